@@ -0,0 +1,129 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <margo.h>
+#include <collector/collector-server.h>
+#include <collector/collector-client.h>
+#include <collector/collector-metric.h>
+#include <collector/collector-common.h>
+
+/*
+ * Measures the time a single client takes to fetch one metric from each
+ * of many local providers, with blocking fetches issued one after the
+ * other and with non-blocking fetches kept in flight (at most [window]
+ * at a time). Usage: bench-fanout [providers] [samples per fetch] [window]
+ */
+
+static double fetch_blocking(collector_metric_handle_t* handles, int num_providers, int64_t num_samples)
+{
+    double t_start = ABT_get_wtime();
+    int i;
+    for(i = 0; i < num_providers; i++) {
+        collector_metric_buffer buf;
+        char *name, *ns;
+        int64_t count = num_samples;
+        collector_remote_metric_fetch(handles[i], &count, &buf, &name, &ns);
+        free(buf);
+        free(name);
+        free(ns);
+    }
+    return ABT_get_wtime() - t_start;
+}
+
+struct fetch_result {
+    collector_metric_buffer buf;
+    char*                   name;
+    char*                   ns;
+    int64_t                 count;
+};
+
+static double fetch_async(collector_metric_handle_t* handles, int num_providers, int64_t num_samples, int window)
+{
+    collector_request_t* reqs = (collector_request_t*)calloc(window, sizeof(*reqs));
+    struct fetch_result* results = (struct fetch_result*)calloc(window, sizeof(*results));
+    double t_start = ABT_get_wtime();
+    int next = 0, pending = 0;
+    size_t index;
+
+    /* fill the window, then issue a new fetch each time one completes */
+    for(index = 0; index < (size_t)window && next < num_providers; index++, next++, pending++) {
+        results[index].count = num_samples;
+        collector_remote_metric_ifetch(handles[next], &results[index].count, &results[index].buf,
+                &results[index].name, &results[index].ns, &reqs[index]);
+    }
+    while(pending) {
+        collector_request_wait_any(window, reqs, &index);
+        free(results[index].buf);
+        free(results[index].name);
+        free(results[index].ns);
+        pending--;
+        if(next < num_providers) {
+            results[index].count = num_samples;
+            collector_remote_metric_ifetch(handles[next], &results[index].count, &results[index].buf,
+                    &results[index].name, &results[index].ns, &reqs[index]);
+            next++;
+            pending++;
+        }
+    }
+
+    double t = ABT_get_wtime() - t_start;
+    free(results);
+    free(reqs);
+    return t;
+}
+
+int main(int argc, char** argv)
+{
+    int num_providers   = argc > 1 ? atoi(argv[1]) : 256;
+    int64_t num_samples = argc > 2 ? atol(argv[2]) : 1000;
+    int window          = argc > 3 ? atoi(argv[3]) : 64;
+    int i, j;
+
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 4);
+    assert(mid);
+
+    hg_addr_t addr;
+    margo_addr_self(mid, &addr);
+
+    collector_client_t client;
+    collector_client_init(mid, &client);
+
+    collector_taglist_t taglist;
+    collector_taglist_create(&taglist, 0);
+
+    /* one provider per simulated server, each with one metric */
+    collector_provider_t* providers = (collector_provider_t*)calloc(num_providers, sizeof(*providers));
+    collector_metric_handle_t* handles = (collector_metric_handle_t*)calloc(num_providers, sizeof(*handles));
+    collector_metric_id_t id;
+    collector_remote_metric_get_id("bench", "fanout", taglist, &id);
+    for(i = 0; i < num_providers; i++) {
+        collector_metric_t m;
+        collector_provider_register(mid, i + 1, NULL, &providers[i]);
+        collector_metric_create("bench", "fanout", COLLECTOR_TYPE_GAUGE,
+                "fan-out benchmark", taglist, &m, providers[i]);
+        for(j = 0; j < num_samples; j++)
+            collector_metric_update(m, (double)j);
+        collector_remote_metric_handle_create(client, addr, i + 1, id, &handles[i]);
+    }
+
+    double t_blocking = fetch_blocking(handles, num_providers, num_samples);
+    double t_async    = fetch_async(handles, num_providers, num_samples, window);
+    printf("# providers  samples  window  blocking (s)  async (s)\n");
+    printf("%11d  %7ld  %6d  %12.6f  %9.6f\n", num_providers, num_samples, window, t_blocking, t_async);
+
+    for(i = 0; i < num_providers; i++)
+        collector_remote_metric_handle_release(handles[i]);
+    free(handles);
+    free(providers);
+    collector_taglist_destroy(taglist);
+    collector_client_finalize(client);
+    margo_addr_free(mid, addr);
+    margo_finalize(mid);
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <margo.h>
+#include <collector/collector-server.h>
+#include <collector/collector-client.h>
+#include <collector/collector-metric.h>
+#include <collector/collector-common.h>
+
+/*
+ * Measures the latency of collector_remote_metric_fetch as a function of
+ * the number of samples fetched. Fetches of up to COLLECTOR_FETCH_INLINE_MAX
+ * samples are sent inline in the response, larger ones use a bulk transfer.
+ * Usage: bench-fetch [address protocol] [fetches per size]
+ */
+
+int main(int argc, char** argv)
+{
+    const char* protocol = argc > 1 ? argv[1] : "na+sm";
+    int num_fetches      = argc > 2 ? atoi(argv[2]) : 10000;
+    int64_t sizes[] = { 1, 16, 64, COLLECTOR_FETCH_INLINE_MAX,
+                        COLLECTOR_FETCH_INLINE_MAX + 1, 512, 4096, 65536 };
+    size_t s;
+    int i;
+
+    margo_instance_id mid = margo_init(protocol, MARGO_SERVER_MODE, 0, 1);
+    assert(mid);
+
+    hg_addr_t addr;
+    margo_addr_self(mid, &addr);
+
+    collector_provider_t provider;
+    collector_provider_register(mid, 42, NULL, &provider);
+
+    collector_client_t client;
+    collector_client_init(mid, &client);
+
+    collector_taglist_t taglist;
+    collector_taglist_create(&taglist, 0);
+
+    /* enough samples for the largest fetch */
+    collector_metric_t m;
+    collector_metric_create("bench", "fetch", COLLECTOR_TYPE_GAUGE,
+            "fetch benchmark", taglist, &m, provider);
+    for(i = 0; i < 65536; i++)
+        collector_metric_update(m, (double)i);
+
+    collector_metric_id_t id;
+    collector_metric_handle_t rh;
+    collector_remote_metric_get_id("bench", "fetch", taglist, &id);
+    collector_remote_metric_handle_create(client, addr, 42, id, &rh);
+
+    printf("# samples  path    latency (us)\n");
+    for(s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        double t_start = ABT_get_wtime(), t_end;
+        for(i = 0; i < num_fetches; i++) {
+            collector_metric_buffer buf;
+            char *name, *ns;
+            int64_t count = sizes[s];
+            if(i == 1) t_start = ABT_get_wtime(); /* first fetch is a warm-up */
+            collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+            assert(count == sizes[s]);
+            free(buf);
+            free(name);
+            free(ns);
+        }
+        t_end = ABT_get_wtime();
+        printf("%9ld  %-6s  %12.2f\n", sizes[s],
+               sizes[s] <= COLLECTOR_FETCH_INLINE_MAX ? "inline" : "bulk",
+               (t_end - t_start)*1e6/(num_fetches - 1));
+    }
+
+    collector_remote_metric_handle_release(rh);
+    collector_metric_destroy(m, provider);
+    collector_taglist_destroy(taglist);
+    collector_client_finalize(client);
+    margo_addr_free(mid, addr);
+    margo_finalize(mid);
+
+    return 0;
+}
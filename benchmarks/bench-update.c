@@ -0,0 +1,100 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <margo.h>
+#include <collector/collector-server.h>
+#include <collector/collector-metric.h>
+#include <collector/collector-common.h>
+
+/*
+ * Measures how collector_metric_update scales with the number of
+ * execution streams, for a metric protected by its mutex and for a
+ * sharded metric. Usage: bench-update [max ES] [ULTs per ES] [updates per ULT]
+ */
+
+struct ult_args {
+    collector_metric_t m;
+    int                num_updates;
+};
+
+static void update_ult(void* arg)
+{
+    struct ult_args* a = (struct ult_args*)arg;
+    int i;
+    for(i = 0; i < a->num_updates; i++)
+        collector_metric_update(a->m, (double)i);
+}
+
+static double run(collector_provider_t provider, collector_taglist_t taglist, uint8_t sharded,
+                  int num_es, int ults_per_es, int num_updates)
+{
+    ABT_xstream* xstreams = (ABT_xstream*)calloc(num_es, sizeof(*xstreams));
+    ABT_thread*  threads  = (ABT_thread*)calloc(num_es*ults_per_es, sizeof(*threads));
+    collector_metric_t m;
+    double t_start, t_end;
+    int i, j;
+
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.sharded = sharded;
+    collector_metric_create_ext("bench", "update", COLLECTOR_TYPE_TIMER,
+            "update benchmark", taglist, &args, &m, provider);
+    struct ult_args a = { m, num_updates };
+
+    for(i = 0; i < num_es; i++)
+        ABT_xstream_create(ABT_SCHED_NULL, &xstreams[i]);
+
+    t_start = ABT_get_wtime();
+    for(i = 0; i < num_es; i++) {
+        ABT_pool pool;
+        ABT_xstream_get_main_pools(xstreams[i], 1, &pool);
+        for(j = 0; j < ults_per_es; j++)
+            ABT_thread_create(pool, update_ult, &a, ABT_THREAD_ATTR_NULL, &threads[i*ults_per_es+j]);
+    }
+    for(i = 0; i < num_es*ults_per_es; i++)
+        ABT_thread_free(&threads[i]);
+    t_end = ABT_get_wtime();
+
+    for(i = 0; i < num_es; i++) {
+        ABT_xstream_join(xstreams[i]);
+        ABT_xstream_free(&xstreams[i]);
+    }
+    collector_metric_destroy(m, provider);
+    free(threads);
+    free(xstreams);
+
+    return ((double)num_es*ults_per_es*num_updates)/(t_end - t_start);
+}
+
+int main(int argc, char** argv)
+{
+    int max_es      = argc > 1 ? atoi(argv[1]) : 8;
+    int ults_per_es = argc > 2 ? atoi(argv[2]) : 16;
+    int num_updates = argc > 3 ? atoi(argv[3]) : 100000;
+    int num_es;
+
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    assert(mid);
+
+    collector_provider_t provider;
+    collector_provider_register(mid, 42, NULL, &provider);
+
+    collector_taglist_t taglist;
+    collector_taglist_create(&taglist, 0);
+
+    printf("# ES  mutex (updates/s)  sharded (updates/s)\n");
+    for(num_es = 1; num_es <= max_es; num_es *= 2) {
+        double locked  = run(provider, taglist, 0, num_es, ults_per_es, num_updates);
+        double sharded = run(provider, taglist, 1, num_es, ults_per_es, num_updates);
+        printf("%4d  %18.0f  %19.0f\n", num_es, locked, sharded);
+    }
+
+    collector_taglist_destroy(taglist);
+    margo_finalize(mid);
+
+    return 0;
+}
@@ -4,6 +4,7 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <stdio.h>
+#include <inttypes.h>
 #include <margo.h>
 #include <assert.h>
 #include <collector/collector-client.h>
@@ -55,7 +56,7 @@ int main(int argc, char** argv)
 
     collector_metric_id_t id;
     collector_remote_metric_get_id("srini", "testmetric2", taglist, &id);
-    fprintf(stderr, "Retrieved metric id is: %d\n", id);
+    fprintf(stderr, "Retrieved metric id is: %" PRIu64 "\n", id);
 
     if(ret != COLLECTOR_SUCCESS) {
 	fprintf(stderr, "collector_remote_list_metrics failed (ret = %d)\n", ret);
@@ -63,7 +64,7 @@ int main(int argc, char** argv)
 	fprintf(stderr, "Retrieved a total of %lu metrics\n", count);
         size_t j = 0;
         for(j = 0; j < count; j++)
-           fprintf(stderr, "Retrieved metric with id: %d\n", ids[j]);
+           fprintf(stderr, "Retrieved metric with id: %" PRIu64 "\n", ids[j]);
     }
 
     ret = collector_remote_metric_handle_create(
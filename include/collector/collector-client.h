@@ -35,6 +35,19 @@ collector_return_t collector_client_init(margo_instance_id mid, collector_client
  */
 collector_return_t collector_client_finalize(collector_client_t client);
 
+/**
+ * @brief Sets the encodings that the client accepts for the samples of
+ * collector_remote_metric_fetch and collector_remote_metric_ifetch
+ * (COLLECTOR_ENCODING_ALL by default). The samples are decoded on
+ * reception; the provider always may send them RAW.
+ *
+ * @param[in] client COLLECTOR client
+ * @param[in] encodings bitwise OR of COLLECTOR_ENCODING_* values
+ *
+ * @return COLLECTOR_SUCCESS or error code defined in collector-common.h
+ */
+collector_return_t collector_client_set_fetch_encodings(collector_client_t client, uint32_t encodings);
+
 #ifdef __cplusplus
 }
 #endif
@@ -30,21 +30,37 @@ typedef enum collector_return_t {
     COLLECTOR_ERR_FROM_ARGOBOTS,     /* Argobots error */
     COLLECTOR_ERR_OP_UNSUPPORTED,    /* Unsupported operation */
     COLLECTOR_ERR_OP_FORBIDDEN,      /* Forbidden operation */
+    COLLECTOR_ERR_METRIC_EXISTS,     /* Metric creation error - same ns, name and tags as an existing metric */
+    COLLECTOR_ERR_ID_COLLISION,      /* Metric creation error - id of a different existing metric */
+    COLLECTOR_ERR_IO,                /* File read or write error */
     /* ... TODO add more error codes here if needed */
     COLLECTOR_ERR_OTHER              /* Other error */
 } collector_return_t;
 
 #define METRIC_BUFFER_SIZE 160000000
+/* Largest total number of samples of a batch fetch, each metric's count
+ * being capped at METRIC_BUFFER_SIZE as for single fetches */
+#define COLLECTOR_FETCH_BATCH_MAX_SAMPLES METRIC_BUFFER_SIZE
+/* Largest fetch whose samples are sent in the RPC response rather than
+ * with a bulk transfer (the response then fits in a 4 KiB eager buffer) */
+#define COLLECTOR_FETCH_INLINE_MAX 128
+/* Largest size in bytes of the metric metadata records that a listing
+ * sends in the RPC response rather than with a bulk transfer */
+#define COLLECTOR_LIST_INLINE_MAX 3072
 
 /**
- * @brief Identifier for a metric.
+ * @brief Identifier for a metric, computed from its namespace, name and
+ * tags by collector_metric_id. Clients compute it once and then address
+ * the metric without sending or hashing strings.
  */
-typedef uint32_t collector_metric_id_t;
+typedef uint64_t collector_metric_id_t;
 
 typedef enum collector_metric_type {
    COLLECTOR_TYPE_COUNTER,
    COLLECTOR_TYPE_TIMER,
-   COLLECTOR_TYPE_GAUGE    
+   COLLECTOR_TYPE_GAUGE,
+   COLLECTOR_TYPE_HISTOGRAM, /* bucket counts only, see collector_metric_args */
+   COLLECTOR_TYPE_SKETCH     /* quantile sketch only, see collector-sketch.h */
 } collector_metric_type_t;
 
 typedef struct collector_metric_sample {
@@ -55,6 +71,55 @@ typedef struct collector_metric_sample {
 
 typedef collector_metric_sample* collector_metric_buffer;
 
+/* Fields of the samples, selected by a column fetch */
+#define COLLECTOR_COLUMN_TIME      0x1
+#define COLLECTOR_COLUMN_VAL       0x2
+#define COLLECTOR_COLUMN_SAMPLE_ID 0x4
+#define COLLECTOR_COLUMN_ALL       0x7
+
+/* Encodings of the samples of a fetch transfer. A client offers a set of
+ * them (see collector_client_set_fetch_encodings) and the provider picks
+ * the most compact one, falling back to RAW when encoding doesn't make
+ * the samples smaller */
+#define COLLECTOR_ENCODING_RAW     0x1
+#define COLLECTOR_ENCODING_DELTA   0x2 /* delta and varint */
+#define COLLECTOR_ENCODING_GORILLA 0x4 /* delta-of-delta and XOR, see gorilla.h */
+#define COLLECTOR_ENCODING_ALL     0x7
+
+/* Downsampling methods of collector_remote_metric_fetch_downsampled, which
+ * split the samples into buckets of equally many samples */
+typedef enum collector_downsample_method {
+   COLLECTOR_DOWNSAMPLE_LTTB,  /* largest triangle three buckets: one sample per bucket */
+   COLLECTOR_DOWNSAMPLE_MINMAX /* samples of lowest and highest value: two per bucket */
+} collector_downsample_method_t;
+
+/* Largest number of points of a downsampled fetch */
+#define COLLECTOR_DOWNSAMPLE_MAX_POINTS 1048576
+
+/* Largest size in bytes of the series that a query sends in the RPC
+ * response rather than with a bulk transfer */
+#define COLLECTOR_QUERY_INLINE_MAX 3072
+/* Largest number of windows and of aggregations of a query */
+#define COLLECTOR_QUERY_MAX_WINDOWS 1048576
+#define COLLECTOR_QUERY_MAX_AGGS    16
+
+/* Aggregation functions computed by a query over each window */
+typedef enum collector_agg_type {
+   COLLECTOR_AGG_COUNT,
+   COLLECTOR_AGG_SUM,
+   COLLECTOR_AGG_MIN,
+   COLLECTOR_AGG_MAX,
+   COLLECTOR_AGG_AVG,
+   COLLECTOR_AGG_STDDEV,  /* population standard deviation */
+   COLLECTOR_AGG_QUANTILE, /* nearest-rank quantile q of the values (not answered by rollups) */
+   COLLECTOR_AGG_LAST      /* value of the latest sample */
+} collector_agg_type_t;
+
+typedef struct collector_agg {
+   collector_agg_type_t type;
+   double q; /* in [0, 1], for COLLECTOR_AGG_QUANTILE */
+} collector_agg;
+
 typedef struct collector_taglist {
     char **taglist;
     int num_tags;
@@ -64,8 +129,6 @@ typedef collector_taglist* collector_taglist_t;
 
 inline uint32_t collector_hash(char *str);
 
-inline void collector_id_from_string_identifiers(char *ns, char *name, char **taglist, int num_tags, collector_metric_id_t *id_);
-
 /* djb2 hash from Dan Bernstein */
 inline uint32_t
 collector_hash(char *str)
@@ -81,22 +144,53 @@ collector_hash(char *str)
 }
 
 
-inline void collector_id_from_string_identifiers(char *ns, char *name, char **taglist, int num_tags, collector_metric_id_t *id_)
+/* murmur3 finalizer, spreading every input bit over the whole hash */
+static inline uint64_t collector_hash64_mix(uint64_t h)
 {
-    collector_metric_id_t id, temp_id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
 
-    id = collector_hash(ns);
-    temp_id = collector_hash(name);
-    id = id^temp_id;
+/* 64-bit FNV-1a hash, finalized with collector_hash64_mix */
+static inline uint64_t collector_hash64(const char *str)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
 
-    /* XOR all the tag ids, so that any ordering of tags returns the same final metric id */
-    int i;
-    for(i = 0; i < num_tags; i++) {
-	temp_id = collector_hash(taglist[i]);
-	id = id^temp_id;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 0x100000001b3ULL;
     }
-   
-    *id_ = id;
+
+    return collector_hash64_mix(hash);
+}
+
+/* Combines two hashes, depending on their order */
+static inline uint64_t collector_hash64_combine(uint64_t h, uint64_t v)
+{
+    return collector_hash64_mix(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+/* Metric id of a namespace, name and list of tags. The hashes of the tags
+ * are added, so that any ordering of tags gives the same id (as if they
+ * were sorted) while, unlike with XOR, duplicate tags don't cancel out */
+static inline collector_metric_id_t collector_metric_id(const char *ns, const char *name, char *const *taglist, int num_tags)
+{
+    uint64_t tags_hash = 0;
+    int i;
+
+    for(i = 0; i < num_tags; i++)
+        tags_hash += collector_hash64(taglist[i]);
+
+    return collector_hash64_combine(collector_hash64_combine(collector_hash64(ns), collector_hash64(name)), tags_hash);
+}
+
+static inline void collector_id_from_string_identifiers(char *ns, char *name, char **taglist, int num_tags, collector_metric_id_t *id_)
+{
+    *id_ = collector_metric_id(ns, name, taglist, num_tags);
 }
 
 #ifdef __cplusplus
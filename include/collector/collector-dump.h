@@ -0,0 +1,105 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __COLLECTOR_DUMP_H
+#define __COLLECTOR_DUMP_H
+
+#include <stddef.h>
+#include <collector/collector-common.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Binary dump of the samples of a metric, written by
+ * collector_metric_dump_raw_data. A dump file is made of:
+ *
+ * - a collector_dump_header;
+ * - the strings section: the namespace, name, description and tags of
+ *   the metric, each terminated by a NUL byte;
+ * - from data_offset (a multiple of COLLECTOR_DUMP_ALIGN) on, the samples
+ *   in time order, in chunks of chunk_samples samples (the last one may
+ *   be shorter). A chunk of n samples holds the columns time[n], val[n]
+ *   and sample_id[n] one after the other, so chunk c starts at
+ *   data_offset + c*chunk_samples*COLLECTOR_DUMP_SAMPLE_SIZE.
+ *
+ * Numbers are in the byte order of the host that wrote the dump, which
+ * byte_order records. Dumps are meant to be mapped in memory and read in
+ * place, e.g. with collector_dump_open.
+ */
+#define COLLECTOR_DUMP_MAGIC       "COLLDUMP"
+#define COLLECTOR_DUMP_VERSION     1
+#define COLLECTOR_DUMP_BYTE_ORDER  0x01020304
+#define COLLECTOR_DUMP_ALIGN       64
+#define COLLECTOR_DUMP_SAMPLE_SIZE (2*sizeof(double) + sizeof(uint64_t))
+
+typedef struct collector_dump_header {
+    char     magic[8];      /* COLLECTOR_DUMP_MAGIC, without its NUL byte */
+    uint32_t version;       /* COLLECTOR_DUMP_VERSION */
+    uint32_t byte_order;    /* COLLECTOR_DUMP_BYTE_ORDER, as written by the host */
+    uint64_t header_size;   /* sizeof(collector_dump_header), the strings section follows */
+    uint64_t id;            /* collector_metric_id_t of the metric */
+    uint32_t type;          /* collector_metric_type_t of the metric */
+    uint32_t num_tags;
+    uint64_t num_samples;
+    uint64_t chunk_samples;
+    uint64_t strings_size;  /* size of the strings section */
+    uint64_t data_offset;
+} collector_dump_header;
+
+typedef struct collector_dump* collector_dump_t;
+#define COLLECTOR_DUMP_NULL ((collector_dump_t)NULL)
+
+/**
+ * @brief Metadata of the metric of a dump, pointing into the dump.
+ */
+typedef struct collector_dump_info {
+    collector_metric_id_t   id;
+    collector_metric_type_t type;
+    uint64_t                num_samples;
+    uint64_t                num_chunks;
+    const char*             ns;
+    const char*             name;
+    const char*             desc;
+    size_t                  num_tags;
+    const char* const*      tags;
+} collector_dump_info;
+
+/**
+ * @brief Maps a dump file in memory and checks its header.
+ *
+ * @param[in] filename dump written by collector_metric_dump_raw_data
+ * @param[out] dump dump to close
+ *
+ * @return COLLECTOR_SUCCESS, COLLECTOR_ERR_IO if the file can't be read,
+ * COLLECTOR_ERR_INVALID_ARGS if it isn't a valid dump or
+ * COLLECTOR_ERR_OP_UNSUPPORTED if it was written with another version
+ * or byte order
+ */
+collector_return_t collector_dump_open(const char* filename, collector_dump_t* dump);
+
+/**
+ * @brief Unmaps a dump, invalidating the pointers into it.
+ */
+collector_return_t collector_dump_close(collector_dump_t dump);
+
+/**
+ * @brief Returns the metadata of the metric of a dump.
+ */
+collector_return_t collector_dump_get_info(collector_dump_t dump, collector_dump_info* info);
+
+/**
+ * @brief Points the arrays of the columns of chunk c of a dump into the
+ * mapping and returns its number of samples (0 if there is no chunk c).
+ * Any of time, val and sample_id may be NULL.
+ */
+uint64_t collector_dump_chunk(collector_dump_t dump, uint64_t c, const double** time, const double** val, const uint64_t** sample_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
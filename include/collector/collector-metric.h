@@ -9,6 +9,7 @@
 #include <margo.h>
 #include <collector/collector-common.h>
 #include <collector/collector-client.h>
+#include <collector/collector-sketch.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,26 +24,212 @@ typedef struct collector_metric_sample* collector_metric_buffer;
 typedef struct collector_metric_sample collector_metric_sample;
 typedef void (*func)();
 #define COLLECTOR_METRIC_HANDLE_NULL ((collector_metric_handle_t)NULL)
+typedef struct collector_request* collector_request_t;
+#define COLLECTOR_REQUEST_NULL ((collector_request_t)NULL)
+typedef struct collector_cursor* collector_cursor_t;
+#define COLLECTOR_CURSOR_NULL ((collector_cursor_t)NULL)
+
+/**
+ * @brief Metadata of a metric returned by collector_remote_list_metrics_ext.
+ */
+typedef struct collector_metric_info {
+    collector_metric_id_t   id;
+    collector_metric_type_t type;
+    uint64_t                num_samples; // samples currently retained by the metric
+    const char*             ns;
+    const char*             name;
+    size_t                  num_tags;
+    const char* const*      tags;
+} collector_metric_info;
+
+/**
+ * @brief Summary of the samples of a metric returned by
+ * collector_remote_metric_fetch_stats (all 0 if there are none).
+ */
+typedef struct collector_metric_stats {
+    uint64_t count;
+    uint64_t num_above; // samples whose value is greater than the threshold
+    double   min;
+    double   max;
+    double   sum;
+    double   mean;
+    double   variance;  // population variance
+} collector_metric_stats;
+
+/**
+ * @brief Series of aggregated points returned by a query: values[w*num_aggs + a]
+ * is aggregation a over window w of the samples of the metrics of the series.
+ * Windows without samples have a count and a sum of 0, and NaN for the other
+ * aggregations.
+ */
+typedef struct collector_query_series {
+    collector_metric_id_t id;          // metric of the series, 0 for a group of metrics
+    const char*           group;       // label "key=value" of the group ("" for the metrics without the key, or for a
+                                       // single group), NULL if the series is a single metric
+    uint64_t              num_metrics; // metrics aggregated in the series
+    const double*         values;
+} collector_query_series;
+
+/* Pagination token of the first page of a listing, and token returned
+ * after the last page */
+#define COLLECTOR_LIST_BEGIN 0
+#define COLLECTOR_LIST_END UINT64_MAX
+
+/**
+ * @brief Optional per-metric settings for collector_metric_create_ext.
+ */
+/* Rollup tier of a ring-mode metric: the samples that age out of the ring
+ * are summarized (count, sum, min, max, mean and deviation, last value)
+ * in buckets of resolution seconds, the last ones of which cover the
+ * latest retention seconds. The buckets that age out of a tier are merged
+ * into the next one, which must have a coarser resolution */
+struct collector_rollup_tier_args {
+    double resolution;
+    double retention;
+};
+
+struct collector_metric_args {
+    uint64_t max_samples; // Ring mode: retain only the latest max_samples samples (0 = unbounded, per shard if sharded)
+    uint8_t  sharded;     // Lock-free updates into one store per execution stream
+    uint8_t  columnar;    // Store the times, values and ids of the samples in separate arrays (faster scans over values)
+    uint8_t  compressed;  // Compress the samples of each chunk once it is full (unbounded, unsharded metrics only)
+    double   sampling_period; // Counters and gauges: update a value in place and record it every sampling_period seconds (0 = record every update)
+    /* Histograms: either num_bounds sorted upper bounds (num_bounds+1 buckets),
+     * or, if bounds is NULL, log-linear buckets splitting each power of two in
+     * [histogram_min, histogram_max) into histogram_sub_buckets linear buckets */
+    const double* bounds;
+    size_t        num_bounds;
+    double        histogram_min;
+    double        histogram_max;
+    uint32_t      histogram_sub_buckets;
+    /* Sketches: relative accuracy of the quantiles (0 = 0.01), for values in
+     * [sketch_min, sketch_max] (0 = 1e-9 and 1e9); lower values count as 0 */
+    double        sketch_relative_accuracy;
+    double        sketch_min;
+    double        sketch_max;
+    /* Counters, timers and gauges in ring mode, unsharded: rollup tiers,
+     * from the finest to the coarsest, which queries use for windows of
+     * at least their resolution */
+    const struct collector_rollup_tier_args* rollups;
+    size_t        num_rollups;
+    // ...
+};
+
+#define COLLECTOR_METRIC_ARGS_INIT { \
+    .max_samples = 0, \
+    .sharded = 0, \
+    .columnar = 0, \
+    .compressed = 0, \
+    .sampling_period = 0, \
+    .bounds = NULL, \
+    .num_bounds = 0, \
+    .histogram_min = 0, \
+    .histogram_max = 0, \
+    .histogram_sub_buckets = 0, \
+    .sketch_relative_accuracy = 0, \
+    .sketch_min = 0, \
+    .sketch_max = 0, \
+    .rollups = NULL, \
+    .num_rollups = 0 \
+}
 
 /* APIs for providers to record performance data */
 collector_return_t collector_taglist_create(collector_taglist_t *taglist, int num_tags, ...);
+/* creates a taglist of num_labels key/value labels from num_labels pairs of (non-empty) key and value strings;
+ * a label is the tag "key=value", which providers intern once and can group metrics by */
+collector_return_t collector_taglist_create_labels(collector_taglist_t *taglist, int num_labels, ...);
 collector_return_t collector_taglist_destroy(collector_taglist_t taglist);
 collector_return_t collector_metric_create(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t taglist, collector_metric_t* metric_handle, collector_provider_t provider);
+collector_return_t collector_metric_create_ext(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t taglist, const struct collector_metric_args* args, collector_metric_t* metric_handle, collector_provider_t provider);
 collector_return_t collector_metric_destroy(collector_metric_t m, collector_provider_t provider);
 collector_return_t collector_metric_destroy_all(collector_provider_t provider);
 collector_return_t collector_metric_update(collector_metric_t m, double val);
 collector_return_t collector_metric_update_gauge_by_fixed_amount(collector_metric_t m, double diff);
 collector_return_t collector_metric_dump_histogram(collector_metric_t m, const char *filename, size_t num_buckets);
+/* writes the samples of a metric, in time order, to a binary columnar dump (see collector-dump.h) that can be mapped
+ * in memory with collector_dump_open, or converted to CSV or JSON with the collector-dump-convert tool */
 collector_return_t collector_metric_dump_raw_data(collector_metric_t m, const char *filename);
 collector_return_t collector_metric_class_register_retrieval_callback(char *ns, func f);
 
 /* APIs for remote clients to request for performance data */
+/* computes the id of a metric locally, as its provider does: ids can be computed once and cached */
 collector_return_t collector_remote_metric_get_id(char *ns, char *name, collector_taglist_t taglist, collector_metric_id_t* metric_id);
 collector_return_t collector_remote_metric_handle_create(collector_client_t client, hg_addr_t addr, uint16_t provider_id, collector_metric_id_t metric_id, collector_metric_handle_t* handle);
 collector_return_t collector_remote_metric_handle_ref_incr(collector_metric_handle_t handle);
 collector_return_t collector_remote_metric_handle_release(collector_metric_handle_t handle);
 collector_return_t collector_remote_metric_fetch(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns);
+/* same as collector_remote_metric_fetch, also returning the sequence number of buf[0] and
+ * the number of samples ever recorded by the metric, so that the samples of a fetch are those of
+ * sequence numbers first_seq to next_seq-1. A poller keeps the next_seq of its previous fetch: if
+ * the first_seq of a fetch is greater, the samples in between were missed, either overwritten by a
+ * ring-mode metric or not requested */
+collector_return_t collector_remote_metric_fetch_with_seq(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns, uint64_t *first_seq, uint64_t *next_seq);
+/* fetches the samples recorded in [t_start, t_end), oldest first; *num_samples is the maximum number of samples
+ * to fetch (all the samples of the range if negative) and is set to the number of samples in buf (to free) */
+collector_return_t collector_remote_metric_fetch_range(collector_metric_handle_t handle, double t_start, double t_end, int64_t *num_samples, collector_metric_buffer *buf);
+/* fetches at most *num_points points summarizing the samples recorded in [t_start, t_end) (all the samples if there
+ * are no more), oldest first, downsampled by the provider with method (a COLLECTOR_DOWNSAMPLE_* value) so that the
+ * transfer doesn't depend on the number of samples; *num_points is set to the number of points in buf (to free) */
+collector_return_t collector_remote_metric_fetch_downsampled(collector_metric_handle_t handle, double t_start, double t_end, uint32_t method, int64_t *num_points, collector_metric_buffer *buf);
+/* cursor of an incremental fetch, initially before the first sample of the metric */
+collector_return_t collector_cursor_create(collector_cursor_t *cursor);
+collector_return_t collector_cursor_destroy(collector_cursor_t cursor);
+/* fetches the (at most *num_samples, all of them if not positive) samples recorded since the cursor, oldest
+ * first, and advances the cursor past them; *dropped (if not NULL) is set to the number of samples after the
+ * cursor that a ring-mode metric no longer retains. Polling with the same cursor only transfers the samples
+ * recorded in between */
+collector_return_t collector_remote_metric_fetch_since(collector_metric_handle_t handle, collector_cursor_t cursor, int64_t *num_samples, collector_metric_buffer *buf, uint64_t *dropped);
+/* fetches the latest (at most *num_samples, all of them if not positive) samples of a metric, oldest first, as
+ * separate arrays, transferring only the fields selected by columns (COLLECTOR_COLUMN_* flags); the array of
+ * each selected field is allocated by the call and must be freed, the others are set to NULL. Cheapest on
+ * metrics created with the columnar argument */
+collector_return_t collector_remote_metric_fetch_columns(collector_metric_handle_t handle, int64_t *num_samples, uint32_t columns, double **times, double **vals, uint64_t **sample_ids);
+/* fetches the latest (at most counts[i]) samples of each of num_metrics metrics of a provider with a single RPC and
+ * bulk transfer; the samples of metric i are (*buf)[offsets[i]] to (*buf)[offsets[i+1]-1], offsets having room for
+ * num_metrics+1 entries, and rets[i] (if rets is not NULL) is the status of metric i (e.g. for an unknown id); the
+ * counts, each capped at METRIC_BUFFER_SIZE, may add up to at most COLLECTOR_FETCH_BATCH_MAX_SAMPLES */
+collector_return_t collector_remote_metric_fetch_batch(collector_client_t client, hg_addr_t addr, uint16_t provider_id, size_t num_metrics, const collector_metric_id_t *ids, const int64_t *counts, collector_metric_buffer *buf, uint64_t *offsets, collector_return_t *rets);
+/* same as collector_remote_metric_fetch_batch for the metrics of a provider that have the namespace ns and the name
+ * (NULL or "" for any) and all the tags of taglist (NULL for any), fetching at most count samples of each;
+ * *num_metrics is set to their number, and *ids (their ids), *buf and *offsets (num_metrics+1 entries) are allocated
+ * by the call and must be freed. The samples of all the metrics may add up to at most COLLECTOR_FETCH_BATCH_MAX_SAMPLES */
+collector_return_t collector_remote_metric_fetch_batch_select(collector_client_t client, hg_addr_t addr, uint16_t provider_id, const char *ns, const char *name, collector_taglist_t taglist, int64_t count, size_t *num_metrics, collector_metric_id_t **ids, collector_metric_buffer *buf, uint64_t **offsets);
+/* summarizes the samples of a metric recorded in [t_start, t_end) (-INFINITY and INFINITY for all the samples) on
+ * the provider, without transferring them */
+collector_return_t collector_remote_metric_fetch_stats(collector_metric_handle_t handle, double t_start, double t_end, double threshold, collector_metric_stats *stats);
+/* aggregates the samples of a metric on the provider over the windows [t_start + w*step, t_start + (w+1)*step) that
+ * cover [t_start, t_end) (the last one ending at t_end); *num_windows is set to their number and *values, allocated by
+ * the call and freed with free(), to num_windows*num_aggs values laid out as in collector_query_series. Unless a
+ * quantile is requested, the samples that aged out of a ring-mode metric are counted from its rollup tiers having a
+ * resolution of at most step, a bucket falling in the window of its start */
+collector_return_t collector_remote_metric_query(collector_metric_handle_t handle, double t_start, double t_end, double step, size_t num_aggs, const collector_agg *aggs, size_t *num_windows, double **values);
+/* bounds (num_buckets-1 upper bounds) and counts (num_buckets) are allocated by the call and must be freed */
+collector_return_t collector_remote_metric_fetch_histogram(collector_metric_handle_t handle, size_t *num_buckets, double **bounds, uint64_t **counts);
+/* the sketch is created by the call and must be destroyed with collector_sketch_destroy */
+collector_return_t collector_remote_metric_fetch_sketch(collector_metric_handle_t handle, collector_sketch_t *sketch);
 collector_return_t collector_remote_list_metrics(collector_client_t client, hg_addr_t addr, uint16_t provider_id, collector_metric_id_t** ids, size_t* count);
+/* lists one page of the metrics of a provider in namespace ns (any if NULL) having all the tags of taglist (if not NULL),
+ * in creation order; *token is COLLECTOR_LIST_BEGIN for the first page and is set to the token of the next page, or to
+ * COLLECTOR_LIST_END after the last one. *count is the maximum number of metrics of the page (0 for no limit) and is set
+ * to the number of entries of *infos, allocated by the call and freed with a single free() */
+collector_return_t collector_remote_list_metrics_ext(collector_client_t client, hg_addr_t addr, uint16_t provider_id, const char *ns, collector_taglist_t taglist, uint64_t *token, size_t *count, collector_metric_info **infos);
+
+/* same as collector_remote_metric_query, for the metrics of a provider in namespace ns and with name name (any if NULL)
+ * having all the tags of taglist (if not NULL): with a NULL group_by, there is one series per metric; otherwise the
+ * series aggregate the samples of all the metrics having the same label with key group_by (e.g. "host"), or of all
+ * the metrics if group_by is "". *series (*num_series entries) is allocated by the call and freed with a single free() */
+collector_return_t collector_remote_query(collector_client_t client, hg_addr_t addr, uint16_t provider_id, const char *ns, const char *name, collector_taglist_t taglist, const char *group_by, double t_start, double t_end, double step, size_t num_aggs, const collector_agg *aggs, size_t *num_windows, size_t *num_series, collector_query_series **series);
+
+/* Non-blocking variants: the output arguments are set when the request completes, and must remain valid until then */
+collector_return_t collector_remote_metric_ifetch(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns, collector_request_t *req);
+collector_return_t collector_remote_ilist_metrics(collector_client_t client, hg_addr_t addr, uint16_t provider_id, collector_metric_id_t** ids, size_t* count, collector_request_t *req);
+/* waits for a request to complete, frees it, and returns the status of the operation */
+collector_return_t collector_request_wait(collector_request_t req);
+/* sets *flag to 1 if the request has completed (collector_request_wait then returns immediately) */
+collector_return_t collector_request_test(collector_request_t req, int *flag);
+/* waits for any of the requests to complete, frees it and sets reqs[*index] to COLLECTOR_REQUEST_NULL;
+ * returns the status of the completed operation */
+collector_return_t collector_request_wait_any(size_t count, collector_request_t *reqs, size_t *index);
 
 #ifdef __cplusplus
 }
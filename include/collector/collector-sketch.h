@@ -0,0 +1,72 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __COLLECTOR_SKETCH_H
+#define __COLLECTOR_SKETCH_H
+
+#include <stddef.h>
+#include <collector/collector-common.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Quantile sketch (DDSketch) with a relative-error guarantee:
+ * a quantile q is estimated as a value v' such that |v' - v| <= a*v
+ * where v is the exact quantile and a the sketch's relative accuracy.
+ * Sketches with the same relative accuracy can be merged, e.g. to get
+ * global quantiles out of the sketches fetched from many providers.
+ */
+typedef struct collector_sketch* collector_sketch_t;
+#define COLLECTOR_SKETCH_NULL ((collector_sketch_t)NULL)
+
+/**
+ * @brief Creates an empty sketch, e.g. to merge fetched sketches into.
+ *
+ * @param[in] relative_accuracy relative accuracy (e.g. 0.01)
+ * @param[out] sketch new sketch
+ *
+ * @return COLLECTOR_SUCCESS or error code defined in collector-common.h
+ */
+collector_return_t collector_sketch_create(double relative_accuracy, collector_sketch_t* sketch);
+
+/**
+ * @brief Destroys a sketch.
+ */
+collector_return_t collector_sketch_destroy(collector_sketch_t sketch);
+
+/**
+ * @brief Adds the counts of src into dst. Both must have the same
+ * relative accuracy.
+ */
+collector_return_t collector_sketch_merge(collector_sketch_t dst, collector_sketch_t src);
+
+/**
+ * @brief Estimates the q-quantile (0 <= q <= 1) of the values in the sketch.
+ */
+collector_return_t collector_sketch_quantile(collector_sketch_t sketch, double q, double* value);
+
+/**
+ * @brief Returns the number of values added to the sketch.
+ */
+uint64_t collector_sketch_count(collector_sketch_t sketch);
+
+/**
+ * @brief Serializes a sketch into a buffer allocated by the call (to free),
+ * in the format used on the wire by collector_remote_metric_fetch_sketch.
+ */
+collector_return_t collector_sketch_serialize(collector_sketch_t sketch, void** buf, size_t* size);
+
+/**
+ * @brief Creates a sketch from a buffer produced by collector_sketch_serialize.
+ */
+collector_return_t collector_sketch_deserialize(const void* buf, size_t size, collector_sketch_t* sketch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
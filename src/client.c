@@ -3,12 +3,16 @@
  * 
  * See COPYRIGHT in top-level directory.
  */
+#include <inttypes.h>
+#include <math.h>
 #include <stdarg.h>
 #include "types.h"
 #include "client.h"
 #include "provider.h"
+#include "encoding.h"
 #include "collector/collector-client.h"
 #include "collector/collector-common.h"
+#include "collector/collector-dump.h"
 
 collector_return_t collector_client_init(margo_instance_id mid, collector_client_t* client)
 {
@@ -23,13 +27,34 @@ collector_return_t collector_client_init(margo_instance_id mid, collector_client
 
     if(flag == HG_TRUE) {
         margo_registered_name(mid, "collector_remote_metric_fetch", &c->metric_fetch_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_range", &c->metric_fetch_range_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_downsampled", &c->metric_fetch_downsampled_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_columns", &c->metric_fetch_columns_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_since", &c->metric_fetch_since_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_batch", &c->metric_fetch_batch_id, &flag);
         margo_registered_name(mid, "collector_remote_list_metrics", &c->list_metrics_id, &flag);
+        margo_registered_name(mid, "collector_remote_list_metrics_ext", &c->list_metrics_ext_id, &flag);
+        margo_registered_name(mid, "collector_remote_query", &c->query_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_stats", &c->metric_fetch_stats_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_histogram", &c->metric_fetch_histogram_id, &flag);
+        margo_registered_name(mid, "collector_remote_metric_fetch_sketch", &c->metric_fetch_sketch_id, &flag);
     } else {
         c->metric_fetch_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch", metric_fetch_in_t, metric_fetch_out_t, NULL);
+        c->metric_fetch_range_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_range", metric_fetch_range_in_t, metric_fetch_range_out_t, NULL);
+        c->metric_fetch_downsampled_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_downsampled", metric_fetch_downsampled_in_t, metric_fetch_downsampled_out_t, NULL);
+        c->metric_fetch_columns_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_columns", metric_fetch_columns_in_t, metric_fetch_columns_out_t, NULL);
+        c->metric_fetch_since_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_since", metric_fetch_since_in_t, metric_fetch_since_out_t, NULL);
+        c->metric_fetch_batch_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_batch", metric_fetch_batch_in_t, metric_fetch_batch_out_t, NULL);
         c->list_metrics_id = MARGO_REGISTER(mid, "collector_remote_list_metrics", list_metrics_in_t, list_metrics_out_t, NULL);
+        c->list_metrics_ext_id = MARGO_REGISTER(mid, "collector_remote_list_metrics_ext", list_metrics_ext_in_t, list_metrics_ext_out_t, NULL);
+        c->query_id = MARGO_REGISTER(mid, "collector_remote_query", query_in_t, query_out_t, NULL);
+        c->metric_fetch_stats_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_stats", metric_fetch_stats_in_t, metric_fetch_stats_out_t, NULL);
+        c->metric_fetch_histogram_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_histogram", metric_fetch_histogram_in_t, metric_fetch_histogram_out_t, NULL);
+        c->metric_fetch_sketch_id = MARGO_REGISTER(mid, "collector_remote_metric_fetch_sketch", metric_fetch_sketch_in_t, metric_fetch_sketch_out_t, NULL);
     }
 
     c->num_metric_handles = 0;
+    c->fetch_encodings = COLLECTOR_ENCODING_ALL;
     *client = c;
     return COLLECTOR_SUCCESS;
 }
@@ -45,25 +70,81 @@ collector_return_t collector_client_finalize(collector_client_t client)
     return COLLECTOR_SUCCESS;
 }
 
+collector_return_t collector_client_set_fetch_encodings(collector_client_t client, uint32_t encodings)
+{
+    if(encodings & ~(uint32_t)COLLECTOR_ENCODING_ALL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    client->fetch_encodings = encodings | COLLECTOR_ENCODING_RAW;
+    return COLLECTOR_SUCCESS;
+}
+
 /* APIs for microservice clients */
+static collector_return_t taglist_alloc(collector_taglist_t *taglist, int num_tags)
+{
+    *taglist = (collector_taglist_t)calloc(1, sizeof(collector_taglist));
+    if(!*taglist)
+        return COLLECTOR_ERR_ALLOCATION;
+    (*taglist)->taglist = (char **)calloc(num_tags ? num_tags : 1, sizeof(char*));
+    if(!(*taglist)->taglist) {
+        free(*taglist);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    return COLLECTOR_SUCCESS;
+}
+
 collector_return_t collector_taglist_create(collector_taglist_t *taglist, int num_tags, ...) 
 {
-    *taglist = (collector_taglist_t)malloc(sizeof(collector_taglist));
+    collector_return_t ret = taglist_alloc(taglist, num_tags);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+
     va_list valist;
     va_start(valist, num_tags);
-
-    (*taglist)->taglist = (char **)malloc(num_tags*sizeof(char*));
-    (*taglist)->num_tags = num_tags;
     int i = 0;
 
     for(i = 0; i < num_tags; i++) {
-        (*taglist)->taglist[i] = (char*)malloc(36*sizeof(char*));
-	strcpy((*taglist)->taglist[i], va_arg(valist, char*));
+        (*taglist)->taglist[i] = strdup(va_arg(valist, char*));
+        if(!(*taglist)->taglist[i]) {
+            ret = COLLECTOR_ERR_ALLOCATION;
+            break;
+        }
+        (*taglist)->num_tags += 1;
     }
 
     va_end(valist);
-    return COLLECTOR_SUCCESS;
+    if(ret != COLLECTOR_SUCCESS)
+        collector_taglist_destroy(*taglist);
+    return ret;
+}
+
+collector_return_t collector_taglist_create_labels(collector_taglist_t *taglist, int num_labels, ...)
+{
+    collector_return_t ret = taglist_alloc(taglist, num_labels);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+
+    va_list valist;
+    va_start(valist, num_labels);
+    int i = 0;
 
+    for(i = 0; i < num_labels; i++) {
+        const char* key = va_arg(valist, const char*);
+        const char* value = va_arg(valist, const char*);
+        char* label = (char*)malloc(strlen(key) + strlen(value) + 2);
+        if(!label || !key[0] || strchr(key, '=')) {
+            free(label);
+            ret = label ? COLLECTOR_ERR_INVALID_ARGS : COLLECTOR_ERR_ALLOCATION;
+            break;
+        }
+        sprintf(label, "%s=%s", key, value);
+        (*taglist)->taglist[i] = label;
+        (*taglist)->num_tags += 1;
+    }
+
+    va_end(valist);
+    if(ret != COLLECTOR_SUCCESS)
+        collector_taglist_destroy(*taglist);
+    return ret;
 }
 
 collector_return_t collector_taglist_destroy(collector_taglist_t taglist)
@@ -82,7 +163,12 @@ collector_return_t collector_taglist_destroy(collector_taglist_t taglist)
 
 collector_return_t collector_metric_create(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t taglist, collector_metric_t* m, collector_provider_t p)
 {
-    return collector_provider_metric_create(ns, name, t, desc, taglist, m, p);
+    return collector_provider_metric_create(ns, name, t, desc, taglist, NULL, m, p);
+}
+
+collector_return_t collector_metric_create_ext(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t taglist, const struct collector_metric_args* args, collector_metric_t* m, collector_provider_t p)
+{
+    return collector_provider_metric_create(ns, name, t, desc, taglist, args, m, p);
 }
 
 collector_return_t collector_metric_destroy(collector_metric_t m, collector_provider_t p)
@@ -95,11 +181,106 @@ collector_return_t collector_metric_destroy_all(collector_provider_t p)
     return collector_provider_destroy_all_metrics(p);
 }
 
+/* Returns the calling execution stream's shard of a sharded metric,
+ * creating it on first use, or NULL if the caller must append to the
+ * metric's locked store instead (metric not sharded, caller not in an
+ * execution stream, or execution stream rank too high). */
+static collector_sample_store* metric_shard(collector_metric_t m)
+{
+    int rank;
+
+    if(!m->shards)
+        return NULL;
+    if(ABT_self_get_xstream_rank(&rank) != ABT_SUCCESS || rank < 0 || rank >= COLLECTOR_MAX_SHARDS)
+        return NULL;
+
+    /* only ULTs running on this execution stream touch this slot */
+    collector_sample_store* shard = m->shards[rank];
+    if(!shard) {
+        /* own cache line(s), so that shards don't false-share */
+        size_t size = (sizeof(*shard) + COLLECTOR_CACHE_LINE_SIZE - 1) & ~(size_t)(COLLECTOR_CACHE_LINE_SIZE - 1);
+        shard = (collector_sample_store*)aligned_alloc(COLLECTOR_CACHE_LINE_SIZE, size);
+        if(!shard)
+            return NULL;
+        if(collector_store_init(shard, m->store.pool, m->store.max_samples, m->store.columnar, m->store.compressed) != COLLECTOR_SUCCESS) {
+            free(shard);
+            return NULL;
+        }
+        __atomic_store_n(&m->shards[rank], shard, __ATOMIC_RELEASE);
+    }
+    return shard;
+}
+
+/* Appends a sample to the calling execution stream's shard without
+ * locking: appending never yields, so ULTs of the same execution stream
+ * cannot interleave. Falls back to the locked store if there is no shard. */
+static collector_return_t metric_append(collector_metric_t m, collector_sample_store* shard, double val)
+{
+    ABT_unit_id self_id;
+    collector_return_t ret;
+
+    ABT_self_get_thread_id(&self_id);
+
+    if(shard)
+        return collector_store_append(shard, ABT_get_wtime(), val, self_id);
+
+    ABT_mutex_lock(m->metric_mutex);
+    ret = collector_store_append(&m->store, ABT_get_wtime(), val, self_id);
+    if(m->rollup)
+        collector_rollup_age(m->rollup, &m->store);
+    ABT_mutex_unlock(m->metric_mutex);
+
+    return ret;
+}
+
+/* Updates the value of a sampled metric in place. Its samples are
+ * recorded by the provider's sampler. */
+static collector_return_t sampled_metric_update(collector_metric_t m, double val)
+{
+    double current;
+
+    switch(m->type) {
+        case COLLECTOR_TYPE_COUNTER:
+          __atomic_load(&m->value, &current, __ATOMIC_RELAXED);
+          do {
+              if(current > val)
+                  return COLLECTOR_ERR_INVALID_VALUE;
+          } while(!__atomic_compare_exchange(&m->value, &current, &val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+          break;
+        case COLLECTOR_TYPE_GAUGE:
+          __atomic_store(&m->value, &val, __ATOMIC_RELAXED);
+          break;
+        default:
+          return COLLECTOR_ERR_INVALID_VALUE;
+    }
+
+    return COLLECTOR_SUCCESS;
+}
+
 collector_return_t collector_metric_update(collector_metric_t m, double val)
 {
+    if(m->histogram) {
+        collector_histogram_update(m->histogram, val);
+        return COLLECTOR_SUCCESS;
+    }
+
+    if(m->sketch) {
+        collector_sketch_update(m->sketch, val);
+        return COLLECTOR_SUCCESS;
+    }
+
+    if(m->sampling_period > 0)
+        return sampled_metric_update(m, val);
+
+    collector_sample_store* shard = metric_shard(m);
+    collector_sample_store* store = shard ? shard : &m->store;
+    uint64_t n;
+
     switch(m->type) {
         case COLLECTOR_TYPE_COUNTER:
-          if((m->buffer_index >=1) && (m->buffer[m->buffer_index-1].val > val)) 
+          /* for sharded metrics, only checked against the shard's last value */
+          n = collector_store_size(store);
+          if((n >= 1) && (collector_store_val(store, n-1) > val))
               return COLLECTOR_ERR_INVALID_VALUE;
           break;
         case COLLECTOR_TYPE_TIMER:
@@ -107,51 +288,55 @@ collector_return_t collector_metric_update(collector_metric_t m, double val)
               return COLLECTOR_ERR_INVALID_VALUE;
           break;
         case COLLECTOR_TYPE_GAUGE:
+        default:
           break;
     }
 
-    ABT_unit_id self_id;
-  
-    ABT_mutex_lock(m->metric_mutex);
-    ABT_self_get_thread_id(&self_id);
-        
-    m->buffer[m->buffer_index].val = val;
-    m->buffer[m->buffer_index].time = ABT_get_wtime();
-    m->buffer[m->buffer_index].sample_id = self_id;
-    m->buffer_index++;
-
-    ABT_mutex_unlock(m->metric_mutex);
-
-    return COLLECTOR_SUCCESS;
+    return metric_append(m, shard, val);
 }
 
 collector_return_t collector_metric_update_gauge_by_fixed_amount(collector_metric_t m, double diff)
 {
     switch(m->type) {
-        case COLLECTOR_TYPE_COUNTER:
-        case COLLECTOR_TYPE_TIMER:
+        case COLLECTOR_TYPE_GAUGE:
+             break;
+        default:
              return COLLECTOR_ERR_INVALID_VALUE;
     }
 
     ABT_unit_id self_id;
+    collector_return_t ret;
+    double val;
+    uint64_t n;
+
+    if(m->sampling_period > 0) {
+        collector_atomic_add_double(&m->value, diff);
+        return COLLECTOR_SUCCESS;
+    }
+
+    if(m->shards) {
+        /* shards don't know each other's last value, keep a running one */
+        val = collector_atomic_add_double(&m->value, diff);
+        return metric_append(m, metric_shard(m), val);
+    }
 
     ABT_mutex_lock(m->metric_mutex);
     ABT_self_get_thread_id(&self_id);
 
-    if(m->buffer_index) {
-        m->buffer[m->buffer_index].val = m->buffer[m->buffer_index - 1].val + diff;
+    n = collector_store_size(&m->store);
+    if(n) {
+        val = collector_store_val(&m->store, n - 1) + diff;
     } else {
-        m->buffer[m->buffer_index].val = 1;
+        val = diff;
     }
 
-    m->buffer[m->buffer_index].time = ABT_get_wtime();
-    m->buffer[m->buffer_index].sample_id = self_id;
-    m->buffer_index++;
+    ret = collector_store_append(&m->store, ABT_get_wtime(), val, self_id);
+    if(m->rollup)
+        collector_rollup_age(m->rollup, &m->store);
 
-unlock:
     ABT_mutex_unlock(m->metric_mutex);
 
-    return COLLECTOR_SUCCESS;
+    return ret;
 }
 
 collector_return_t collector_metric_register_retrieval_callback(char *ns, func f)
@@ -167,38 +352,165 @@ collector_return_t collector_metric_dump_histogram(collector_metric_t m, const c
     double min = 9999999999999;
 
     fprintf(stderr, "Invoked dump histogram\n");
-    int i = 0; 
-    size_t *buckets = (size_t*)calloc(num_buckets, sizeof(size_t));
-    for(i = 0 ; i < m->buffer_index; i++) {
-        if(m->buffer[i].val > max)
-            max = m->buffer[i].val;
-	if(m->buffer[i].val < min)
-	    min = m->buffer[i].val;
+
+    if(m->histogram) {
+        /* native histogram: its own buckets, one "lower bound, count" line each */
+        size_t b;
+        FILE *fp = fopen(filename, "w");
+        if(!fp)
+            return COLLECTOR_ERR_IO;
+        fprintf(fp, "%zu\n", m->histogram->num_bounds + 1);
+        fprintf(fp, "-inf, %" PRIu64 "\n", __atomic_load_n(&m->histogram->counts[0], __ATOMIC_RELAXED));
+        for(b = 0; b < m->histogram->num_bounds; b++)
+            fprintf(fp, "%lf, %" PRIu64 "\n", m->histogram->bounds[b],
+                    __atomic_load_n(&m->histogram->counts[b+1], __ATOMIC_RELAXED));
+        fclose(fp);
+        return COLLECTOR_SUCCESS;
     }
 
-    int bucket_index;
-    for(i = 0 ; i < m->buffer_index; i++) {
-        bucket_index = (int)(((m->buffer[i].val - min)/(max - min))*num_buckets);
-        buckets[bucket_index]++;
+    collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+    uint64_t first[COLLECTOR_MAX_SHARDS+1], last[COLLECTOR_MAX_SHARDS+1];
+    size_t num_stores = collector_metric_stores(m, stores);
+    size_t k;
+    uint64_t i;
+    double store_min, store_max;
+    if(num_buckets == 0 || num_buckets > INT32_MAX)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    uint64_t *buckets = (uint64_t*)calloc(num_buckets, sizeof(uint64_t));
+    if(!buckets)
+        return COLLECTOR_ERR_ALLOCATION;
+    for(k = 0; k < num_stores; k++) {
+        last[k]  = collector_store_size(stores[k]);
+        first[k] = collector_store_first(stores[k], last[k]);
+        if(first[k] == last[k])
+            continue;
+        collector_store_min_max(stores[k], first[k], last[k], &store_min, &store_max);
+        if(store_max > max)
+            max = store_max;
+        if(store_min < min)
+            min = store_min;
     }
 
+    /* the max value goes to the last bucket, all values to the first one if they are equal */
+    for(k = 0; k < num_stores; k++)
+        collector_store_bucket(stores[k], first[k], last[k], min, max > min ? max - min : 1, num_buckets, buckets);
+
     FILE *fp = fopen(filename, "w");
-    fprintf(fp, "%lu, %lf, %lf\n", num_buckets, min, max);
+    if(!fp) {
+        free(buckets);
+        return COLLECTOR_ERR_IO;
+    }
+    fprintf(fp, "%zu, %lf, %lf\n", num_buckets, min, max);
     for(i = 0; i < num_buckets; i++)
-        fprintf(fp, "%lu\n", buckets[i]);
+        fprintf(fp, "%" PRIu64 "\n", buckets[i]);
     fclose(fp);
     free(buckets);
 
+    return COLLECTOR_SUCCESS;
+}
+
+/* Writes the header and the strings section of the dump of a metric,
+ * padded with zeros to the offset of its samples */
+static collector_return_t dump_write_header(FILE* fp, collector_metric_t m, uint64_t num_samples)
+{
+    const collector_intern* strings = m->cold->strings;
+    const collector_labelset* labels = m->cold->labels;
+    collector_dump_header header;
+    size_t size;
+    char *buf, *dst;
+    uint32_t j;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLLECTOR_DUMP_MAGIC, sizeof(header.magic));
+    header.version       = COLLECTOR_DUMP_VERSION;
+    header.byte_order    = COLLECTOR_DUMP_BYTE_ORDER;
+    header.header_size   = sizeof(header);
+    header.id            = m->id;
+    header.type          = m->type;
+    header.num_tags      = labels->num_labels;
+    header.num_samples   = num_samples;
+    header.chunk_samples = COLLECTOR_CHUNK_SAMPLES;
+    header.strings_size  = strlen(collector_intern_str(strings, m->cold->ns)) + 1
+                         + strlen(collector_intern_str(strings, m->cold->name)) + 1
+                         + strlen(m->cold->desc) + 1;
+    for(j = 0; j < labels->num_labels; j++)
+        header.strings_size += strlen(collector_intern_str(strings, labels->labels[j])) + 1;
+    size = sizeof(header) + header.strings_size;
+    header.data_offset = (size + COLLECTOR_DUMP_ALIGN - 1) & ~(uint64_t)(COLLECTOR_DUMP_ALIGN - 1);
+
+    buf = (char*)calloc(1, header.data_offset);
+    if(!buf)
+        return COLLECTOR_ERR_ALLOCATION;
+    memcpy(buf, &header, sizeof(header));
+    dst = buf + sizeof(header);
+    dst = stpcpy(dst, collector_intern_str(strings, m->cold->ns)) + 1;
+    dst = stpcpy(dst, collector_intern_str(strings, m->cold->name)) + 1;
+    dst = stpcpy(dst, m->cold->desc) + 1;
+    for(j = 0; j < labels->num_labels; j++)
+        dst = stpcpy(dst, collector_intern_str(strings, labels->labels[j])) + 1;
+
+    size = fwrite(buf, header.data_offset, 1, fp);
+    free(buf);
+    return size == 1 ? COLLECTOR_SUCCESS : COLLECTOR_ERR_IO;
 }
 
 collector_return_t collector_metric_dump_raw_data(collector_metric_t m, const char *filename)
 {
+    collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+    size_t num_stores = collector_metric_stores(m, stores);
+    collector_store_merge it;
+    collector_metric_sample s;
+    collector_return_t ret;
+    uint64_t num_samples, done, n, j;
+    double *time, *val;
+    uint64_t* sample_id;
+    void* chunk;
+    FILE* fp;
 
-    FILE *fp = fopen(filename, "w");
-    int i;
-    for(i = 0; i < m->buffer_index; i++)
-        fprintf(fp, "%.9lf, %.9lf, %lu\n", m->buffer[i].val, m->buffer[i].time, m->buffer[i].sample_id);
-    fclose(fp);
+    if(!filename)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* shards of a sharded metric are merged by timestamp */
+    if(collector_store_merge_init(&it, stores, num_stores) != COLLECTOR_SUCCESS)
+        return COLLECTOR_ERR_ALLOCATION;
+    num_samples = collector_store_merge_remaining(&it);
+    chunk = malloc(COLLECTOR_CHUNK_SAMPLES*COLLECTOR_DUMP_SAMPLE_SIZE);
+    if(!chunk) {
+        collector_store_merge_finalize(&it);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    fp = fopen(filename, "wb");
+    if(!fp) {
+        free(chunk);
+        collector_store_merge_finalize(&it);
+        return COLLECTOR_ERR_IO;
+    }
+
+    /* one chunk of columns at a time, with a single write each */
+    ret = dump_write_header(fp, m, num_samples);
+    for(done = 0; ret == COLLECTOR_SUCCESS && done < num_samples; done += n) {
+        n = num_samples - done < COLLECTOR_CHUNK_SAMPLES ? num_samples - done : COLLECTOR_CHUNK_SAMPLES;
+        time      = (double*)chunk;
+        val       = time + n;
+        sample_id = (uint64_t*)(val + n);
+        if(num_stores == 1) {
+            collector_store_copy_columns(stores[0], it.start[0] + done, n, COLLECTOR_COLUMN_ALL, time, val, sample_id);
+        } else {
+            for(j = 0; j < n && collector_store_merge_next(&it, &s); j++) {
+                time[j]      = s.time;
+                val[j]       = s.val;
+                sample_id[j] = s.sample_id;
+            }
+        }
+        if(fwrite(chunk, COLLECTOR_DUMP_SAMPLE_SIZE, n, fp) != n)
+            ret = COLLECTOR_ERR_IO;
+    }
+    if(fclose(fp) != 0 && ret == COLLECTOR_SUCCESS)
+        ret = COLLECTOR_ERR_IO;
+    free(chunk);
+    collector_store_merge_finalize(&it);
+
+    return ret;
 }
 
 /* APIs for remote monitoring clients */
@@ -208,151 +520,1345 @@ collector_return_t collector_remote_metric_get_id(char *ns, char *name, collecto
     if(!ns || !name)
         return COLLECTOR_ERR_INVALID_NAME;
 
-    collector_id_from_string_identifiers(ns, name, taglist->taglist, taglist->num_tags, metric_id);
+    /* the same id as the provider's, so handles can be created without any RPC */
+    *metric_id = collector_metric_id(ns, name, taglist ? taglist->taglist : NULL, taglist ? taglist->num_tags : 0);
 
     return COLLECTOR_SUCCESS;
 }
 
-collector_return_t collector_remote_metric_fetch(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns)
+static void request_free(collector_request* r)
+{
+    margo_destroy(r->h);
+    if(r->bulk != HG_BULK_NULL)
+        margo_bulk_free(r->bulk);
+    free(r);
+}
+
+/* Decodes the response of a request whose margo request has completed
+ * with status hret, and frees the request */
+static collector_return_t request_complete(collector_request* r, hg_return_t hret)
+{
+    collector_return_t ret;
+    if(hret != HG_SUCCESS) {
+        /* the response won't be decoded: free what it would have filled */
+        if(r->release)
+            r->release(r);
+        ret = COLLECTOR_ERR_FROM_MERCURY;
+    } else {
+        ret = r->complete(r);
+    }
+    request_free(r);
+    return ret;
+}
+
+collector_return_t collector_request_wait(collector_request_t req)
+{
+    if(req == COLLECTOR_REQUEST_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    return request_complete(req, margo_wait(req->req));
+}
+
+collector_return_t collector_request_test(collector_request_t req, int *flag)
+{
+    if(req == COLLECTOR_REQUEST_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    if(margo_test(req->req, flag) != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_request_wait_any(size_t count, collector_request_t *reqs, size_t *index)
+{
+    margo_request* mreqs;
+    size_t i, j = count;
+    hg_return_t hret;
+    collector_return_t ret;
+
+    mreqs = (margo_request*)calloc(count ? count : 1, sizeof(*mreqs));
+    if(!mreqs)
+        return COLLECTOR_ERR_ALLOCATION;
+    for(i = 0; i < count; i++)
+        mreqs[i] = reqs[i] ? reqs[i]->req : MARGO_REQUEST_NULL;
+
+    /* margo_wait_any waits on the first margo request to complete */
+    hret = margo_wait_any(count, mreqs, &j);
+    free(mreqs);
+    if(j >= count || reqs[j] == COLLECTOR_REQUEST_NULL) {
+        /* no pending request in the array */
+        *index = count;
+        return hret != HG_SUCCESS ? COLLECTOR_ERR_FROM_MERCURY : COLLECTOR_ERR_INVALID_ARGS;
+    }
+
+    ret = request_complete(reqs[j], hret);
+    reqs[j] = COLLECTOR_REQUEST_NULL;
+    *index = j;
+    return ret;
+}
+
+static void release_fetch(collector_request* r)
+{
+    free(r->fetch.b);
+}
+
+static collector_return_t complete_fetch(collector_request* r)
 {
-    hg_handle_t h;
-    metric_fetch_in_t in;
     metric_fetch_out_t out;
-    hg_bulk_t local_bulk;
+    collector_return_t ret;
+
+    if(margo_get_output(r->h, &out) != HG_SUCCESS) {
+        free(r->fetch.b);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    /* the samples were pushed to or sent inline at the start of the
+     * buffer: decode them into a new one unless they are raw */
+    if(out.ret == COLLECTOR_SUCCESS && out.actual_count && (out.num_inline || out.encoding != COLLECTOR_ENCODING_RAW)) {
+        collector_metric_buffer b = r->fetch.b;
+        const void* data = out.num_inline ? out.inline_data : (const void*)r->fetch.b;
+        if(out.encoding != COLLECTOR_ENCODING_RAW)
+            b = (collector_metric_buffer)malloc(out.actual_count*sizeof(collector_metric_sample));
+        if(!b || !collector_decode_samples(out.encoding, data, out.size, b, out.actual_count)) {
+            if(b != r->fetch.b)
+                free(b);
+            free(r->fetch.b);
+            margo_free_output(r->h, &out);
+            return b ? COLLECTOR_ERR_OTHER : COLLECTOR_ERR_ALLOCATION;
+        }
+        if(b != r->fetch.b) {
+            free(r->fetch.b);
+            r->fetch.b = b;
+        }
+    }
+
+    char* name = strdup(out.name ? out.name : "");
+    char* ns   = strdup(out.ns ? out.ns : "");
+    if(!name || !ns) {
+        free(name);
+        free(ns);
+        free(r->fetch.b);
+        margo_free_output(r->h, &out);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
 
+    *r->fetch.num_samples = out.actual_count;
+    if(r->fetch.first_seq) *r->fetch.first_seq = out.first_seq;
+    if(r->fetch.next_seq)  *r->fetch.next_seq = out.next_seq;
+    *r->fetch.buf = r->fetch.b;
+    *r->fetch.name = name;
+    *r->fetch.ns = ns;
+
+    ret = out.ret;
+    margo_free_output(r->h, &out);
+    return ret;
+}
+
+static collector_return_t metric_ifetch(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns, uint64_t *first_seq, uint64_t *next_seq, collector_request_t *req)
+{
+    metric_fetch_in_t in;
     hg_return_t ret;
+
+    collector_request* r = (collector_request*)calloc(1, sizeof(*r));
+    if(!r)
+        return COLLECTOR_ERR_ALLOCATION;
+    r->bulk = HG_BULK_NULL;
+    r->complete = complete_fetch;
+    r->release = release_fetch;
+
     in.metric_id = handle->metric_id;
 
     if(*num_samples_requested >= METRIC_BUFFER_SIZE || *num_samples_requested < 0)
         *num_samples_requested = METRIC_BUFFER_SIZE;
 
     in.count = *num_samples_requested;
+    in.encodings = handle->client->fetch_encodings;
 
-    collector_metric_buffer b = (collector_metric_buffer)calloc(*num_samples_requested, sizeof(collector_metric_sample));
-    hg_size_t segment_sizes[1] = {*num_samples_requested*sizeof(collector_metric_sample)};
-    void *segment_ptrs[1] = {(void*)b};
-
-    margo_bulk_create(handle->client->mid, 1,  segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
-    in.bulk = local_bulk;
-
-    ret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_id, &h);
-    if(ret != HG_SUCCESS)         
-        return COLLECTOR_ERR_FROM_MERCURY; 
+    r->fetch.b = (collector_metric_buffer)calloc(*num_samples_requested ? *num_samples_requested : 1, sizeof(collector_metric_sample));
+    if(!r->fetch.b) {
+        free(r);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    r->fetch.num_samples = num_samples_requested;
+    r->fetch.buf = buf;
+    r->fetch.name = name;
+    r->fetch.ns = ns;
+    r->fetch.first_seq = first_seq;
+    r->fetch.next_seq = next_seq;
+
+    /* small fetches get the samples in the response, without a bulk transfer */
+    if(*num_samples_requested > COLLECTOR_FETCH_INLINE_MAX) {
+        hg_size_t segment_sizes[1] = {*num_samples_requested*sizeof(collector_metric_sample)};
+        void *segment_ptrs[1] = {(void*)r->fetch.b};
+
+        ret = margo_bulk_create(handle->client->mid, 1, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &r->bulk);
+        if(ret != HG_SUCCESS) {
+            free(r->fetch.b);
+            free(r);
+            return COLLECTOR_ERR_FROM_MERCURY;
+        }
+    }
+    in.bulk = r->bulk;
 
-    ret = margo_provider_forward(handle->provider_id, h, &in);
+    ret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_id, &r->h);
     if(ret != HG_SUCCESS) {
-        margo_destroy(h);
-	return COLLECTOR_ERR_FROM_MERCURY;
+        if(r->bulk != HG_BULK_NULL)
+            margo_bulk_free(r->bulk);
+        free(r->fetch.b);
+        free(r);
+        return COLLECTOR_ERR_FROM_MERCURY;
     }
 
-    ret = margo_get_output(h, &out);
+    ret = margo_provider_iforward(handle->provider_id, r->h, &in, &r->req);
     if(ret != HG_SUCCESS) {
-	margo_free_output(h, &out);
-        margo_destroy(h);
-	return COLLECTOR_ERR_FROM_MERCURY;
+        release_fetch(r);
+        request_free(r);
+        return COLLECTOR_ERR_FROM_MERCURY;
     }
 
-    *num_samples_requested = out.actual_count;
-    *buf = b;
-    *name = (char*)malloc(36*sizeof(char));
-    *ns = (char*)malloc(36*sizeof(char));
-    strcpy(*name, out.name);
-    strcpy(*ns, out.ns);
+    *req = r;
+    return COLLECTOR_SUCCESS;
+}
 
-    margo_free_output(h, &out);
-    margo_destroy(h);
-    margo_bulk_free(local_bulk);
+collector_return_t collector_remote_metric_fetch(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns)
+{
+    uint64_t first_seq, next_seq;
+    return collector_remote_metric_fetch_with_seq(handle, num_samples_requested, buf, name, ns, &first_seq, &next_seq);
+}
 
-    return out.ret;
+collector_return_t collector_remote_metric_fetch_with_seq(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns, uint64_t *first_seq, uint64_t *next_seq)
+{
+    collector_request_t req;
+    collector_return_t ret = metric_ifetch(handle, num_samples_requested, buf, name, ns, first_seq, next_seq, &req);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    return collector_request_wait(req);
 }
 
-collector_return_t collector_remote_metric_handle_create(
-        collector_client_t client,
-        hg_addr_t addr,
-        uint16_t provider_id,
-        collector_metric_id_t metric_id,
-        collector_metric_handle_t* handle)
+collector_return_t collector_remote_metric_ifetch(collector_metric_handle_t handle, int64_t *num_samples_requested, collector_metric_buffer *buf, char **name, char **ns, collector_request_t *req)
 {
-    if(client == COLLECTOR_CLIENT_NULL)
-        return COLLECTOR_ERR_INVALID_ARGS;
+    return metric_ifetch(handle, num_samples_requested, buf, name, ns, NULL, NULL, req);
+}
 
-    collector_metric_handle_t rh =
-        (collector_metric_handle_t)calloc(1, sizeof(*rh));
+/* Initial capacity of the buffers of a fetch of unknown size (of a time
+ * range, or of all the samples), resized from the total the server reports */
+#define COLLECTOR_FETCH_INIT_COUNT 1024
 
-    if(!rh) return COLLECTOR_ERR_ALLOCATION;
+static collector_return_t metric_fetch_range(collector_metric_handle_t handle, double t_start, double t_end, int64_t count, collector_metric_buffer b, int64_t *actual_count, uint64_t *total)
+{
+    hg_handle_t h;
+    metric_fetch_range_in_t  in;
+    metric_fetch_range_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_return_t ret;
+    hg_return_t hret;
 
-    hg_return_t ret = margo_addr_dup(client->mid, addr, &(rh->addr));
-    if(ret != HG_SUCCESS) {
-        free(rh);
+    in.metric_id = handle->metric_id;
+    in.t_start = t_start;
+    in.t_end = t_end;
+    in.count = count;
+    in.bulk = HG_BULK_NULL;
+
+    if(count) {
+        hg_size_t segment_sizes[1] = {count*sizeof(collector_metric_sample)};
+        void *segment_ptrs[1] = {(void*)b};
+        hret = margo_bulk_create(handle->client->mid, 1, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS)
+            return COLLECTOR_ERR_FROM_MERCURY;
+        in.bulk = local_bulk;
+    }
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_range_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
         return COLLECTOR_ERR_FROM_MERCURY;
     }
 
-    rh->client      = client;
-    rh->provider_id = provider_id;
-    rh->metric_id   = metric_id;
-    rh->refcount    = 1;
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        margo_bulk_free(local_bulk);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
 
-    client->num_metric_handles += 1;
+    ret = out.ret;
+    *actual_count = out.actual_count;
+    *total = out.total;
 
-    *handle = rh;
-    return COLLECTOR_SUCCESS;
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    margo_bulk_free(local_bulk);
+    return ret;
 }
 
-collector_return_t collector_remote_metric_handle_ref_incr(
-        collector_metric_handle_t handle)
+collector_return_t collector_remote_metric_fetch_range(collector_metric_handle_t handle, double t_start, double t_end, int64_t *num_samples, collector_metric_buffer *buf)
 {
-    if(handle == COLLECTOR_METRIC_HANDLE_NULL)
-        return COLLECTOR_ERR_INVALID_ARGS;
-    handle->refcount += 1;
-    return COLLECTOR_SUCCESS;
-}
+    collector_return_t ret;
+    int64_t count, actual_count;
+    uint64_t total;
+    int exact = *num_samples >= 0;
+
+    count = exact ? *num_samples : COLLECTOR_FETCH_INIT_COUNT;
+    if(count > METRIC_BUFFER_SIZE)
+        count = METRIC_BUFFER_SIZE;
+
+    collector_metric_buffer b = (collector_metric_buffer)calloc(count ? count : 1, sizeof(collector_metric_sample));
+    if(!b)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    ret = metric_fetch_range(handle, t_start, t_end, count, b, &actual_count, &total);
+
+    /* all the samples of the range were requested: now that the server
+     * told us how many there are, fetch them again with the right size */
+    if(ret == COLLECTOR_SUCCESS && !exact && total > (uint64_t)count && total <= METRIC_BUFFER_SIZE) {
+        free(b);
+        count = total;
+        b = (collector_metric_buffer)calloc(count, sizeof(collector_metric_sample));
+        if(!b)
+            return COLLECTOR_ERR_ALLOCATION;
+        ret = metric_fetch_range(handle, t_start, t_end, count, b, &actual_count, &total);
+    }
 
-collector_return_t collector_remote_metric_handle_release(collector_metric_handle_t handle)
-{
-    if(handle == COLLECTOR_METRIC_HANDLE_NULL)
-        return COLLECTOR_ERR_INVALID_ARGS;
-    handle->refcount -= 1;
-    if(handle->refcount == 0) {
-        margo_addr_free(handle->client->mid, handle->addr);
-        handle->client->num_metric_handles -= 1;
-        free(handle);
+    if(ret != COLLECTOR_SUCCESS) {
+        free(b);
+        return ret;
     }
+
+    *num_samples = actual_count;
+    *buf = b;
     return COLLECTOR_SUCCESS;
 }
 
-collector_return_t collector_remote_list_metrics(collector_client_t client, hg_addr_t addr, uint16_t provider_id, collector_metric_id_t** ids, size_t* count)
+collector_return_t collector_remote_metric_fetch_downsampled(collector_metric_handle_t handle, double t_start, double t_end, uint32_t method, int64_t *num_points, collector_metric_buffer *buf)
 {
     hg_handle_t h;
-    list_metrics_in_t  in;
-    list_metrics_out_t out;
+    metric_fetch_downsampled_in_t  in;
+    metric_fetch_downsampled_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
     collector_return_t ret;
     hg_return_t hret;
 
-    in.max_ids = *count;
+    if(*num_points <= 0 || *num_points > COLLECTOR_DOWNSAMPLE_MAX_POINTS)
+        return COLLECTOR_ERR_INVALID_ARGS;
 
-    hret = margo_create(client->mid, addr, client->list_metrics_id, &h);
-    if(hret != HG_SUCCESS)
+    collector_metric_buffer b = (collector_metric_buffer)calloc(*num_points, sizeof(collector_metric_sample));
+    if(!b)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    in.metric_id = handle->metric_id;
+    in.t_start = t_start;
+    in.t_end = t_end;
+    in.method = method;
+    in.count = *num_points;
+
+    hg_size_t segment_sizes[1] = {*num_points*sizeof(collector_metric_sample)};
+    void *segment_ptrs[1] = {(void*)b};
+    hret = margo_bulk_create(handle->client->mid, 1, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        free(b);
         return COLLECTOR_ERR_FROM_MERCURY;
+    }
+    in.bulk = local_bulk;
 
-    hret = margo_provider_forward(provider_id, h, &in);
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_downsampled_id, &h);
     if(hret != HG_SUCCESS) {
-        margo_destroy(h);
+        margo_bulk_free(local_bulk);
+        free(b);
         return COLLECTOR_ERR_FROM_MERCURY;
     }
 
-    hret = margo_get_output(h, &out);
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
     if(hret != HG_SUCCESS) {
         margo_destroy(h);
+        margo_bulk_free(local_bulk);
+        free(b);
         return COLLECTOR_ERR_FROM_MERCURY;
     }
 
     ret = out.ret;
     if(ret == COLLECTOR_SUCCESS) {
-        *count = out.count;
-        memcpy(*ids, out.ids, out.count*sizeof(collector_metric_id_t));
+        *num_points = out.actual_count;
+        *buf = b;
+    } else {
+        free(b);
     }
-    
+
     margo_free_output(h, &out);
     margo_destroy(h);
+    margo_bulk_free(local_bulk);
     return ret;
 }
+
+/* Sends a column fetch of (at most) count samples into arrays, which
+ * holds a count-sample array per selected field */
+static collector_return_t metric_fetch_columns(collector_metric_handle_t handle, int64_t count, uint32_t columns, void** arrays, int64_t *actual_count, uint64_t *total)
+{
+    hg_handle_t h;
+    metric_fetch_columns_in_t  in;
+    metric_fetch_columns_out_t out;
+    hg_bulk_t local_bulk;
+    collector_return_t ret;
+    hg_return_t hret;
+    void *segment_ptrs[3];
+    hg_size_t segment_sizes[3];
+    uint32_t num_segments = 0, f;
+
+    /* the arrays are exposed as consecutive segments of a single bulk region */
+    for(f = 0; f < 3; f++) {
+        if(!(columns & (1u << f)))
+            continue;
+        segment_ptrs[num_segments]  = arrays[f];
+        segment_sizes[num_segments] = count*sizeof(double);
+        num_segments += 1;
+    }
+
+    hret = margo_bulk_create(handle->client->mid, num_segments, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+
+    in.metric_id = handle->metric_id;
+    in.count = count;
+    in.columns = columns;
+    in.bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_columns_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        margo_bulk_free(local_bulk);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    *actual_count = out.actual_count;
+    *total = out.total;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    margo_bulk_free(local_bulk);
+    return ret;
+}
+
+/* Allocates a count-sample array per selected field */
+static collector_return_t column_arrays_alloc(int64_t count, uint32_t columns, void** arrays)
+{
+    uint32_t f;
+
+    for(f = 0; f < 3; f++) {
+        arrays[f] = NULL;
+        if(!(columns & (1u << f)))
+            continue;
+        arrays[f] = malloc(count*sizeof(double));
+        if(!arrays[f])
+            return COLLECTOR_ERR_ALLOCATION;
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_remote_metric_fetch_columns(collector_metric_handle_t handle, int64_t *num_samples, uint32_t columns, double **times, double **vals, uint64_t **sample_ids)
+{
+    collector_return_t ret;
+    void *arrays[3] = {NULL, NULL, NULL};
+    int64_t count, actual_count;
+    uint64_t total;
+    uint32_t f;
+    int exact = *num_samples > 0 && *num_samples < METRIC_BUFFER_SIZE;
+
+    if(!(columns & COLLECTOR_COLUMN_ALL) || (columns & ~COLLECTOR_COLUMN_ALL))
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    count = exact ? *num_samples : COLLECTOR_FETCH_INIT_COUNT;
+    ret = column_arrays_alloc(count, columns, arrays);
+    if(ret == COLLECTOR_SUCCESS)
+        ret = metric_fetch_columns(handle, count, columns, arrays, &actual_count, &total);
+
+    /* all the samples were requested: now that the server told us how
+     * many there are, fetch them again with the right size */
+    if(ret == COLLECTOR_SUCCESS && !exact && total > (uint64_t)count) {
+        for(f = 0; f < 3; f++)
+            free(arrays[f]);
+        count = total < METRIC_BUFFER_SIZE ? total : METRIC_BUFFER_SIZE;
+        ret = column_arrays_alloc(count, columns, arrays);
+        if(ret == COLLECTOR_SUCCESS)
+            ret = metric_fetch_columns(handle, count, columns, arrays, &actual_count, &total);
+    }
+
+    if(ret != COLLECTOR_SUCCESS) {
+        for(f = 0; f < 3; f++)
+            free(arrays[f]);
+        return ret;
+    }
+
+    *num_samples = actual_count;
+    if(times)      *times      = (double*)arrays[0];   else free(arrays[0]);
+    if(vals)       *vals       = (double*)arrays[1];   else free(arrays[1]);
+    if(sample_ids) *sample_ids = (uint64_t*)arrays[2]; else free(arrays[2]);
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_cursor_create(collector_cursor_t* cursor)
+{
+    collector_cursor_t c = (collector_cursor_t)calloc(1, sizeof(*c));
+    if(!c) return COLLECTOR_ERR_ALLOCATION;
+    *cursor = c;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_cursor_destroy(collector_cursor_t cursor)
+{
+    if(cursor == COLLECTOR_CURSOR_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    free(cursor);
+    return COLLECTOR_SUCCESS;
+}
+
+/* Sends a fetch of the (at most count) samples following a cursor into b,
+ * without advancing the cursor: *out is to free with margo_free_output and
+ * *h to destroy on success */
+static collector_return_t metric_fetch_since(collector_metric_handle_t handle, collector_cursor_t cursor, int64_t count, collector_metric_buffer b, hg_handle_t *h, metric_fetch_since_out_t *out)
+{
+    metric_fetch_since_in_t in;
+    hg_bulk_t local_bulk;
+    collector_return_t ret;
+    hg_return_t hret;
+
+    in.metric_id = handle->metric_id;
+    in.count = count;
+    in.num_positions = cursor->num_positions;
+    in.positions = cursor->positions;
+
+    hg_size_t segment_sizes[1] = {count*sizeof(collector_metric_sample)};
+    void *segment_ptrs[1] = {(void*)b};
+
+    hret = margo_bulk_create(handle->client->mid, 1, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+    in.bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_since_id, h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, *h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(*h, out);
+    margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(*h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    ret = out->ret;
+    /* the positions are copied into the cursor */
+    if(ret == COLLECTOR_SUCCESS && out->num_positions > COLLECTOR_MAX_SHARDS+1)
+        ret = COLLECTOR_ERR_INVALID_ARGS;
+    if(ret != COLLECTOR_SUCCESS) {
+        margo_free_output(*h, out);
+        margo_destroy(*h);
+    }
+    return ret;
+}
+
+collector_return_t collector_remote_metric_fetch_since(collector_metric_handle_t handle, collector_cursor_t cursor, int64_t *num_samples, collector_metric_buffer *buf, uint64_t *dropped)
+{
+    hg_handle_t h;
+    metric_fetch_since_out_t out;
+    collector_return_t ret;
+    int64_t count;
+    int exact = *num_samples > 0 && *num_samples < METRIC_BUFFER_SIZE;
+
+    if(cursor == COLLECTOR_CURSOR_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    count = exact ? *num_samples : COLLECTOR_FETCH_INIT_COUNT;
+    collector_metric_buffer b = (collector_metric_buffer)calloc(count, sizeof(collector_metric_sample));
+    if(!b)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    ret = metric_fetch_since(handle, cursor, count, b, &h, &out);
+
+    /* all the samples were requested: now that the server told us how many
+     * follow the cursor, which didn't move, fetch them again with the right size */
+    if(ret == COLLECTOR_SUCCESS && !exact && out.total > (uint64_t)count) {
+        count = out.total < METRIC_BUFFER_SIZE ? out.total : METRIC_BUFFER_SIZE;
+        margo_free_output(h, &out);
+        margo_destroy(h);
+        free(b);
+        b = (collector_metric_buffer)calloc(count, sizeof(collector_metric_sample));
+        if(!b)
+            return COLLECTOR_ERR_ALLOCATION;
+        ret = metric_fetch_since(handle, cursor, count, b, &h, &out);
+    }
+
+    if(ret != COLLECTOR_SUCCESS) {
+        free(b);
+        return ret;
+    }
+
+    /* advance the cursor */
+    cursor->num_positions = out.num_positions;
+    memcpy(cursor->positions, out.positions, out.num_positions*sizeof(uint64_t));
+    *num_samples = out.actual_count;
+    *buf = b;
+    if(dropped) *dropped = out.dropped;
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return COLLECTOR_SUCCESS;
+}
+
+/* Sends a batch fetch whose samples are pushed to a new buffer of
+ * capacity samples. On success, *out is to free with margo_free_output
+ * and *h to destroy, and *b is to free */
+static collector_return_t fetch_batch(collector_client_t client, hg_addr_t addr, uint16_t provider_id, metric_fetch_batch_in_t* in, uint64_t capacity, hg_handle_t* h, metric_fetch_batch_out_t* out, collector_metric_buffer* b)
+{
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    hg_return_t hret;
+
+    /* a single bulk region receives the samples of all the metrics */
+    *b = (collector_metric_buffer)calloc(capacity ? capacity : 1, sizeof(collector_metric_sample));
+    if(!*b)
+        return COLLECTOR_ERR_ALLOCATION;
+    in->bulk = HG_BULK_NULL;
+    if(capacity) {
+        hg_size_t segment_sizes[1] = {capacity*sizeof(collector_metric_sample)};
+        void *segment_ptrs[1] = {(void*)*b};
+        hret = margo_bulk_create(client->mid, 1, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            free(*b);
+            return COLLECTOR_ERR_FROM_MERCURY;
+        }
+        in->bulk = local_bulk;
+    }
+
+    hret = margo_create(client->mid, addr, client->metric_fetch_batch_id, h);
+    if(hret == HG_SUCCESS) {
+        hret = margo_provider_forward(provider_id, *h, in);
+        if(hret == HG_SUCCESS)
+            hret = margo_get_output(*h, out);
+        if(hret != HG_SUCCESS)
+            margo_destroy(*h);
+    }
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        free(*b);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_remote_metric_fetch_batch(collector_client_t client, hg_addr_t addr, uint16_t provider_id, size_t num_metrics, const collector_metric_id_t *ids, const int64_t *counts, collector_metric_buffer *buf, uint64_t *offsets, collector_return_t *rets)
+{
+    hg_handle_t h;
+    metric_fetch_batch_in_t  in;
+    metric_fetch_batch_out_t out;
+    collector_metric_buffer b;
+    collector_return_t ret;
+    uint64_t total = 0;
+    size_t i;
+
+    if(client == COLLECTOR_CLIENT_NULL || num_metrics == 0)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    for(i = 0; i < num_metrics; i++) {
+        if(counts[i] < 0)
+            return COLLECTOR_ERR_INVALID_ARGS;
+        total += counts[i] < METRIC_BUFFER_SIZE ? counts[i] : METRIC_BUFFER_SIZE;
+        if(total > COLLECTOR_FETCH_BATCH_MAX_SAMPLES)
+            return COLLECTOR_ERR_INVALID_ARGS;
+    }
+
+    memset(&in, 0, sizeof(in));
+    in.num_metrics = num_metrics;
+    in.ids = (collector_metric_id_t*)ids;
+    in.counts = (int64_t*)counts;
+    in.ns = (hg_string_t)"";
+    in.name = (hg_string_t)"";
+
+    ret = fetch_batch(client, addr, provider_id, &in, total, &h, &out, &b);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+
+    ret = out.ret;
+    if(ret == COLLECTOR_SUCCESS && out.num_metrics != num_metrics)
+        ret = COLLECTOR_ERR_OTHER;
+    if(ret == COLLECTOR_SUCCESS) {
+        memcpy(offsets, out.offsets, (num_metrics + 1)*sizeof(uint64_t));
+        if(rets) {
+            for(i = 0; i < num_metrics; i++)
+                rets[i] = out.rets[i];
+        }
+        *buf = b;
+    } else {
+        free(b);
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+collector_return_t collector_remote_metric_fetch_batch_select(collector_client_t client, hg_addr_t addr, uint16_t provider_id, const char *ns, const char *name, collector_taglist_t taglist, int64_t count, size_t *num_metrics, collector_metric_id_t **ids, collector_metric_buffer *buf, uint64_t **offsets)
+{
+    hg_handle_t h;
+    metric_fetch_batch_in_t  in;
+    metric_fetch_batch_out_t out;
+    collector_metric_buffer b;
+    collector_return_t ret;
+    size_t n;
+
+    if(client == COLLECTOR_CLIENT_NULL || count < 0 || !num_metrics || !ids || !buf || !offsets)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    memset(&in, 0, sizeof(in));
+    in.by_selector = 1;
+    in.ns = (hg_string_t)(ns ? ns : "");
+    in.name = (hg_string_t)(name ? name : "");
+    in.num_tags = taglist ? taglist->num_tags : 0;
+    in.tags = taglist ? taglist->taglist : NULL;
+    in.count = count;
+    /* start with room for a chunk of samples: if more are selected, the
+     * provider tells how many and the fetch is sent again */
+    in.capacity = count < COLLECTOR_CHUNK_SAMPLES ? (uint64_t)count : COLLECTOR_CHUNK_SAMPLES;
+    for(;;) {
+        ret = fetch_batch(client, addr, provider_id, &in, in.capacity, &h, &out, &b);
+        if(ret != COLLECTOR_SUCCESS)
+            return ret;
+        if(out.ret != COLLECTOR_SUCCESS || !out.needed)
+            break;
+        /* metrics created since the previous attempt may need more room */
+        in.capacity = out.needed;
+        margo_free_output(h, &out);
+        margo_destroy(h);
+        free(b);
+    }
+
+    ret = out.ret;
+    n = out.num_metrics;
+    if(ret == COLLECTOR_SUCCESS) {
+        *ids = (collector_metric_id_t*)malloc((n ? n : 1)*sizeof(collector_metric_id_t));
+        *offsets = (uint64_t*)calloc(n + 1, sizeof(uint64_t));
+        if(!*ids || !*offsets) {
+            free(*ids);
+            free(*offsets);
+            ret = COLLECTOR_ERR_ALLOCATION;
+        }
+    }
+    if(ret == COLLECTOR_SUCCESS) {
+        if(n) {
+            memcpy(*ids, out.ids, n*sizeof(collector_metric_id_t));
+            memcpy(*offsets, out.offsets, (n + 1)*sizeof(uint64_t));
+        }
+        *num_metrics = n;
+        *buf = b;
+    } else {
+        free(b);
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+collector_return_t collector_remote_metric_fetch_stats(collector_metric_handle_t handle, double t_start, double t_end, double threshold, collector_metric_stats *stats)
+{
+    hg_handle_t h;
+    metric_fetch_stats_in_t  in;
+    metric_fetch_stats_out_t out;
+    collector_return_t ret;
+    hg_return_t hret;
+
+    in.metric_id = handle->metric_id;
+    in.t_start = t_start;
+    in.t_end = t_end;
+    in.threshold = threshold;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_stats_id, &h);
+    if(hret != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == COLLECTOR_SUCCESS) {
+        stats->count     = out.count;
+        stats->num_above = out.num_above;
+        stats->min       = out.min;
+        stats->max       = out.max;
+        stats->sum       = out.sum;
+        stats->mean      = out.mean;
+        stats->variance  = out.variance;
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+collector_return_t collector_remote_metric_fetch_histogram(collector_metric_handle_t handle, size_t *num_buckets, double **bounds, uint64_t **counts)
+{
+    hg_handle_t h;
+    metric_fetch_histogram_in_t  in;
+    metric_fetch_histogram_out_t out;
+    collector_return_t ret;
+    hg_return_t hret;
+
+    in.metric_id = handle->metric_id;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_histogram_id, &h);
+    if(hret != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == COLLECTOR_SUCCESS) {
+        *num_buckets = out.num_bounds + 1;
+        *bounds = (double*)malloc(out.num_bounds*sizeof(double));
+        *counts = (uint64_t*)malloc((out.num_bounds + 1)*sizeof(uint64_t));
+        memcpy(*bounds, out.bounds, out.num_bounds*sizeof(double));
+        memcpy(*counts, out.counts, (out.num_bounds + 1)*sizeof(uint64_t));
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+collector_return_t collector_remote_metric_fetch_sketch(collector_metric_handle_t handle, collector_sketch_t *sketch)
+{
+    hg_handle_t h;
+    metric_fetch_sketch_in_t  in;
+    metric_fetch_sketch_out_t out;
+    collector_return_t ret;
+    hg_return_t hret;
+
+    in.metric_id = handle->metric_id;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_sketch_id, &h);
+    if(hret != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == COLLECTOR_SUCCESS)
+        ret = collector_sketch_deserialize(out.buf, out.size, sketch);
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+collector_return_t collector_remote_metric_handle_create(
+        collector_client_t client,
+        hg_addr_t addr,
+        uint16_t provider_id,
+        collector_metric_id_t metric_id,
+        collector_metric_handle_t* handle)
+{
+    if(client == COLLECTOR_CLIENT_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    collector_metric_handle_t rh =
+        (collector_metric_handle_t)calloc(1, sizeof(*rh));
+
+    if(!rh) return COLLECTOR_ERR_ALLOCATION;
+
+    hg_return_t ret = margo_addr_dup(client->mid, addr, &(rh->addr));
+    if(ret != HG_SUCCESS) {
+        free(rh);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    rh->client      = client;
+    rh->provider_id = provider_id;
+    rh->metric_id   = metric_id;
+    rh->refcount    = 1;
+
+    client->num_metric_handles += 1;
+
+    *handle = rh;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_remote_metric_handle_ref_incr(
+        collector_metric_handle_t handle)
+{
+    if(handle == COLLECTOR_METRIC_HANDLE_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    handle->refcount += 1;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_remote_metric_handle_release(collector_metric_handle_t handle)
+{
+    if(handle == COLLECTOR_METRIC_HANDLE_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    handle->refcount -= 1;
+    if(handle->refcount == 0) {
+        margo_addr_free(handle->client->mid, handle->addr);
+        handle->client->num_metric_handles -= 1;
+        free(handle);
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+static collector_return_t complete_list(collector_request* r)
+{
+    list_metrics_out_t out;
+    collector_return_t ret;
+
+    if(margo_get_output(r->h, &out) != HG_SUCCESS)
+        return COLLECTOR_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == COLLECTOR_SUCCESS) {
+        *r->list.count = out.count;
+        memcpy(*r->list.ids, out.ids, out.count*sizeof(collector_metric_id_t));
+    }
+
+    margo_free_output(r->h, &out);
+    return ret;
+}
+
+collector_return_t collector_remote_ilist_metrics(collector_client_t client, hg_addr_t addr, uint16_t provider_id, collector_metric_id_t** ids, size_t* count, collector_request_t* req)
+{
+    list_metrics_in_t  in;
+    hg_return_t hret;
+
+    collector_request* r = (collector_request*)calloc(1, sizeof(*r));
+    if(!r)
+        return COLLECTOR_ERR_ALLOCATION;
+    r->bulk = HG_BULK_NULL;
+    r->complete = complete_list;
+    r->list.ids = ids;
+    r->list.count = count;
+
+    in.max_ids = *count;
+
+    hret = margo_create(client->mid, addr, client->list_metrics_id, &r->h);
+    if(hret != HG_SUCCESS) {
+        free(r);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_iforward(provider_id, r->h, &in, &r->req);
+    if(hret != HG_SUCCESS) {
+        request_free(r);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    *req = r;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_remote_list_metrics(collector_client_t client, hg_addr_t addr, uint16_t provider_id, collector_metric_id_t** ids, size_t* count)
+{
+    collector_request_t req;
+    collector_return_t ret = collector_remote_ilist_metrics(client, addr, provider_id, ids, count, &req);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    return collector_request_wait(req);
+}
+
+/* Expected size of a metadata record, used to size the first request of a listing */
+#define METRIC_INFO_SIZE_HINT 128
+
+/* Decodes count metadata records into a single allocation */
+static collector_return_t decode_metric_infos(const char* records, size_t size, size_t count, collector_metric_info** infos)
+{
+    metric_info_header header;
+    size_t i, j, num_tags = 0, offset;
+    const char* p;
+
+    for(i = 0, offset = 0; i < count; i++) {
+        if(offset + sizeof(header) > size)
+            return COLLECTOR_ERR_FROM_MERCURY;
+        memcpy(&header, records + offset, sizeof(header));
+        num_tags += header.num_tags;
+        p = records + offset + sizeof(header);
+        /* the ns, the name and the tags must be terminated within the records */
+        for(j = 0; j < (size_t)header.num_tags + 2; j++) {
+            p = (const char*)memchr(p, '\0', records + size - p);
+            if(!p)
+                return COLLECTOR_ERR_FROM_MERCURY;
+            p++;
+        }
+        offset = (p - records + 7) & ~(size_t)7;
+        if(offset > size)
+            return COLLECTOR_ERR_FROM_MERCURY;
+    }
+
+    char* mem = (char*)malloc(count*sizeof(collector_metric_info) + num_tags*sizeof(char*) + size + 1);
+    if(!mem)
+        return COLLECTOR_ERR_ALLOCATION;
+    collector_metric_info* info = (collector_metric_info*)mem;
+    const char** tags = (const char**)(mem + count*sizeof(collector_metric_info));
+    char* strings = (char*)(tags + num_tags);
+    memcpy(strings, records, size);
+
+    for(i = 0, offset = 0; i < count; i++) {
+        memcpy(&header, strings + offset, sizeof(header));
+        info[i].id = header.id;
+        info[i].type = (collector_metric_type_t)header.type;
+        info[i].num_samples = header.num_samples;
+        p = strings + offset + sizeof(header);
+        info[i].ns = p;
+        p += strlen(p) + 1;
+        info[i].name = p;
+        p += strlen(p) + 1;
+        info[i].num_tags = header.num_tags;
+        info[i].tags = tags;
+        for(j = 0; j < header.num_tags; j++) {
+            *(tags++) = p;
+            p += strlen(p) + 1;
+        }
+        offset = (p - strings + 7) & ~(size_t)7;
+    }
+    *infos = info;
+    return COLLECTOR_SUCCESS;
+}
+
+/* Sends one list_metrics_ext request whose records are returned in a
+ * buffer of the given capacity, inline if it is small enough */
+static collector_return_t list_metrics_ext(collector_client_t client, hg_addr_t addr, uint16_t provider_id, list_metrics_ext_in_t* in, list_metrics_ext_out_t* out, char** records)
+{
+    hg_handle_t h;
+    hg_return_t hret;
+    collector_return_t ret;
+    char* buf = NULL;
+
+    *records = NULL;
+    in->bulk = HG_BULK_NULL;
+    if(in->capacity > COLLECTOR_LIST_INLINE_MAX) {
+        hg_size_t buf_size = in->capacity;
+        buf = (char*)malloc(buf_size);
+        if(!buf)
+            return COLLECTOR_ERR_ALLOCATION;
+        hret = margo_bulk_create(client->mid, 1, (void**)&buf, &buf_size, HG_BULK_WRITE_ONLY, &in->bulk);
+        if(hret != HG_SUCCESS) {
+            free(buf);
+            return COLLECTOR_ERR_FROM_MERCURY;
+        }
+    }
+
+    hret = margo_create(client->mid, addr, client->list_metrics_ext_id, &h);
+    if(hret != HG_SUCCESS) {
+        ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_provider_forward(provider_id, h, in);
+    if(hret != HG_SUCCESS) {
+        ret = COLLECTOR_ERR_FROM_MERCURY;
+        margo_destroy(h);
+        goto finish;
+    }
+
+    hret = margo_get_output(h, out);
+    if(hret != HG_SUCCESS) {
+        ret = COLLECTOR_ERR_FROM_MERCURY;
+        margo_destroy(h);
+        goto finish;
+    }
+
+    ret = out->ret;
+    if(ret == COLLECTOR_SUCCESS) {
+        if(in->bulk == HG_BULK_NULL) {
+            /* records sent inline are freed with the output */
+            buf = (char*)malloc(out->size ? out->size : 1);
+            if(buf)
+                memcpy(buf, out->records, out->size);
+            else
+                ret = COLLECTOR_ERR_ALLOCATION;
+        }
+        *records = buf;
+        buf = NULL;
+    }
+    margo_free_output(h, out);
+    margo_destroy(h);
+
+finish:
+    if(in->bulk != HG_BULK_NULL)
+        margo_bulk_free(in->bulk);
+    free(buf);
+    return ret;
+}
+
+collector_return_t collector_remote_list_metrics_ext(collector_client_t client, hg_addr_t addr, uint16_t provider_id, const char *ns, collector_taglist_t taglist, uint64_t *token, size_t *count, collector_metric_info **infos)
+{
+    list_metrics_ext_in_t  in;
+    list_metrics_ext_out_t out;
+    collector_return_t ret;
+    char* records = NULL;
+
+    if(!token || !count || !infos)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    *infos = NULL;
+    if(*token == COLLECTOR_LIST_END) {
+        *count = 0;
+        return COLLECTOR_SUCCESS;
+    }
+
+    in.ns = (hg_string_t)(ns ? ns : "");
+    in.num_tags = taglist ? taglist->num_tags : 0;
+    in.tags = taglist ? taglist->taglist : NULL;
+    in.token = *token;
+    in.max_count = *count;
+    in.capacity = (*count ? *count : COLLECTOR_LIST_INLINE_MAX) * METRIC_INFO_SIZE_HINT;
+
+    ret = list_metrics_ext(client, addr, provider_id, &in, &out, &records);
+    if(ret == COLLECTOR_SUCCESS && out.count == 0 && out.needed) {
+        /* the first record of the page didn't fit, retry with enough room for it */
+        free(records);
+        in.capacity = out.needed;
+        ret = list_metrics_ext(client, addr, provider_id, &in, &out, &records);
+    }
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+
+    ret = decode_metric_infos(records, out.size, out.count, infos);
+    free(records);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    *count = out.count;
+    *token = out.next_token;
+    return COLLECTOR_SUCCESS;
+}
+
+/* Sends query requests until the series fit in the client's buffer, which
+ * is sized from the needed size returned by the provider */
+static collector_return_t query(collector_client_t client, hg_addr_t addr, uint16_t provider_id, query_in_t* in, query_out_t* out, char** records)
+{
+    hg_handle_t h;
+    hg_return_t hret;
+    collector_return_t ret;
+    char* buf;
+
+    for(;;) {
+        buf = NULL;
+        *records = NULL;
+        in->bulk = HG_BULK_NULL;
+        if(in->capacity > COLLECTOR_QUERY_INLINE_MAX) {
+            hg_size_t buf_size = in->capacity;
+            buf = (char*)malloc(buf_size);
+            if(!buf)
+                return COLLECTOR_ERR_ALLOCATION;
+            hret = margo_bulk_create(client->mid, 1, (void**)&buf, &buf_size, HG_BULK_WRITE_ONLY, &in->bulk);
+            if(hret != HG_SUCCESS) {
+                free(buf);
+                return COLLECTOR_ERR_FROM_MERCURY;
+            }
+        }
+
+        hret = margo_create(client->mid, addr, client->query_id, &h);
+        if(hret != HG_SUCCESS) {
+            ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+
+        hret = margo_provider_forward(provider_id, h, in);
+        if(hret != HG_SUCCESS) {
+            ret = COLLECTOR_ERR_FROM_MERCURY;
+            margo_destroy(h);
+            goto finish;
+        }
+
+        hret = margo_get_output(h, out);
+        if(hret != HG_SUCCESS) {
+            ret = COLLECTOR_ERR_FROM_MERCURY;
+            margo_destroy(h);
+            goto finish;
+        }
+
+        ret = out->ret;
+        if(ret == COLLECTOR_SUCCESS && !out->needed) {
+            if(in->bulk == HG_BULK_NULL) {
+                /* records sent inline are freed with the output */
+                buf = (char*)malloc(out->size ? out->size : 1);
+                if(buf)
+                    memcpy(buf, out->records, out->size);
+                else
+                    ret = COLLECTOR_ERR_ALLOCATION;
+            }
+            *records = buf;
+            buf = NULL;
+        }
+        margo_free_output(h, out);
+        margo_destroy(h);
+
+    finish:
+        if(in->bulk != HG_BULK_NULL)
+            margo_bulk_free(in->bulk);
+        free(buf);
+        /* metrics created since the previous attempt may need more room */
+        if(ret != COLLECTOR_SUCCESS || !out->needed)
+            return ret;
+        in->capacity = out->needed;
+    }
+}
+
+/* Decodes num_series series records into a single allocation */
+static collector_return_t decode_query_series(const char* records, size_t size, size_t num_series, size_t num_values, collector_query_series** series)
+{
+    query_series_header header;
+    size_t i, offset;
+
+    char* mem = (char*)malloc(num_series*sizeof(collector_query_series) + size + 1);
+    if(!mem)
+        return COLLECTOR_ERR_ALLOCATION;
+    collector_query_series* s = (collector_query_series*)mem;
+    char* data = mem + num_series*sizeof(collector_query_series);
+    memcpy(data, records, size);
+
+    for(i = 0, offset = 0; i < num_series; i++) {
+        if(offset + sizeof(header) > size)
+            goto error;
+        memcpy(&header, data + offset, sizeof(header));
+        offset += sizeof(header);
+        s[i].id = header.id;
+        s[i].num_metrics = header.num_metrics;
+        s[i].group = header.group_len ? data + offset : NULL;
+        offset += (header.group_len + 7) & ~(size_t)7;
+        s[i].values = (const double*)(data + offset);
+        offset += num_values*sizeof(double);
+        if(offset > size)
+            goto error;
+    }
+    *series = s;
+    return COLLECTOR_SUCCESS;
+
+error:
+    free(mem);
+    return COLLECTOR_ERR_FROM_MERCURY;
+}
+
+collector_return_t collector_remote_metric_query(collector_metric_handle_t handle, double t_start, double t_end, double step, size_t num_aggs, const collector_agg *aggs, size_t *num_windows, double **values)
+{
+    query_in_t  in;
+    query_out_t out;
+    collector_return_t ret;
+    char* records = NULL;
+    double n;
+
+    if(!num_windows || !values || (num_aggs && !aggs))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    *values = NULL;
+
+    memset(&in, 0, sizeof(in));
+    in.by_id = 1;
+    in.metric_id = handle->metric_id;
+    in.ns = (hg_string_t)"";
+    in.name = (hg_string_t)"";
+    in.grouping = QUERY_GROUP_NONE;
+    in.group_by = (hg_string_t)"";
+    in.t_start = t_start;
+    in.t_end = t_end;
+    in.step = step;
+    in.num_aggs = num_aggs;
+    in.aggs = (collector_agg*)aggs;
+    /* the size of a single series is known (the provider checks the
+     * arguments) */
+    n = (t_end - t_start) / step;
+    in.capacity = COLLECTOR_QUERY_INLINE_MAX;
+    if(n > 0 && n <= COLLECTOR_QUERY_MAX_WINDOWS && num_aggs <= COLLECTOR_QUERY_MAX_AGGS)
+        in.capacity = sizeof(query_series_header) + (size_t)ceil(n)*num_aggs*sizeof(double);
+
+    ret = query(handle->client, handle->addr, handle->provider_id, &in, &out, &records);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    if(out.num_series != 1 || out.size != sizeof(query_series_header) + out.num_windows*num_aggs*sizeof(double)) {
+        free(records);
+        return COLLECTOR_ERR_FROM_MERCURY;
+    }
+    /* the values follow the header: move them to the front of the buffer */
+    memmove(records, records + sizeof(query_series_header), out.num_windows*num_aggs*sizeof(double));
+    *values = (double*)records;
+    *num_windows = out.num_windows;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_remote_query(collector_client_t client, hg_addr_t addr, uint16_t provider_id, const char *ns, const char *name, collector_taglist_t taglist, const char *group_by, double t_start, double t_end, double step, size_t num_aggs, const collector_agg *aggs, size_t *num_windows, size_t *num_series, collector_query_series **series)
+{
+    query_in_t  in;
+    query_out_t out;
+    collector_return_t ret;
+    char* records = NULL;
+
+    if(!num_windows || !num_series || !series || (num_aggs && !aggs))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    *series = NULL;
+
+    memset(&in, 0, sizeof(in));
+    in.ns = (hg_string_t)(ns ? ns : "");
+    in.name = (hg_string_t)(name ? name : "");
+    in.num_tags = taglist ? taglist->num_tags : 0;
+    in.tags = taglist ? taglist->taglist : NULL;
+    if(!group_by)
+        in.grouping = QUERY_GROUP_NONE;
+    else if(!group_by[0])
+        in.grouping = QUERY_GROUP_ALL;
+    else
+        in.grouping = QUERY_GROUP_BY_KEY;
+    in.group_by = (hg_string_t)(group_by ? group_by : "");
+    in.t_start = t_start;
+    in.t_end = t_end;
+    in.step = step;
+    in.num_aggs = num_aggs;
+    in.aggs = (collector_agg*)aggs;
+    in.capacity = COLLECTOR_QUERY_INLINE_MAX;
+
+    ret = query(client, addr, provider_id, &in, &out, &records);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+
+    ret = decode_query_series(records, out.size, out.num_series, out.num_windows*num_aggs, series);
+    free(records);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    *num_windows = out.num_windows;
+    *num_series = out.num_series;
+    return COLLECTOR_SUCCESS;
+}
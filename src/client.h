@@ -13,8 +13,19 @@
 typedef struct collector_client {
    margo_instance_id mid;
    hg_id_t           metric_fetch_id;
+   hg_id_t           metric_fetch_range_id;
+   hg_id_t           metric_fetch_downsampled_id;
+   hg_id_t           metric_fetch_columns_id;
+   hg_id_t           metric_fetch_since_id;
+   hg_id_t           metric_fetch_batch_id;
+   hg_id_t           metric_fetch_stats_id;
+   hg_id_t           metric_fetch_histogram_id;
+   hg_id_t           metric_fetch_sketch_id;
    hg_id_t           list_metrics_id;
+   hg_id_t           list_metrics_ext_id;
+   hg_id_t           query_id;
    uint64_t          num_metric_handles;
+   uint32_t          fetch_encodings; /* COLLECTOR_ENCODING_* accepted by fetches */
 } collector_client;
 
 typedef struct collector_metric_handle {
@@ -25,4 +36,36 @@ typedef struct collector_metric_handle {
     collector_metric_id_t metric_id;
 } collector_metric_handle;
 
+/* pending non-blocking operation; complete decodes the response into
+ * the caller's output arguments once the RPC has completed */
+typedef struct collector_request {
+    margo_request       req;
+    hg_handle_t         h;
+    hg_bulk_t           bulk;
+    collector_return_t  (*complete)(struct collector_request* r);
+    void                (*release)(struct collector_request* r); /* frees the buffers of a request that won't complete, may be NULL */
+    union {
+        struct {
+            collector_metric_buffer  b;
+            int64_t*                 num_samples;
+            collector_metric_buffer* buf;
+            char**                   name;
+            char**                   ns;
+            uint64_t*                first_seq;
+            uint64_t*                next_seq;
+        } fetch;
+        struct {
+            collector_metric_id_t** ids;
+            size_t*                 count;
+        } list;
+    };
+} collector_request;
+
+/* position of a poller in the sample streams of a metric, see
+ * hg_proc_collector_cursor_positions */
+typedef struct collector_cursor {
+    hg_size_t num_positions;
+    uint64_t  positions[COLLECTOR_MAX_SHARDS+1];
+} collector_cursor;
+
 #endif
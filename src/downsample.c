@@ -0,0 +1,137 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include "downsample.h"
+
+/* Returns the index of the first of n samples that falls in bucket b of
+ * num_buckets buckets, i.e. b*n/num_buckets without overflowing: with
+ * n = q*num_buckets + r, it is b*q + b*r/num_buckets, where b and r are
+ * at most COLLECTOR_DOWNSAMPLE_MAX_POINTS */
+static inline uint64_t bucket_start(uint64_t b, uint64_t num_buckets, uint64_t n)
+{
+    return b * (n / num_buckets) + b * (n % num_buckets) / num_buckets;
+}
+
+static uint64_t downsample_minmax(collector_store_merge* it, uint64_t n, uint64_t num_points, collector_metric_sample* dst)
+{
+    uint64_t num_buckets = num_points / 2;
+    uint64_t b, i, end, lo_i, hi_i, count = 0;
+    collector_metric_sample s, lo, hi;
+
+    for(b = 0, i = 0; b < num_buckets; b++) {
+        end = bucket_start(b + 1, num_buckets, n);
+        if(!collector_store_merge_next(it, &s))
+            break;
+        lo = hi = s;
+        lo_i = hi_i = i;
+        for(i += 1; i < end && collector_store_merge_next(it, &s); i++) {
+            if(s.val < lo.val) {
+                lo = s;
+                lo_i = i;
+            } else if(s.val > hi.val) {
+                hi = s;
+                hi_i = i;
+            }
+        }
+        /* in time order, once if the bucket is flat */
+        dst[count++] = lo_i <= hi_i ? lo : hi;
+        if(lo_i != hi_i)
+            dst[count++] = lo_i <= hi_i ? hi : lo;
+    }
+    return count;
+}
+
+/* Average time (relative to the first sample) and value of an LTTB bucket */
+typedef struct lttb_point {
+    double time;
+    double val;
+} lttb_point;
+
+static collector_return_t downsample_lttb(collector_store_merge* it, uint64_t n, uint64_t num_points, collector_metric_sample* dst, uint64_t* count)
+{
+    uint64_t num_buckets = num_points - 2;
+    uint64_t b, i, end;
+    collector_metric_sample s, first, last, a, best;
+    lttb_point* avg;
+    lttb_point next;
+    double t0, area, best_area;
+
+    avg = (lttb_point*)calloc(num_buckets, sizeof(*avg));
+    if(!avg)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    /* first pass: the averages of the buckets of samples 1 to n-2 */
+    collector_store_merge_next(it, &first);
+    t0 = first.time;
+    for(b = 0, i = 1; b < num_buckets; b++) {
+        end = 1 + bucket_start(b + 1, num_buckets, n - 2);
+        for(; i < end && collector_store_merge_next(it, &s); i++) {
+            avg[b].time += s.time - t0;
+            avg[b].val  += s.val;
+        }
+        avg[b].time /= (double)(end - (1 + bucket_start(b, num_buckets, n - 2)));
+        avg[b].val  /= (double)(end - (1 + bucket_start(b, num_buckets, n - 2)));
+    }
+    collector_store_merge_next(it, &last);
+
+    /* second pass: the sample of each bucket forming the largest triangle
+     * with the previous choice and the next bucket's average */
+    collector_store_merge_rewind(it);
+    collector_store_merge_next(it, &a);
+    dst[0] = a;
+    for(b = 0, i = 1; b < num_buckets; b++) {
+        if(b + 1 < num_buckets) {
+            next = avg[b + 1];
+        } else {
+            next.time = last.time - t0;
+            next.val  = last.val;
+        }
+        end = 1 + bucket_start(b + 1, num_buckets, n - 2);
+        best_area = -1;
+        best = a;
+        for(; i < end && collector_store_merge_next(it, &s); i++) {
+            area = fabs((a.time - t0 - next.time) * (s.val - a.val)
+                      - (a.time - s.time) * (next.val - a.val));
+            if(area > best_area || best_area < 0) {
+                best_area = area;
+                best = s;
+            }
+        }
+        dst[b + 1] = best;
+        a = best;
+    }
+    dst[num_buckets + 1] = last;
+    *count = num_points;
+
+    free(avg);
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_downsample(collector_store_merge* it, uint32_t method, uint64_t num_points, collector_metric_sample* dst, uint64_t* count)
+{
+    uint64_t n = collector_store_merge_remaining(it);
+    uint64_t i;
+
+    *count = 0;
+    if(method == COLLECTOR_DOWNSAMPLE_LTTB && num_points < 3)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    if(method == COLLECTOR_DOWNSAMPLE_MINMAX && num_points < 2)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    if(method != COLLECTOR_DOWNSAMPLE_LTTB && method != COLLECTOR_DOWNSAMPLE_MINMAX)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    if(n <= num_points) {
+        for(i = 0; i < n && collector_store_merge_next(it, &dst[i]); i++);
+        *count = i;
+        return COLLECTOR_SUCCESS;
+    }
+    if(method == COLLECTOR_DOWNSAMPLE_MINMAX) {
+        *count = downsample_minmax(it, n, num_points, dst);
+        return COLLECTOR_SUCCESS;
+    }
+    return downsample_lttb(it, n, num_points, dst, count);
+}
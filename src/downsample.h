@@ -0,0 +1,29 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __DOWNSAMPLE_H
+#define __DOWNSAMPLE_H
+
+#include "store.h"
+
+/**
+ * @brief Summarizes the samples left to visit by an iterator into at most
+ * num_points samples of dst, in time order, with one of the
+ * COLLECTOR_DOWNSAMPLE_* methods. The samples are split into buckets of
+ * (nearly) equally many samples, and each bucket is represented by:
+ *
+ * - LTTB: the sample forming the largest triangle with the sample chosen
+ *   in the previous bucket and the average of the next bucket
+ *   (Steinarsson, "Downsampling Time Series for Visual Representation"),
+ *   the first and last samples being kept;
+ * - MINMAX: its samples of lowest and highest value.
+ *
+ * All the samples are copied if there are at most num_points of them.
+ * LTTB visits the samples twice (rewinding the iterator) and needs
+ * num_points >= 3, MINMAX visits them once and needs num_points >= 2.
+ */
+collector_return_t collector_downsample(collector_store_merge* it, uint32_t method, uint64_t num_points, collector_metric_sample* dst, uint64_t* count);
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "collector/collector-dump.h"
+
+struct collector_dump {
+    void*               map;
+    size_t              size;
+    collector_dump_info info;
+    const char**        tags;
+};
+
+/* Checks the header and strings of a mapped dump and fills its info */
+static collector_return_t dump_parse(struct collector_dump* d)
+{
+    const collector_dump_header* h = (const collector_dump_header*)d->map;
+    const char *p, *end;
+    uint64_t i;
+
+    if(d->size < sizeof(*h) || memcmp(h->magic, COLLECTOR_DUMP_MAGIC, sizeof(h->magic)))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    if(h->version != COLLECTOR_DUMP_VERSION || h->byte_order != COLLECTOR_DUMP_BYTE_ORDER)
+        return COLLECTOR_ERR_OP_UNSUPPORTED;
+    /* written so that sizes can't overflow */
+    if(h->header_size < sizeof(*h) || h->chunk_samples == 0
+    || h->data_offset % COLLECTOR_DUMP_ALIGN
+    || h->data_offset > d->size
+    || h->header_size > h->data_offset
+    || h->strings_size > h->data_offset - h->header_size
+    || h->num_samples > (d->size - h->data_offset) / COLLECTOR_DUMP_SAMPLE_SIZE)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* the namespace, name and description, then the tags */
+    if(h->num_tags > h->strings_size)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    d->tags = (const char**)calloc(h->num_tags + 3, sizeof(*d->tags));
+    if(!d->tags)
+        return COLLECTOR_ERR_ALLOCATION;
+    p   = (const char*)d->map + h->header_size;
+    end = p + h->strings_size;
+    for(i = 0; i < h->num_tags + 3; i++) {
+        d->tags[i] = p;
+        p = (const char*)memchr(p, '\0', end - p);
+        if(!p)
+            return COLLECTOR_ERR_INVALID_ARGS;
+        p++;
+    }
+
+    d->info.id          = h->id;
+    d->info.type        = (collector_metric_type_t)h->type;
+    d->info.num_samples = h->num_samples;
+    d->info.num_chunks  = (h->num_samples + h->chunk_samples - 1) / h->chunk_samples;
+    d->info.ns          = d->tags[0];
+    d->info.name        = d->tags[1];
+    d->info.desc        = d->tags[2];
+    d->info.num_tags    = h->num_tags;
+    d->info.tags        = d->tags + 3;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_dump_open(const char* filename, collector_dump_t* dump)
+{
+    struct collector_dump* d;
+    collector_return_t ret;
+    struct stat st;
+    int fd;
+
+    if(!filename || !dump)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    d = (struct collector_dump*)calloc(1, sizeof(*d));
+    if(!d)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    fd = open(filename, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        if(fd >= 0) close(fd);
+        free(d);
+        return COLLECTOR_ERR_IO;
+    }
+    if((size_t)st.st_size < sizeof(collector_dump_header)) {
+        close(fd);
+        free(d);
+        return COLLECTOR_ERR_INVALID_ARGS;
+    }
+    d->size = (size_t)st.st_size;
+    d->map  = mmap(NULL, d->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(d->map == MAP_FAILED) {
+        free(d);
+        return COLLECTOR_ERR_IO;
+    }
+
+    ret = dump_parse(d);
+    if(ret != COLLECTOR_SUCCESS) {
+        collector_dump_close(d);
+        return ret;
+    }
+    /* chunks are read once, in order */
+    madvise(d->map, d->size, MADV_SEQUENTIAL);
+    *dump = d;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_dump_close(collector_dump_t dump)
+{
+    if(!dump)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    munmap(dump->map, dump->size);
+    free(dump->tags);
+    free(dump);
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_dump_get_info(collector_dump_t dump, collector_dump_info* info)
+{
+    if(!dump || !info)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    *info = dump->info;
+    return COLLECTOR_SUCCESS;
+}
+
+uint64_t collector_dump_chunk(collector_dump_t dump, uint64_t c, const double** time, const double** val, const uint64_t** sample_id)
+{
+    const collector_dump_header* h = (const collector_dump_header*)dump->map;
+    const char* chunk;
+    uint64_t n;
+
+    if(c >= dump->info.num_chunks)
+        return 0;
+    n = h->num_samples - c*h->chunk_samples;
+    if(n > h->chunk_samples)
+        n = h->chunk_samples;
+    chunk = (const char*)dump->map + h->data_offset + c*h->chunk_samples*COLLECTOR_DUMP_SAMPLE_SIZE;
+    if(time)      *time      = (const double*)chunk;
+    if(val)       *val       = (const double*)(chunk + n*sizeof(double));
+    if(sample_id) *sample_id = (const uint64_t*)(chunk + 2*n*sizeof(double));
+    return n;
+}
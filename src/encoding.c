@@ -0,0 +1,184 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "encoding.h"
+#include "gorilla.h"
+
+static inline uint64_t double_bits(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static inline double bits_double(uint64_t u)
+{
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+/* Writes the zigzag varint of a difference, returning its size or 0 if it
+ * doesn't fit in the end - p bytes left */
+static inline size_t put_varint(uint8_t* p, const uint8_t* end, uint64_t diff)
+{
+    uint64_t u = (diff << 1) ^ (uint64_t)((int64_t)diff >> 63);
+    size_t len = 0;
+
+    do {
+        if(p + len == end)
+            return 0;
+        p[len++] = (uint8_t)(u & 0x7f) | (u >= 0x80 ? 0x80 : 0);
+        u >>= 7;
+    } while(u);
+    return len;
+}
+
+static inline size_t get_varint(const uint8_t* p, const uint8_t* end, uint64_t* diff)
+{
+    uint64_t u = 0;
+    size_t len = 0;
+    unsigned shift = 0;
+
+    do {
+        if(p + len == end || shift > 63)
+            return 0;
+        u |= (uint64_t)(p[len] & 0x7f) << shift;
+        shift += 7;
+    } while(p[len++] & 0x80);
+    *diff = (u >> 1) ^ (uint64_t)-(int64_t)(u & 1);
+    return len;
+}
+
+static size_t encode_delta(const collector_metric_sample* samples, size_t n, uint8_t* buf, size_t capacity)
+{
+    const uint8_t* end = buf + capacity;
+    uint64_t t = 0, v = 0, id = 0, bits;
+    size_t size = 0, i, len;
+
+    for(i = 0; i < n; i++) {
+        bits = double_bits(samples[i].time);
+        if(!(len = put_varint(buf + size, end, bits - t)))
+            return 0;
+        size += len;
+        t = bits;
+        bits = double_bits(samples[i].val);
+        if(!(len = put_varint(buf + size, end, bits - v)))
+            return 0;
+        size += len;
+        v = bits;
+        if(!(len = put_varint(buf + size, end, samples[i].sample_id - id)))
+            return 0;
+        size += len;
+        id = samples[i].sample_id;
+    }
+    return size;
+}
+
+static int decode_delta(const uint8_t* buf, size_t size, collector_metric_sample* samples, size_t n)
+{
+    const uint8_t* end = buf + size;
+    uint64_t t = 0, v = 0, id = 0, diff;
+    size_t pos = 0, i, len;
+
+    for(i = 0; i < n; i++) {
+        if(!(len = get_varint(buf + pos, end, &diff)))
+            return 0;
+        pos += len;
+        t += diff;
+        if(!(len = get_varint(buf + pos, end, &diff)))
+            return 0;
+        pos += len;
+        v += diff;
+        if(!(len = get_varint(buf + pos, end, &diff)))
+            return 0;
+        pos += len;
+        id += diff;
+        samples[i].time      = bits_double(t);
+        samples[i].val       = bits_double(v);
+        samples[i].sample_id = id;
+    }
+    return pos == size;
+}
+
+size_t collector_encode_samples(uint32_t encoding, const collector_metric_sample* samples, size_t n, void* buf, size_t capacity)
+{
+    collector_gorilla_encoder enc;
+    size_t i;
+
+    switch(encoding) {
+    case COLLECTOR_ENCODING_RAW:
+        if(n*sizeof(*samples) > capacity)
+            return 0;
+        memcpy(buf, samples, n*sizeof(*samples));
+        return n*sizeof(*samples);
+    case COLLECTOR_ENCODING_DELTA:
+        return encode_delta(samples, n, (uint8_t*)buf, capacity);
+    case COLLECTOR_ENCODING_GORILLA:
+        collector_gorilla_encoder_init(&enc, (uint64_t*)buf, capacity / sizeof(uint64_t));
+        for(i = 0; i < n; i++) {
+            if(!collector_gorilla_put(&enc, samples[i].time, samples[i].val, samples[i].sample_id))
+                return 0;
+        }
+        return collector_gorilla_words(&enc)*sizeof(uint64_t);
+    }
+    return 0;
+}
+
+int collector_decode_samples(uint32_t encoding, const void* buf, size_t size, collector_metric_sample* samples, size_t n)
+{
+    collector_gorilla_decoder dec;
+    size_t i;
+
+    switch(encoding) {
+    case COLLECTOR_ENCODING_RAW:
+        if(size != n*sizeof(*samples))
+            return 0;
+        memcpy(samples, buf, size);
+        return 1;
+    case COLLECTOR_ENCODING_DELTA:
+        return decode_delta((const uint8_t*)buf, size, samples, n);
+    case COLLECTOR_ENCODING_GORILLA:
+        if(size % sizeof(uint64_t))
+            return 0;
+        collector_gorilla_decoder_init(&dec, (const uint64_t*)buf, size / sizeof(uint64_t));
+        for(i = 0; i < n; i++) {
+            if(!collector_gorilla_get(&dec, &samples[i].time, &samples[i].val, &samples[i].sample_id))
+                return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+void* collector_encode_best(uint32_t encodings, const collector_metric_sample* samples, size_t n, uint32_t* encoding, size_t* size)
+{
+    static const uint32_t order[] = { COLLECTOR_ENCODING_GORILLA, COLLECTOR_ENCODING_DELTA };
+    void *best = NULL, *tmp = NULL, *swap;
+    size_t i, len;
+
+    *encoding = COLLECTOR_ENCODING_RAW;
+    *size = n*sizeof(collector_metric_sample);
+    if(n == 0)
+        return NULL;
+    for(i = 0; i < sizeof(order)/sizeof(order[0]); i++) {
+        if(!(encodings & order[i]))
+            continue;
+        if(!tmp && !(tmp = malloc(*size)))
+            break;
+        len = collector_encode_samples(order[i], samples, n, tmp, *size - 1);
+        if(len) {
+            swap = best;
+            best = tmp;
+            tmp = swap;
+            *encoding = order[i];
+            *size = len;
+        }
+    }
+    free(tmp);
+    return best;
+}
@@ -0,0 +1,44 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __ENCODING_H
+#define __ENCODING_H
+
+#include <stddef.h>
+#include "collector/collector-common.h"
+
+/**
+ * @brief Encodes samples for a transfer with one of the
+ * COLLECTOR_ENCODING_* encodings:
+ *
+ * - RAW: the samples as they are;
+ * - DELTA: for each sample, the differences between the bit patterns of
+ *   its time and value and those of the previous sample, and between
+ *   their sample ids, as zigzag varints;
+ * - GORILLA: the stream of collector_gorilla_put (see gorilla.h), as
+ *   64-bit words.
+ *
+ * buf must be 8-byte aligned. Returns the size in bytes of the encoded
+ * samples, or 0 if they don't fit in capacity bytes.
+ */
+size_t collector_encode_samples(uint32_t encoding, const collector_metric_sample* samples, size_t n, void* buf, size_t capacity);
+
+/**
+ * @brief Decodes the n samples that collector_encode_samples encoded in
+ * size bytes. Returns 0 if the buffer doesn't hold n samples.
+ */
+int collector_decode_samples(uint32_t encoding, const void* buf, size_t size, collector_metric_sample* samples, size_t n);
+
+/**
+ * @brief Encodes n samples in the most compact of the encodings allowed
+ * by the encodings mask, trying each one with a capacity below the best
+ * size so far so that it gives up early if it can't do better. Sets
+ * encoding and size (in bytes) to those chosen and returns the encoded
+ * samples, to free, or NULL if RAW is the most compact (or memory is
+ * short).
+ */
+void* collector_encode_best(uint32_t encodings, const collector_metric_sample* samples, size_t n, uint32_t* encoding, size_t* size);
+
+#endif
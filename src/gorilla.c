@@ -0,0 +1,199 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <string.h>
+#include "gorilla.h"
+
+static inline uint64_t double_bits(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static inline double bits_double(uint64_t u)
+{
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+/* Writes the n (1 to 64) low bits of v */
+static inline int put_bits(collector_gorilla_encoder* enc, uint64_t v, unsigned n)
+{
+    size_t   w    = enc->num_bits / 64;
+    unsigned used = enc->num_bits % 64;
+    unsigned room = 64 - used;
+
+    if(enc->num_bits + n > enc->capacity*64)
+        return 0;
+    if(n < 64)
+        v &= ((uint64_t)1 << n) - 1;
+    if(used == 0)
+        enc->words[w] = 0;
+    if(n <= room) {
+        enc->words[w] |= v << (room - n);
+    } else {
+        enc->words[w] |= v >> (n - room);
+        enc->words[w+1] = v << (64 - (n - room));
+    }
+    enc->num_bits += n;
+    return 1;
+}
+
+/* Reads n (1 to 64) bits, setting *ok to 0 past the end of the stream */
+static inline uint64_t get_bits(collector_gorilla_decoder* dec, unsigned n, int* ok)
+{
+    size_t   w    = dec->pos / 64;
+    unsigned used = dec->pos % 64;
+    unsigned room = 64 - used;
+    uint64_t v;
+
+    if(dec->pos + n > dec->num_bits) {
+        *ok = 0;
+        return 0;
+    }
+    v = (dec->words[w] << used) >> (64 - n);
+    if(n > room)
+        v |= dec->words[w+1] >> (64 - (n - room));
+    dec->pos += n;
+    return v;
+}
+
+/* Delta-of-deltas are zigzag-encoded, then stored with a prefix giving
+ * their size: 0 (1 bit), 7 bits (2+7), 12 bits (3+12), 20 bits (4+20),
+ * 32 bits (5+32) or 64 bits (5+64) */
+static int put_dod(collector_gorilla_encoder* enc, uint64_t dod)
+{
+    uint64_t u = (dod << 1) ^ (uint64_t)((int64_t)dod >> 63);
+
+    if(u == 0)
+        return put_bits(enc, 0x0, 1);
+    if(u < ((uint64_t)1 << 7))
+        return put_bits(enc, 0x2, 2) && put_bits(enc, u, 7);
+    if(u < ((uint64_t)1 << 12))
+        return put_bits(enc, 0x6, 3) && put_bits(enc, u, 12);
+    if(u < ((uint64_t)1 << 20))
+        return put_bits(enc, 0xe, 4) && put_bits(enc, u, 20);
+    if(u < ((uint64_t)1 << 32))
+        return put_bits(enc, 0x1e, 5) && put_bits(enc, u, 32);
+    return put_bits(enc, 0x1f, 5) && put_bits(enc, u, 64);
+}
+
+static uint64_t get_dod(collector_gorilla_decoder* dec, int* ok)
+{
+    static const unsigned sizes[] = { 0, 7, 12, 20, 32, 64 };
+    unsigned ones = 0;
+    uint64_t u;
+
+    while(ones < 5 && get_bits(dec, 1, ok))
+        ones += 1;
+    if(ones == 0)
+        return 0;
+    u = get_bits(dec, sizes[ones], ok);
+    return (u >> 1) ^ (uint64_t)-(int64_t)(u & 1);
+}
+
+void collector_gorilla_encoder_init(collector_gorilla_encoder* enc, uint64_t* words, size_t capacity)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->words    = words;
+    enc->capacity = capacity;
+}
+
+int collector_gorilla_put(collector_gorilla_encoder* enc, double time, double val, uint64_t sample_id)
+{
+    uint64_t t = double_bits(time), v = double_bits(val);
+    uint64_t delta, x;
+    unsigned leading, trailing;
+
+    if(enc->count == 0) {
+        if(!put_bits(enc, t, 64) || !put_bits(enc, v, 64) || !put_bits(enc, sample_id, 64))
+            return 0;
+        goto done;
+    }
+
+    delta = t - enc->time;
+    if(!put_dod(enc, delta - enc->time_delta))
+        return 0;
+    enc->time_delta = delta;
+
+    /* values: '0' if unchanged, '10' and the meaningful bits of the XOR if
+     * they fit in the previous window, '11', the window and the bits
+     * otherwise */
+    x = v ^ enc->val;
+    if(x == 0) {
+        if(!put_bits(enc, 0x0, 1))
+            return 0;
+    } else {
+        leading  = __builtin_clzll(x);
+        trailing = __builtin_ctzll(x);
+        if(enc->window && leading >= enc->leading && trailing >= enc->trailing) {
+            if(!put_bits(enc, 0x2, 2) || !put_bits(enc, x >> enc->trailing, 64 - enc->leading - enc->trailing))
+                return 0;
+        } else {
+            if(!put_bits(enc, 0x3, 2) || !put_bits(enc, leading, 6)
+            || !put_bits(enc, 63 - leading - trailing, 6) || !put_bits(enc, x >> trailing, 64 - leading - trailing))
+                return 0;
+            enc->leading  = leading;
+            enc->trailing = trailing;
+            enc->window   = 1;
+        }
+    }
+
+    delta = sample_id - enc->sample_id;
+    if(!put_dod(enc, delta - enc->id_delta))
+        return 0;
+    enc->id_delta = delta;
+
+done:
+    enc->time      = t;
+    enc->val       = v;
+    enc->sample_id = sample_id;
+    enc->count    += 1;
+    return 1;
+}
+
+void collector_gorilla_decoder_init(collector_gorilla_decoder* dec, const uint64_t* words, size_t num_words)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->words    = words;
+    dec->num_bits = num_words*64;
+}
+
+int collector_gorilla_get(collector_gorilla_decoder* dec, double* time, double* val, uint64_t* sample_id)
+{
+    unsigned len;
+    int ok = 1;
+
+    if(dec->count == 0) {
+        dec->time      = get_bits(dec, 64, &ok);
+        dec->val       = get_bits(dec, 64, &ok);
+        dec->sample_id = get_bits(dec, 64, &ok);
+    } else {
+        dec->time_delta += get_dod(dec, &ok);
+        dec->time       += dec->time_delta;
+        if(get_bits(dec, 1, &ok)) {
+            if(get_bits(dec, 1, &ok)) {
+                dec->leading  = get_bits(dec, 6, &ok);
+                len           = get_bits(dec, 6, &ok) + 1;
+                if(dec->leading + len > 64)
+                    return 0;
+                dec->trailing = 64 - dec->leading - len;
+            }
+            len = 64 - dec->leading - dec->trailing;
+            dec->val ^= get_bits(dec, len, &ok) << dec->trailing;
+        }
+        dec->id_delta  += get_dod(dec, &ok);
+        dec->sample_id += dec->id_delta;
+    }
+    if(!ok)
+        return 0;
+    dec->count += 1;
+    *time      = bits_double(dec->time);
+    *val       = bits_double(dec->val);
+    *sample_id = dec->sample_id;
+    return 1;
+}
@@ -0,0 +1,76 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __GORILLA_H
+#define __GORILLA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Gorilla-style compression of a stream of samples (Pelkonen et
+ * al., "Gorilla: A Fast, Scalable, In-Memory Time Series Database"):
+ * times and sample ids are stored as delta-of-deltas and values as their
+ * XOR with the previous value, in a stream of bits.
+ *
+ * Times are doubles. Their deltas are taken between their bit patterns,
+ * which grow with the time within a binade, so that nearly regular times
+ * have small delta-of-deltas; the encoding is lossless for any time.
+ */
+typedef struct collector_gorilla_encoder {
+    uint64_t* words;      /* bits, most significant first */
+    size_t    capacity;   /* size of words, in words */
+    size_t    num_bits;
+    uint64_t  count;      /* samples encoded */
+    uint64_t  time;       /* bit pattern of the previous time */
+    uint64_t  time_delta;
+    uint64_t  val;        /* bit pattern of the previous value */
+    uint64_t  sample_id;
+    uint64_t  id_delta;
+    uint32_t  leading;    /* window of the meaningful bits of the previous XOR */
+    uint32_t  trailing;
+    int       window;     /* leading and trailing are set */
+} collector_gorilla_encoder;
+
+typedef struct collector_gorilla_decoder {
+    const uint64_t* words;
+    size_t          num_bits;
+    size_t          pos;
+    uint64_t        count;
+    uint64_t        time;
+    uint64_t        time_delta;
+    uint64_t        val;
+    uint64_t        sample_id;
+    uint64_t        id_delta;
+    uint32_t        leading;
+    uint32_t        trailing;
+} collector_gorilla_decoder;
+
+void collector_gorilla_encoder_init(collector_gorilla_encoder* enc, uint64_t* words, size_t capacity);
+
+/**
+ * @brief Appends a sample to the stream. Returns 0 if it doesn't fit in
+ * the encoder's buffer, which is then left unusable.
+ */
+int collector_gorilla_put(collector_gorilla_encoder* enc, double time, double val, uint64_t sample_id);
+
+/**
+ * @brief Returns the number of words of the stream.
+ */
+static inline size_t collector_gorilla_words(const collector_gorilla_encoder* enc)
+{
+    return (enc->num_bits + 63) / 64;
+}
+
+void collector_gorilla_decoder_init(collector_gorilla_decoder* dec, const uint64_t* words, size_t num_words);
+
+/**
+ * @brief Decodes the next sample of the stream. Returns 0 at the end of
+ * the stream or if it is corrupted: the decoder never reads past its
+ * num_words words.
+ */
+int collector_gorilla_get(collector_gorilla_decoder* dec, double* time, double* val, uint64_t* sample_id);
+
+#endif
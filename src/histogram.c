@@ -0,0 +1,77 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+
+static collector_return_t histogram_alloc(size_t num_bounds, collector_histogram** hist)
+{
+    collector_histogram* h = (collector_histogram*)calloc(1, sizeof(*h));
+    if(!h)
+        return COLLECTOR_ERR_ALLOCATION;
+    h->num_bounds = num_bounds;
+    h->bounds = (double*)calloc(num_bounds, sizeof(double));
+    h->counts = (uint64_t*)calloc(num_bounds + 1, sizeof(uint64_t));
+    if(!h->bounds || !h->counts) {
+        collector_histogram_destroy(h);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    *hist = h;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_histogram_create_fixed(const double* bounds, size_t num_bounds, collector_histogram** hist)
+{
+    collector_return_t ret;
+    size_t i;
+
+    if(!bounds || num_bounds == 0)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    for(i = 1; i < num_bounds; i++) {
+        if(bounds[i] <= bounds[i-1])
+            return COLLECTOR_ERR_INVALID_ARGS;
+    }
+
+    ret = histogram_alloc(num_bounds, hist);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    memcpy((*hist)->bounds, bounds, num_bounds*sizeof(double));
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_histogram_create_loglinear(double min, double max, uint32_t sub_buckets, collector_histogram** hist)
+{
+    collector_return_t ret;
+    int num_powers;
+    size_t i;
+
+    if(!(min > 0) || !(max > min) || sub_buckets == 0)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* number of powers of two needed to reach max from min */
+    frexp(max / min, &num_powers);
+    if(ldexp(min, num_powers - 1) == max)
+        num_powers -= 1;
+
+    ret = histogram_alloc((size_t)num_powers*sub_buckets + 1, hist);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    (*hist)->loglin_min = min;
+    (*hist)->loglin_sub_buckets = sub_buckets;
+    for(i = 0; i < (*hist)->num_bounds; i++) {
+        double power = ldexp(min, (int)(i / sub_buckets));
+        (*hist)->bounds[i] = power + power*(double)(i % sub_buckets)/sub_buckets;
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_histogram_destroy(collector_histogram* hist)
+{
+    if(!hist) return;
+    free(hist->bounds);
+    free(hist->counts);
+    free(hist);
+}
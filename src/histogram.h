@@ -0,0 +1,78 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <math.h>
+#include <stddef.h>
+#include "collector/collector-common.h"
+
+/**
+ * @brief Bucket counters of a COLLECTOR_TYPE_HISTOGRAM metric.
+ *
+ * There are num_bounds+1 buckets: bucket 0 counts values lower than
+ * bounds[0], bucket i counts values in [bounds[i-1], bounds[i]), and the
+ * last bucket counts values greater than or equal to bounds[num_bounds-1].
+ *
+ * Log-linear histograms split each power of two above loglin_min into
+ * loglin_sub_buckets linear buckets, which lets the bucket of a value be
+ * computed in constant time. Fixed bounds are searched by bisection.
+ */
+typedef struct collector_histogram {
+    size_t    num_bounds;
+    double*   bounds;
+    uint64_t* counts;             /* incremented atomically */
+    double    loglin_min;         /* 0 for fixed bounds */
+    uint32_t  loglin_sub_buckets;
+} collector_histogram;
+
+/**
+ * @brief Creates a histogram with the given sorted upper bounds.
+ */
+collector_return_t collector_histogram_create_fixed(const double* bounds, size_t num_bounds, collector_histogram** hist);
+
+/**
+ * @brief Creates a log-linear histogram covering [min, max).
+ */
+collector_return_t collector_histogram_create_loglinear(double min, double max, uint32_t sub_buckets, collector_histogram** hist);
+
+void collector_histogram_destroy(collector_histogram* hist);
+
+static inline size_t collector_histogram_bucket(const collector_histogram* hist, double val)
+{
+    size_t lo, hi, mid;
+
+    if(hist->loglin_min > 0) {
+        int exp;
+        size_t index;
+        if(val < hist->loglin_min)
+            return 0;
+        /* val/min = mantissa*2^exp with mantissa in [0.5, 1) */
+        double mantissa = frexp(val / hist->loglin_min, &exp);
+        index = 1 + (size_t)(exp - 1)*hist->loglin_sub_buckets
+                  + (size_t)((2*mantissa - 1)*hist->loglin_sub_buckets);
+        return index < hist->num_bounds ? index : hist->num_bounds;
+    }
+
+    /* first bound greater than val */
+    lo = 0;
+    hi = hist->num_bounds;
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(hist->bounds[mid] <= val)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static inline void collector_histogram_update(collector_histogram* hist, double val)
+{
+    __atomic_fetch_add(&hist->counts[collector_histogram_bucket(hist, val)], 1, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "index.h"
+
+/* Returns the position of the first metric of a posting list, from lo,
+ * whose serial is >= serial */
+static size_t posting_lower_bound(const collector_posting* p, size_t lo, uint64_t serial)
+{
+    size_t hi = p->size, mid;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(p->metrics[mid]->serial < serial)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static collector_return_t posting_add(collector_posting** head, uint32_t key, collector_metric* metric)
+{
+    collector_posting* p = NULL;
+
+    HASH_FIND(hh, *head, &key, sizeof(key), p);
+    if(!p) {
+        p = (collector_posting*)calloc(1, sizeof(*p));
+        if(!p)
+            return COLLECTOR_ERR_ALLOCATION;
+        p->key = key;
+        HASH_ADD(hh, *head, key, sizeof(p->key), p);
+    }
+    /* a metric with a duplicate label is only listed once */
+    if(p->size && p->metrics[p->size-1] == metric)
+        return COLLECTOR_SUCCESS;
+    if(p->size == p->capacity) {
+        size_t capacity = p->capacity ? 2*p->capacity : 4;
+        collector_metric** metrics = (collector_metric**)realloc(p->metrics, capacity*sizeof(*metrics));
+        if(!metrics)
+            return COLLECTOR_ERR_ALLOCATION;
+        p->metrics = metrics;
+        p->capacity = capacity;
+    }
+    p->metrics[p->size++] = metric;
+    return COLLECTOR_SUCCESS;
+}
+
+static void posting_free(collector_posting** head, collector_posting* p)
+{
+    HASH_DEL(*head, p);
+    free(p->metrics);
+    free(p);
+}
+
+static void posting_remove(collector_posting** head, uint32_t key, const collector_metric* metric)
+{
+    collector_posting* p = NULL;
+    size_t i;
+
+    HASH_FIND(hh, *head, &key, sizeof(key), p);
+    if(!p)
+        return;
+    i = posting_lower_bound(p, 0, metric->serial);
+    if(i == p->size || p->metrics[i] != metric)
+        return;
+    memmove(&p->metrics[i], &p->metrics[i+1], (p->size - i - 1)*sizeof(*p->metrics));
+    p->size -= 1;
+    if(p->size == 0)
+        posting_free(head, p);
+}
+
+collector_return_t collector_index_add(collector_index* index, collector_metric* metric)
+{
+    collector_return_t ret;
+    uint32_t i;
+
+    ret = posting_add(&index->by_ns, metric->cold->ns, metric);
+    if(ret == COLLECTOR_SUCCESS)
+        ret = posting_add(&index->by_name, metric->cold->name, metric);
+    for(i = 0; ret == COLLECTOR_SUCCESS && i < metric->cold->labels->num_labels; i++)
+        ret = posting_add(&index->by_label, metric->cold->labels->labels[i], metric);
+    if(ret != COLLECTOR_SUCCESS)
+        collector_index_remove(index, metric);
+    return ret;
+}
+
+void collector_index_remove(collector_index* index, const collector_metric* metric)
+{
+    uint32_t i;
+
+    posting_remove(&index->by_ns, metric->cold->ns, metric);
+    posting_remove(&index->by_name, metric->cold->name, metric);
+    for(i = 0; i < metric->cold->labels->num_labels; i++)
+        posting_remove(&index->by_label, metric->cold->labels->labels[i], metric);
+}
+
+void collector_index_finalize(collector_index* index)
+{
+    collector_posting *p, *tmp;
+
+    HASH_ITER(hh, index->by_ns, p, tmp)
+        posting_free(&index->by_ns, p);
+    HASH_ITER(hh, index->by_name, p, tmp)
+        posting_free(&index->by_name, p);
+    HASH_ITER(hh, index->by_label, p, tmp)
+        posting_free(&index->by_label, p);
+}
+
+int collector_selector_empty(const collector_selector* sel)
+{
+    return (!sel->ns || !sel->ns[0]) && (!sel->name || !sel->name[0]) && sel->num_tags == 0;
+}
+
+collector_return_t collector_index_select(const collector_index* index, const collector_intern* strings, const collector_selector* sel, uint64_t token, collector_metric*** metrics, size_t* count)
+{
+    const collector_posting** lists;
+    const collector_posting* p;
+    size_t num_lists = 0, i, j, n = 0;
+    size_t* pos = NULL;
+    collector_metric** result = NULL;
+
+    *metrics = NULL;
+    *count = 0;
+
+    lists = (const collector_posting**)calloc(sel->num_tags + 2, sizeof(*lists));
+    if(!lists)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    /* gather the posting list of each criterion, any string that isn't
+     * interned (i.e. that no metric has) means no match */
+#define FIND_POSTING(head, str) do { \
+        collector_posting* _p = NULL; \
+        uint32_t _key = collector_intern_find(strings, str); \
+        if(!_key) goto finish; \
+        HASH_FIND(hh, head, &_key, sizeof(_key), _p); \
+        if(!_p) goto finish; \
+        lists[num_lists++] = _p; \
+    } while(0)
+    if(sel->ns && sel->ns[0])
+        FIND_POSTING(index->by_ns, sel->ns);
+    if(sel->name && sel->name[0])
+        FIND_POSTING(index->by_name, sel->name);
+    for(i = 0; i < sel->num_tags; i++)
+        FIND_POSTING(index->by_label, sel->tags[i]);
+#undef FIND_POSTING
+    if(num_lists == 0)
+        goto finish;
+
+    /* the shortest list drives the intersection */
+    for(i = 1; i < num_lists; i++) {
+        if(lists[i]->size < lists[0]->size) {
+            p = lists[0];
+            lists[0] = lists[i];
+            lists[i] = p;
+        }
+    }
+
+    pos = (size_t*)calloc(num_lists, sizeof(*pos));
+    result = (collector_metric**)malloc((lists[0]->size ? lists[0]->size : 1)*sizeof(*result));
+    if(!pos || !result) {
+        free(pos);
+        free(result);
+        free(lists);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+
+    /* candidates are visited in serial order, so the position found in
+     * each other list is where the next search starts from */
+    for(i = posting_lower_bound(lists[0], 0, token); i < lists[0]->size; i++) {
+        collector_metric* m = lists[0]->metrics[i];
+        for(j = 1; j < num_lists; j++) {
+            pos[j] = posting_lower_bound(lists[j], pos[j], m->serial);
+            if(pos[j] == lists[j]->size)
+                goto finish;
+            if(lists[j]->metrics[pos[j]] != m)
+                break;
+        }
+        if(j == num_lists)
+            result[n++] = m;
+    }
+
+finish:
+    free(pos);
+    free(lists);
+    if(n == 0) {
+        free(result);
+        return COLLECTOR_SUCCESS;
+    }
+    *metrics = result;
+    *count = n;
+    return COLLECTOR_SUCCESS;
+}
@@ -0,0 +1,71 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __INDEX_H
+#define __INDEX_H
+
+#include "uthash.h"
+#include "types.h"
+
+/**
+ * @brief List of the metrics having a given namespace, name or label,
+ * sorted by serial. Metrics are created with increasing serials, so
+ * they are appended at the end of the list.
+ */
+typedef struct collector_posting {
+    uint32_t           key; /* id of the interned string */
+    size_t             size;
+    size_t             capacity;
+    collector_metric** metrics;
+    UT_hash_handle     hh;
+} collector_posting;
+
+/**
+ * @brief Inverted index of the metrics of a provider, from each
+ * namespace, name and label to the metrics that have it. It resolves
+ * the selectors of listings, batch fetches and queries.
+ */
+typedef struct collector_index {
+    collector_posting* by_ns;
+    collector_posting* by_name;
+    collector_posting* by_label;
+} collector_index;
+
+/**
+ * @brief Selects the metrics that have all the specified attributes
+ * (NULL or empty namespace and name match any).
+ */
+typedef struct collector_selector {
+    const char*  ns;
+    const char*  name;
+    size_t       num_tags;
+    char* const* tags;
+} collector_selector;
+
+/**
+ * @brief Adds a metric to the index. Its serial must be greater than
+ * that of the metrics already indexed.
+ */
+collector_return_t collector_index_add(collector_index* index, collector_metric* metric);
+
+void collector_index_remove(collector_index* index, const collector_metric* metric);
+
+void collector_index_finalize(collector_index* index);
+
+/**
+ * @brief Returns 1 if a selector has no criterion, i.e. selects all metrics.
+ */
+int collector_selector_empty(const collector_selector* sel);
+
+/**
+ * @brief Returns the metrics with serial >= token matching a selector,
+ * sorted by serial, by intersecting the posting lists of its criteria:
+ * the cost is proportional to the size of the shortest one.
+ *
+ * @param[out] metrics array to free, or NULL if count is 0
+ */
+collector_return_t collector_index_select(const collector_index* index, const collector_intern* strings, const collector_selector* sel, uint64_t token, collector_metric*** metrics, size_t* count);
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+static collector_istring* intern_find(const collector_intern* table, const char* str)
+{
+    collector_istring* s = NULL;
+    HASH_FIND_STR(table->strings, str, s);
+    return s;
+}
+
+static void intern_free(collector_intern* table, collector_istring* s)
+{
+    HASH_DEL(table->strings, s);
+    table->by_id[s->id] = NULL;
+    table->free_ids[table->num_free++] = s->id;
+    if(s->key != s->id)
+        collector_intern_release(table, s->key);
+    free(s->str);
+    free(s);
+}
+
+static collector_istring* intern_add(collector_intern* table, const char* str)
+{
+    collector_istring* s = intern_find(table, str);
+    const char* eq;
+    uint32_t id;
+
+    if(s) {
+        s->refcount += 1;
+        return s;
+    }
+
+    /* id 0 is never used, the free list has room for every id */
+    if(table->next_id == 0)
+        table->next_id = 1;
+    if(!table->num_free && table->next_id >= table->capacity) {
+        uint32_t capacity = table->capacity ? 2*table->capacity : 64;
+        collector_istring** by_id = (collector_istring**)realloc(table->by_id, capacity*sizeof(*by_id));
+        if(!by_id)
+            return NULL;
+        table->by_id = by_id;
+        uint32_t* free_ids = (uint32_t*)realloc(table->free_ids, capacity*sizeof(*free_ids));
+        if(!free_ids)
+            return NULL;
+        table->free_ids = free_ids;
+        table->capacity = capacity;
+    }
+
+    s = (collector_istring*)calloc(1, sizeof(*s));
+    if(!s)
+        return NULL;
+    s->str = strdup(str);
+    if(!s->str) {
+        free(s);
+        return NULL;
+    }
+    if(table->num_free)
+        id = table->free_ids[--table->num_free];
+    else
+        id = table->next_id++;
+    s->id = id;
+    s->key = id;
+    s->refcount = 1;
+    table->by_id[id] = s;
+    HASH_ADD_KEYPTR(hh, table->strings, s->str, strlen(s->str), s);
+
+    /* the key of a label "key=value" is interned too */
+    eq = strchr(str, '=');
+    if(eq && eq != str) {
+        char* key = strndup(str, eq - str);
+        collector_istring* k = key ? intern_add(table, key) : NULL;
+        free(key);
+        if(!k) {
+            intern_free(table, s);
+            return NULL;
+        }
+        s->key = k->id;
+    }
+    return s;
+}
+
+collector_return_t collector_intern_add(collector_intern* table, const char* str, uint32_t* id)
+{
+    collector_istring* s = intern_add(table, str);
+    if(!s)
+        return COLLECTOR_ERR_ALLOCATION;
+    *id = s->id;
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_intern_release(collector_intern* table, uint32_t id)
+{
+    collector_istring* s;
+
+    if(id == 0)
+        return;
+    s = table->by_id[id];
+    if(--s->refcount == 0)
+        intern_free(table, s);
+}
+
+uint32_t collector_intern_find(const collector_intern* table, const char* str)
+{
+    collector_istring* s = intern_find(table, str);
+    return s ? s->id : 0;
+}
+
+static int compare_ids(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+collector_return_t collector_labelset_get(collector_intern* table, uint32_t* labels, uint32_t num_labels, const collector_labelset** set)
+{
+    collector_labelset* s = NULL;
+    size_t size = num_labels*sizeof(uint32_t);
+    uint32_t i;
+
+    qsort(labels, num_labels, sizeof(uint32_t), compare_ids);
+    HASH_FIND(hh, table->labelsets, labels, size, s);
+    if(s) {
+        /* the set already holds references to its labels */
+        for(i = 0; i < num_labels; i++)
+            collector_intern_release(table, labels[i]);
+        s->refcount += 1;
+        *set = s;
+        return COLLECTOR_SUCCESS;
+    }
+
+    s = (collector_labelset*)calloc(1, sizeof(*s) + size);
+    if(!s)
+        return COLLECTOR_ERR_ALLOCATION;
+    s->refcount = 1;
+    s->num_labels = num_labels;
+    memcpy(s->labels, labels, size);
+    HASH_ADD(hh, table->labelsets, labels, size, s);
+    *set = s;
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_labelset_put(collector_intern* table, const collector_labelset* set)
+{
+    collector_labelset* s = (collector_labelset*)set;
+    uint32_t i;
+
+    if(!s || --s->refcount)
+        return;
+    HASH_DEL(table->labelsets, s);
+    for(i = 0; i < s->num_labels; i++)
+        collector_intern_release(table, s->labels[i]);
+    free(s);
+}
+
+uint32_t collector_labelset_find_key(const collector_intern* table, const collector_labelset* set, uint32_t key)
+{
+    uint32_t i;
+    for(i = 0; i < set->num_labels; i++) {
+        if(collector_intern_key(table, set->labels[i]) == key)
+            return set->labels[i];
+    }
+    return 0;
+}
+
+void collector_intern_finalize(collector_intern* table)
+{
+    collector_labelset *l, *ltmp;
+    collector_istring *s, *tmp;
+
+    HASH_ITER(hh, table->labelsets, l, ltmp) {
+        HASH_DEL(table->labelsets, l);
+        free(l);
+    }
+    HASH_ITER(hh, table->strings, s, tmp) {
+        HASH_DEL(table->strings, s);
+        free(s->str);
+        free(s);
+    }
+    free(table->by_id);
+    free(table->free_ids);
+    memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,104 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __INTERN_H
+#define __INTERN_H
+
+#include <stddef.h>
+#include "uthash.h"
+#include "collector/collector-common.h"
+
+/**
+ * @brief Reference-counted string of an interning table, identified by
+ * a compact id (never 0). A label "key=value" also references its key,
+ * so that labels can be grouped by key; the key of any other string is
+ * the string itself.
+ */
+typedef struct collector_istring {
+    char*          str;
+    uint32_t       id;
+    uint32_t       key;
+    size_t         refcount;
+    UT_hash_handle hh;
+} collector_istring;
+
+/**
+ * @brief Reference-counted, sorted set of label ids. Metrics with the
+ * same labels share a single label set.
+ */
+typedef struct collector_labelset {
+    size_t         refcount;
+    UT_hash_handle hh;
+    uint32_t       num_labels;
+    uint32_t       labels[];
+} collector_labelset;
+
+/**
+ * @brief Table holding a single copy of each namespace, name and label of
+ * the metrics of a provider, and of each set of labels. Interned strings
+ * are equal if and only if their ids are, and label sets if and only if
+ * their pointers are, so the identity of two metrics is compared without
+ * comparing strings.
+ */
+typedef struct collector_intern {
+    collector_istring*  strings;
+    collector_istring** by_id;     /* by_id[id] is the string with that id */
+    uint32_t            capacity;  /* size of by_id */
+    uint32_t            next_id;   /* lowest id never used */
+    uint32_t*           free_ids;  /* ids of released strings, reused first */
+    uint32_t            num_free;
+    collector_labelset* labelsets;
+} collector_intern;
+
+/**
+ * @brief Sets *id to the id of the interned copy of str, taking a reference.
+ */
+collector_return_t collector_intern_add(collector_intern* table, const char* str, uint32_t* id);
+
+/**
+ * @brief Releases a reference to the string with the given id (0 is ignored).
+ */
+void collector_intern_release(collector_intern* table, uint32_t id);
+
+/**
+ * @brief Returns the id of an interned string, or 0 if str isn't interned.
+ */
+uint32_t collector_intern_find(const collector_intern* table, const char* str);
+
+static inline const char* collector_intern_str(const collector_intern* table, uint32_t id)
+{
+    return table->by_id[id]->str;
+}
+
+/**
+ * @brief Returns the id of the key of a label.
+ */
+static inline uint32_t collector_intern_key(const collector_intern* table, uint32_t id)
+{
+    return table->by_id[id]->key;
+}
+
+/**
+ * @brief Returns the interned set of the given labels, taking a reference
+ * to it. The references to the labels are transferred to the set.
+ *
+ * @param labels label ids, sorted in place. On error, the caller keeps
+ * its references to them.
+ */
+collector_return_t collector_labelset_get(collector_intern* table, uint32_t* labels, uint32_t num_labels, const collector_labelset** set);
+
+/**
+ * @brief Releases a reference to a label set (NULL is ignored).
+ */
+void collector_labelset_put(collector_intern* table, const collector_labelset* set);
+
+/**
+ * @brief Returns the id of the label of a set with the given key, or 0.
+ */
+uint32_t collector_labelset_find_key(const collector_intern* table, const collector_labelset* set, uint32_t key);
+
+void collector_intern_finalize(collector_intern* table);
+
+#endif
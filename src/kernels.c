@@ -0,0 +1,409 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define COLLECTOR_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Clamps t to [0, max], NaN giving 0 like the vector max instructions */
+static inline double clamp_index(double t, double max)
+{
+    t = t > 0 ? t : 0;
+    return t < max ? t : max;
+}
+
+/* Portable variants, also used for the tails of the vector variants */
+
+static void scalar_min_max_sum(const double* v, size_t n, double* min, double* max, double* sum)
+{
+    double lo = v[0], hi = v[0], s = 0;
+    size_t i;
+    for(i = 0; i < n; i++) {
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+        s += v[i];
+    }
+    *min = lo;
+    *max = hi;
+    *sum = s;
+}
+
+static double scalar_sum_sq_dev(const double* v, size_t n, double mean)
+{
+    double s = 0;
+    size_t i;
+    for(i = 0; i < n; i++)
+        s += (v[i] - mean)*(v[i] - mean);
+    return s;
+}
+
+static uint64_t scalar_count_above(const double* v, size_t n, double threshold)
+{
+    uint64_t c = 0;
+    size_t i;
+    for(i = 0; i < n; i++)
+        c += v[i] > threshold;
+    return c;
+}
+
+static void scalar_bucket(const double* v, size_t n, double min, double range, size_t num_buckets, uint64_t* counts)
+{
+    double last = (double)(num_buckets - 1);
+    size_t i;
+    for(i = 0; i < n; i++)
+        counts[(size_t)clamp_index((v[i] - min)/range*num_buckets, last)] += 1;
+}
+
+static const collector_kernels scalar_kernels = {
+    "scalar",
+    scalar_min_max_sum,
+    scalar_sum_sq_dev,
+    scalar_count_above,
+    scalar_bucket
+};
+
+#ifdef COLLECTOR_KERNELS_X86
+
+/* Folds the partial results of the vector lanes and of the scalar tail */
+static void fold_min_max_sum(const double* lo, const double* hi, const double* s, size_t lanes,
+                             const double* tail, size_t n_tail, double* min, double* max, double* sum)
+{
+    double t_lo, t_hi, t_sum;
+    size_t i;
+
+    *min = lo[0];
+    *max = hi[0];
+    *sum = 0;
+    for(i = 0; i < lanes; i++) {
+        *min = lo[i] < *min ? lo[i] : *min;
+        *max = hi[i] > *max ? hi[i] : *max;
+        *sum += s[i];
+    }
+    if(n_tail) {
+        scalar_min_max_sum(tail, n_tail, &t_lo, &t_hi, &t_sum);
+        *min = t_lo < *min ? t_lo : *min;
+        *max = t_hi > *max ? t_hi : *max;
+        *sum += t_sum;
+    }
+}
+
+/* SSE2: part of the x86-64 baseline, no target attribute needed */
+
+static void sse2_min_max_sum(const double* v, size_t n, double* min, double* max, double* sum)
+{
+    __m128d lo = _mm_set1_pd(v[0]), hi = lo;
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    double l[2], h[2], s[2];
+    size_t i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        __m128d a = _mm_loadu_pd(v + i);
+        __m128d b = _mm_loadu_pd(v + i + 2);
+        lo = _mm_min_pd(b, _mm_min_pd(a, lo));
+        hi = _mm_max_pd(b, _mm_max_pd(a, hi));
+        s0 = _mm_add_pd(s0, a);
+        s1 = _mm_add_pd(s1, b);
+    }
+    _mm_storeu_pd(l, lo);
+    _mm_storeu_pd(h, hi);
+    _mm_storeu_pd(s, _mm_add_pd(s0, s1));
+    fold_min_max_sum(l, h, s, 2, v + i, n - i, min, max, sum);
+}
+
+static double sse2_sum_sq_dev(const double* v, size_t n, double mean)
+{
+    __m128d m = _mm_set1_pd(mean), s = _mm_setzero_pd();
+    double r[2];
+    size_t i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        __m128d d = _mm_sub_pd(_mm_loadu_pd(v + i), m);
+        s = _mm_add_pd(s, _mm_mul_pd(d, d));
+    }
+    _mm_storeu_pd(r, s);
+    return r[0] + r[1] + scalar_sum_sq_dev(v + i, n - i, mean);
+}
+
+static uint64_t sse2_count_above(const double* v, size_t n, double threshold)
+{
+    __m128d t = _mm_set1_pd(threshold);
+    uint64_t c = 0;
+    size_t i;
+
+    for(i = 0; i + 2 <= n; i += 2)
+        c += __builtin_popcount(_mm_movemask_pd(_mm_cmpgt_pd(_mm_loadu_pd(v + i), t)));
+    return c + scalar_count_above(v + i, n - i, threshold);
+}
+
+static void sse2_bucket(const double* v, size_t n, double min, double range, size_t num_buckets, uint64_t* counts)
+{
+    __m128d lo = _mm_set1_pd(min), r = _mm_set1_pd(range), nb = _mm_set1_pd((double)num_buckets);
+    __m128d zero = _mm_setzero_pd(), last = _mm_set1_pd((double)(num_buckets - 1));
+    int32_t idx[4];
+    size_t i;
+
+    for(i = 0; i + 2 <= n; i += 2) {
+        __m128d t = _mm_mul_pd(_mm_div_pd(_mm_sub_pd(_mm_loadu_pd(v + i), lo), r), nb);
+        t = _mm_min_pd(_mm_max_pd(t, zero), last);
+        _mm_storeu_si128((__m128i*)idx, _mm_cvttpd_epi32(t));
+        counts[idx[0]] += 1;
+        counts[idx[1]] += 1;
+    }
+    scalar_bucket(v + i, n - i, min, range, num_buckets, counts);
+}
+
+static const collector_kernels sse2_kernels = {
+    "sse2",
+    sse2_min_max_sum,
+    sse2_sum_sq_dev,
+    sse2_count_above,
+    sse2_bucket
+};
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static void avx2_min_max_sum(const double* v, size_t n, double* min, double* max, double* sum)
+{
+    __m256d lo = _mm256_set1_pd(v[0]), hi = lo;
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    double l[4], h[4], s[4];
+    size_t i;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        __m256d a = _mm256_loadu_pd(v + i);
+        __m256d b = _mm256_loadu_pd(v + i + 4);
+        lo = _mm256_min_pd(b, _mm256_min_pd(a, lo));
+        hi = _mm256_max_pd(b, _mm256_max_pd(a, hi));
+        s0 = _mm256_add_pd(s0, a);
+        s1 = _mm256_add_pd(s1, b);
+    }
+    _mm256_storeu_pd(l, lo);
+    _mm256_storeu_pd(h, hi);
+    _mm256_storeu_pd(s, _mm256_add_pd(s0, s1));
+    fold_min_max_sum(l, h, s, 4, v + i, n - i, min, max, sum);
+}
+
+__attribute__((target("avx2")))
+static double avx2_sum_sq_dev(const double* v, size_t n, double mean)
+{
+    __m256d m = _mm256_set1_pd(mean), s = _mm256_setzero_pd();
+    double r[4];
+    size_t i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_sub_pd(_mm256_loadu_pd(v + i), m);
+        s = _mm256_add_pd(s, _mm256_mul_pd(d, d));
+    }
+    _mm256_storeu_pd(r, s);
+    return r[0] + r[1] + r[2] + r[3] + scalar_sum_sq_dev(v + i, n - i, mean);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2_count_above(const double* v, size_t n, double threshold)
+{
+    __m256d t = _mm256_set1_pd(threshold);
+    uint64_t c = 0;
+    size_t i;
+
+    for(i = 0; i + 4 <= n; i += 4)
+        c += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(v + i), t, _CMP_GT_OQ)));
+    return c + scalar_count_above(v + i, n - i, threshold);
+}
+
+__attribute__((target("avx2")))
+static void avx2_bucket(const double* v, size_t n, double min, double range, size_t num_buckets, uint64_t* counts)
+{
+    __m256d lo = _mm256_set1_pd(min), r = _mm256_set1_pd(range), nb = _mm256_set1_pd((double)num_buckets);
+    __m256d zero = _mm256_setzero_pd(), last = _mm256_set1_pd((double)(num_buckets - 1));
+    int32_t idx[4];
+    size_t i;
+
+    for(i = 0; i + 4 <= n; i += 4) {
+        __m256d t = _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(v + i), lo), r), nb);
+        t = _mm256_min_pd(_mm256_max_pd(t, zero), last);
+        _mm_storeu_si128((__m128i*)idx, _mm256_cvttpd_epi32(t));
+        counts[idx[0]] += 1;
+        counts[idx[1]] += 1;
+        counts[idx[2]] += 1;
+        counts[idx[3]] += 1;
+    }
+    scalar_bucket(v + i, n - i, min, range, num_buckets, counts);
+}
+
+static const collector_kernels avx2_kernels = {
+    "avx2",
+    avx2_min_max_sum,
+    avx2_sum_sq_dev,
+    avx2_count_above,
+    avx2_bucket
+};
+
+/* AVX-512 (foundation instructions only) */
+
+__attribute__((target("avx512f")))
+static void avx512_min_max_sum(const double* v, size_t n, double* min, double* max, double* sum)
+{
+    __m512d lo = _mm512_set1_pd(v[0]), hi = lo;
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    double l[8], h[8], s[8];
+    size_t i;
+
+    for(i = 0; i + 16 <= n; i += 16) {
+        __m512d a = _mm512_loadu_pd(v + i);
+        __m512d b = _mm512_loadu_pd(v + i + 8);
+        lo = _mm512_min_pd(b, _mm512_min_pd(a, lo));
+        hi = _mm512_max_pd(b, _mm512_max_pd(a, hi));
+        s0 = _mm512_add_pd(s0, a);
+        s1 = _mm512_add_pd(s1, b);
+    }
+    _mm512_storeu_pd(l, lo);
+    _mm512_storeu_pd(h, hi);
+    _mm512_storeu_pd(s, _mm512_add_pd(s0, s1));
+    fold_min_max_sum(l, h, s, 8, v + i, n - i, min, max, sum);
+}
+
+__attribute__((target("avx512f")))
+static double avx512_sum_sq_dev(const double* v, size_t n, double mean)
+{
+    __m512d m = _mm512_set1_pd(mean), s = _mm512_setzero_pd();
+    double r[8], total = 0;
+    size_t i, j;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        __m512d d = _mm512_sub_pd(_mm512_loadu_pd(v + i), m);
+        s = _mm512_add_pd(s, _mm512_mul_pd(d, d));
+    }
+    _mm512_storeu_pd(r, s);
+    for(j = 0; j < 8; j++)
+        total += r[j];
+    return total + scalar_sum_sq_dev(v + i, n - i, mean);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t avx512_count_above(const double* v, size_t n, double threshold)
+{
+    __m512d t = _mm512_set1_pd(threshold);
+    uint64_t c = 0;
+    size_t i;
+
+    for(i = 0; i + 8 <= n; i += 8)
+        c += __builtin_popcount(_mm512_cmp_pd_mask(_mm512_loadu_pd(v + i), t, _CMP_GT_OQ));
+    return c + scalar_count_above(v + i, n - i, threshold);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_bucket(const double* v, size_t n, double min, double range, size_t num_buckets, uint64_t* counts)
+{
+    __m512d lo = _mm512_set1_pd(min), r = _mm512_set1_pd(range), nb = _mm512_set1_pd((double)num_buckets);
+    __m512d zero = _mm512_setzero_pd(), last = _mm512_set1_pd((double)(num_buckets - 1));
+    int32_t idx[8];
+    size_t i, j;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        __m512d t = _mm512_mul_pd(_mm512_div_pd(_mm512_sub_pd(_mm512_loadu_pd(v + i), lo), r), nb);
+        t = _mm512_min_pd(_mm512_max_pd(t, zero), last);
+        _mm256_storeu_si256((__m256i*)idx, _mm512_cvttpd_epi32(t));
+        for(j = 0; j < 8; j++)
+            counts[idx[j]] += 1;
+    }
+    scalar_bucket(v + i, n - i, min, range, num_buckets, counts);
+}
+
+static const collector_kernels avx512_kernels = {
+    "avx512",
+    avx512_min_max_sum,
+    avx512_sum_sq_dev,
+    avx512_count_above,
+    avx512_bucket
+};
+
+#endif /* COLLECTOR_KERNELS_X86 */
+
+/* Returns the best supported kernels, at most those named cap (if not NULL) */
+static const collector_kernels* kernels_select(const char* cap)
+{
+#ifdef COLLECTOR_KERNELS_X86
+    /* best first */
+    const collector_kernels* variants[] = { &avx512_kernels, &avx2_kernels, &sse2_kernels };
+    int supported[] = { 0, 0, 1 };
+    size_t num_variants = sizeof(variants)/sizeof(variants[0]);
+    size_t i, first = 0;
+
+    __builtin_cpu_init();
+    supported[0] = __builtin_cpu_supports("avx512f");
+    supported[1] = __builtin_cpu_supports("avx2");
+
+    /* an unknown name doesn't cap anything */
+    if(cap && strcmp(cap, scalar_kernels.name) == 0)
+        return &scalar_kernels;
+    for(i = 0; cap && i < num_variants; i++) {
+        if(strcmp(cap, variants[i]->name) == 0)
+            first = i;
+    }
+    for(i = first; i < num_variants; i++) {
+        if(supported[i])
+            return variants[i];
+    }
+#else
+    (void)cap;
+#endif
+    return &scalar_kernels;
+}
+
+const collector_kernels* collector_kernels_get(void)
+{
+    static const collector_kernels* selected = NULL;
+    const collector_kernels* k = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+
+    /* concurrent first calls select the same kernels */
+    if(!k) {
+        k = kernels_select(getenv("COLLECTOR_KERNELS"));
+        __atomic_store_n(&selected, k, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+void collector_stats_add(const collector_kernels* k, collector_stats_acc* acc, const double* v, size_t n, double threshold)
+{
+    collector_stats_acc b;
+
+    if(n == 0)
+        return;
+    b.count = n;
+    k->min_max_sum(v, n, &b.min, &b.max, &b.sum);
+    b.mean = b.sum / n;
+    /* the block is still in cache for the second pass */
+    b.m2 = k->sum_sq_dev(v, n, b.mean);
+    b.num_above = k->count_above(v, n, threshold);
+    collector_stats_merge(acc, &b);
+}
+
+void collector_stats_merge(collector_stats_acc* a, const collector_stats_acc* b)
+{
+    double n, delta;
+
+    if(b->count == 0)
+        return;
+    if(a->count == 0) {
+        *a = *b;
+        return;
+    }
+    /* pairwise update of the mean and squared deviations (Chan et al.) */
+    n     = (double)a->count + (double)b->count;
+    delta = b->mean - a->mean;
+    a->mean += delta*(double)b->count/n;
+    a->m2   += b->m2 + delta*delta*(double)a->count*(double)b->count/n;
+    a->min   = b->min < a->min ? b->min : a->min;
+    a->max   = b->max > a->max ? b->max : a->max;
+    a->sum  += b->sum;
+    a->count     += b->count;
+    a->num_above += b->num_above;
+}
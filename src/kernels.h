@@ -0,0 +1,65 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __KERNELS_H
+#define __KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Reduction kernels over contiguous arrays of values, in one
+ * variant per instruction set. The variant used is selected at run time
+ * by collector_kernels_get. Sums may differ between variants in their
+ * last bits, as the values are added in a different order.
+ */
+typedef struct collector_kernels {
+    const char* name;
+    /* sets *min, *max and *sum to the minimum, maximum and sum of n > 0 values */
+    void     (*min_max_sum)(const double* v, size_t n, double* min, double* max, double* sum);
+    /* returns the sum of the squared deviations of n values from mean */
+    double   (*sum_sq_dev)(const double* v, size_t n, double mean);
+    /* returns the number of values greater than threshold */
+    uint64_t (*count_above)(const double* v, size_t n, double threshold);
+    /* adds each value to counts[(size_t)((v - min)/range*num_buckets)], clamped
+     * to [0, num_buckets-1]; num_buckets must be less than 2^31 */
+    void     (*bucket)(const double* v, size_t n, double min, double range, size_t num_buckets, uint64_t* counts);
+} collector_kernels;
+
+/**
+ * @brief Returns the kernels for the best instruction set supported by
+ * the CPU (AVX-512, AVX2, SSE2 or portable C). The COLLECTOR_KERNELS
+ * environment variable ("avx512", "avx2", "sse2" or "scalar") caps the
+ * instruction set, e.g. to compare the variants.
+ */
+const collector_kernels* collector_kernels_get(void);
+
+/**
+ * @brief Running statistics of a set of values, merged block by block.
+ */
+typedef struct collector_stats_acc {
+    uint64_t count;
+    uint64_t num_above; /* values greater than the threshold */
+    double   min;
+    double   max;
+    double   sum;
+    double   mean;
+    double   m2;        /* sum of the squared deviations from the mean */
+} collector_stats_acc;
+
+#define COLLECTOR_STATS_ACC_INIT { 0, 0, 0, 0, 0, 0, 0 }
+
+/**
+ * @brief Adds n values (a block that fits in cache: it is read twice)
+ * to an accumulator.
+ */
+void collector_stats_add(const collector_kernels* k, collector_stats_acc* acc, const double* v, size_t n, double threshold);
+
+/**
+ * @brief Adds the values of accumulator b to accumulator a.
+ */
+void collector_stats_merge(collector_stats_acc* a, const collector_stats_acc* b);
+
+#endif
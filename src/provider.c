@@ -4,6 +4,7 @@
  * See COPYRIGHT in top-level directory.
  */
 #include <assert.h>
+#include <inttypes.h>
 #include "collector/collector-server.h"
 #include "collector/collector-common.h"
 #include "collector/collector-backend.h"
@@ -13,6 +14,7 @@
 #endif
 #include "provider.h"
 #include "types.h"
+#include "encoding.h"
 
 static void collector_finalize_provider(void* p);
 
@@ -33,13 +35,52 @@ static inline collector_return_t remove_metric(
 static inline void remove_all_metrics(
         collector_provider_t provider);
 
+static inline void free_metric(
+        collector_provider_t provider,
+        collector_metric* metric);
+
+/* Functions to manage the sampler of sampled metrics */
+
+static void collector_sampler_ult(void* arg);
+
+static inline void sampler_add_metric(
+        collector_provider_t provider,
+        collector_metric* metric);
+
+static inline void sampler_remove_metric(
+        collector_provider_t provider,
+        collector_metric* metric);
+
+static inline void sampler_stop(
+        collector_provider_t provider);
+
 /* Admin RPCs */
 
 /* Client RPCs */
 static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_ult)
 static void collector_metric_fetch_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_range_ult)
+static void collector_metric_fetch_range_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_downsampled_ult)
+static void collector_metric_fetch_downsampled_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_columns_ult)
+static void collector_metric_fetch_columns_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_since_ult)
+static void collector_metric_fetch_since_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_batch_ult)
+static void collector_metric_fetch_batch_ult(hg_handle_t h);
 static DECLARE_MARGO_RPC_HANDLER(collector_list_metrics_ult)
 static void collector_list_metrics_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_list_metrics_ext_ult)
+static void collector_list_metrics_ext_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_stats_ult)
+static void collector_metric_fetch_stats_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_query_ult)
+static void collector_query_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_histogram_ult)
+static void collector_metric_fetch_histogram_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(collector_metric_fetch_sketch_ult)
+static void collector_metric_fetch_sketch_ult(hg_handle_t h);
 
 /* add other RPC declarations here */
 
@@ -80,6 +121,20 @@ int collector_provider_register(
     p->pool = a.pool;
     p->abtio = a.abtio;
 
+    if(collector_chunk_pool_init(&p->chunk_pool, mid) != COLLECTOR_SUCCESS) {
+        margo_error(mid, "Could not create chunk pool");
+        free(p);
+        return COLLECTOR_ERR_FROM_ARGOBOTS;
+    }
+    if(collector_slab_init(&p->metric_slab, sizeof(collector_metric), COLLECTOR_METRIC_SLAB_SIZE) != COLLECTOR_SUCCESS) {
+        margo_error(mid, "Could not create metric slab");
+        collector_chunk_pool_finalize(&p->chunk_pool);
+        free(p);
+        return COLLECTOR_ERR_FROM_ARGOBOTS;
+    }
+    ABT_mutex_create(&p->sampler_mutex);
+    p->sampler = ABT_THREAD_NULL;
+
     /* Admin RPCs */
 
     /* Client RPCs */
@@ -89,11 +144,71 @@ int collector_provider_register(
     margo_register_data(mid, id, (void*)p, NULL);
     p->metric_fetch_id = id;
 
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_range",
+            metric_fetch_range_in_t, metric_fetch_range_out_t,
+            collector_metric_fetch_range_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_range_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_downsampled",
+            metric_fetch_downsampled_in_t, metric_fetch_downsampled_out_t,
+            collector_metric_fetch_downsampled_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_downsampled_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_columns",
+            metric_fetch_columns_in_t, metric_fetch_columns_out_t,
+            collector_metric_fetch_columns_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_columns_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_since",
+            metric_fetch_since_in_t, metric_fetch_since_out_t,
+            collector_metric_fetch_since_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_since_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_batch",
+            metric_fetch_batch_in_t, metric_fetch_batch_out_t,
+            collector_metric_fetch_batch_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_batch_id = id;
+
     id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_list_metrics",
             list_metrics_in_t, list_metrics_out_t,
             collector_list_metrics_ult, provider_id, p->pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->list_metrics_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_list_metrics_ext",
+            list_metrics_ext_in_t, list_metrics_ext_out_t,
+            collector_list_metrics_ext_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->list_metrics_ext_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_stats",
+            metric_fetch_stats_in_t, metric_fetch_stats_out_t,
+            collector_metric_fetch_stats_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_stats_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_query",
+            query_in_t, query_out_t,
+            collector_query_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->query_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_histogram",
+            metric_fetch_histogram_in_t, metric_fetch_histogram_out_t,
+            collector_metric_fetch_histogram_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_histogram_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "collector_remote_metric_fetch_sketch",
+            metric_fetch_sketch_in_t, metric_fetch_sketch_out_t,
+            collector_metric_fetch_sketch_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_sketch_id = id;
     p->use_aggregator = 0;
 
     /* add other RPC registration here */
@@ -143,16 +258,32 @@ int collector_provider_register(
 static void collector_finalize_provider(void* p)
 {
     collector_provider_t provider = (collector_provider_t)p;
-    margo_info(provider->mid, "Finalizing COLLECTOR provider");
-    margo_deregister(provider->mid, provider->metric_fetch_id);
-    margo_deregister(provider->mid, provider->list_metrics_id);
+    margo_instance_id mid = provider->mid;
+    margo_info(mid, "Finalizing COLLECTOR provider");
+    margo_deregister(mid, provider->metric_fetch_id);
+    margo_deregister(mid, provider->metric_fetch_range_id);
+    margo_deregister(mid, provider->metric_fetch_downsampled_id);
+    margo_deregister(mid, provider->metric_fetch_columns_id);
+    margo_deregister(mid, provider->metric_fetch_since_id);
+    margo_deregister(mid, provider->metric_fetch_batch_id);
+    margo_deregister(mid, provider->list_metrics_id);
+    margo_deregister(mid, provider->list_metrics_ext_id);
+    margo_deregister(mid, provider->metric_fetch_stats_id);
+    margo_deregister(mid, provider->query_id);
+    margo_deregister(mid, provider->metric_fetch_histogram_id);
+    margo_deregister(mid, provider->metric_fetch_sketch_id);
     /* deregister other RPC ids ... */
+    sampler_stop(provider);
     remove_all_metrics(provider);
+    collector_intern_finalize(&provider->strings);
+    collector_chunk_pool_finalize(&provider->chunk_pool);
+    collector_slab_finalize(&provider->metric_slab);
+    ABT_mutex_free(&provider->sampler_mutex);
 #ifdef USE_AGGREGATOR
     //DEREGISTER_AGGREGATOR_CLIENT_AND_PROVIDER_HANDLES();
 #endif
     free(provider);
-    margo_info(provider->mid, "COLLECTOR provider successfuly finalized");
+    margo_info(mid, "COLLECTOR provider successfuly finalized");
 }
 
 int collector_provider_destroy(
@@ -168,30 +299,150 @@ int collector_provider_destroy(
     return COLLECTOR_SUCCESS;
 }
 
-collector_return_t collector_provider_metric_create(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t tl, collector_metric_t* m, collector_provider_t provider)
+/* Sets the namespace, name and labels of a metric to the ids of interned
+ * copies, the labels being shared with the metrics that have the same */
+static collector_return_t intern_identity(collector_provider_t provider, collector_metric* metric, const char* ns, const char* name, collector_taglist_t tl)
+{
+    collector_return_t ret;
+    uint32_t i, num_labels = tl ? tl->num_tags : 0;
+    uint32_t* labels = NULL;
+
+    metric->cold->strings = &provider->strings;
+    ret = collector_intern_add(&provider->strings, ns, &metric->cold->ns);
+    if(ret == COLLECTOR_SUCCESS)
+        ret = collector_intern_add(&provider->strings, name, &metric->cold->name);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    if(num_labels) {
+        labels = (uint32_t*)calloc(num_labels, sizeof(*labels));
+        if(!labels)
+            return COLLECTOR_ERR_ALLOCATION;
+    }
+    for(i = 0; i < num_labels; i++) {
+        ret = collector_intern_add(&provider->strings, tl->taglist[i], &labels[i]);
+        if(ret != COLLECTOR_SUCCESS)
+            break;
+    }
+    if(ret == COLLECTOR_SUCCESS)
+        ret = collector_labelset_get(&provider->strings, labels, num_labels, &metric->cold->labels);
+    if(ret != COLLECTOR_SUCCESS) {
+        while(i--)
+            collector_intern_release(&provider->strings, labels[i]);
+    }
+    free(labels);
+    return ret;
+}
+
+collector_return_t collector_provider_metric_create(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t tl, const struct collector_metric_args* args, collector_metric_t* m, collector_provider_t provider)
 {
+    struct collector_metric_args a = COLLECTOR_METRIC_ARGS_INIT;
+    if(args) a = *args;
+
     if(!ns || !name)
         return COLLECTOR_ERR_INVALID_NAME;
 
+    /* sealed chunks are neither reused in place nor merged with shards */
+    if(a.compressed && (a.max_samples || a.sharded))
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* only counters and gauges have a value that can be sampled */
+    if(a.sampling_period < 0 || (a.sampling_period > 0 && t != COLLECTOR_TYPE_COUNTER && t != COLLECTOR_TYPE_GAUGE))
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* rollups are fed with the samples that leave the ring of a single store */
+    if(a.num_rollups && (!a.max_samples || a.sharded || t == COLLECTOR_TYPE_HISTOGRAM || t == COLLECTOR_TYPE_SKETCH))
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* histograms only record bucket counts */
+    collector_histogram* histogram = NULL;
+    if(t == COLLECTOR_TYPE_HISTOGRAM) {
+        collector_return_t ret;
+        if(a.bounds)
+            ret = collector_histogram_create_fixed(a.bounds, a.num_bounds, &histogram);
+        else
+            ret = collector_histogram_create_loglinear(a.histogram_min, a.histogram_max,
+                                                       a.histogram_sub_buckets, &histogram);
+        if(ret != COLLECTOR_SUCCESS)
+            return ret;
+    }
+
+    /* sketches only record bin counts */
+    collector_sketch* sketch = NULL;
+    if(t == COLLECTOR_TYPE_SKETCH) {
+        collector_return_t ret = collector_sketch_create_fixed(
+                a.sketch_relative_accuracy > 0 ? a.sketch_relative_accuracy : 0.01,
+                a.sketch_min > 0 ? a.sketch_min : COLLECTOR_SKETCH_MIN_VALUE,
+                a.sketch_max > 0 ? a.sketch_max : COLLECTOR_SKETCH_MAX_VALUE,
+                &sketch);
+        if(ret != COLLECTOR_SUCCESS)
+            return ret;
+    }
+
+    collector_rollup* rollup = NULL;
+    if(a.num_rollups) {
+        collector_return_t ret = collector_rollup_create(a.rollups, a.num_rollups, &rollup);
+        if(ret != COLLECTOR_SUCCESS) {
+            collector_histogram_destroy(histogram);
+            collector_sketch_destroy(sketch);
+            return ret;
+        }
+    }
+
     /* create an id for the new metric */
-    collector_metric_id_t id;
-    collector_id_from_string_identifiers(ns, name, tl->taglist, tl->num_tags, &id);
+    collector_metric_id_t id = collector_metric_id(ns, name, tl ? tl->taglist : NULL, tl ? tl->num_tags : 0);
 
     /* allocate a metric, set it up, and add it to the provider */
-    collector_metric* metric = (collector_metric*)calloc(1, sizeof(*metric));
+    collector_metric* metric = (collector_metric*)collector_slab_alloc(&provider->metric_slab);
+    collector_metric_cold* cold = (collector_metric_cold*)calloc(1, sizeof(*cold));
+    if(!metric || !cold) {
+        collector_slab_free(&provider->metric_slab, metric);
+        free(cold);
+        collector_histogram_destroy(histogram);
+        collector_sketch_destroy(sketch);
+        collector_rollup_destroy(rollup);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    metric->cold = cold;
+    if(collector_store_init(&metric->store, &provider->chunk_pool, a.max_samples, a.columnar, a.compressed) != COLLECTOR_SUCCESS) {
+        collector_histogram_destroy(histogram);
+        collector_sketch_destroy(sketch);
+        collector_rollup_destroy(rollup);
+        free(cold);
+        collector_slab_free(&provider->metric_slab, metric);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    metric->histogram = histogram;
+    metric->sketch = sketch;
+    metric->rollup = rollup;
+    if(a.sharded) {
+        /* shards are created by the execution streams that update the metric */
+        metric->shards = (collector_sample_store**)calloc(COLLECTOR_MAX_SHARDS, sizeof(*metric->shards));
+        if(!metric->shards) {
+            collector_store_destroy(&metric->store);
+            collector_histogram_destroy(histogram);
+            collector_sketch_destroy(sketch);
+            collector_rollup_destroy(rollup);
+            free(cold);
+            collector_slab_free(&provider->metric_slab, metric);
+            return COLLECTOR_ERR_ALLOCATION;
+        }
+    }
     ABT_mutex_create(&metric->metric_mutex);
     metric->id  = id;
-    strcpy(metric->name, name);
-    strcpy(metric->ns, ns);
-    strcpy(metric->desc, desc);
+    strncpy(metric->cold->desc, desc ? desc : "", sizeof(metric->cold->desc) - 1);
     metric->type = t;
-    metric->taglist = tl;
-    metric->buffer_index = 0;
-    metric->buffer = (collector_metric_buffer)calloc(METRIC_BUFFER_SIZE, sizeof(collector_metric_sample));
-    add_metric(provider, metric);
+    metric->sampling_period = a.sampling_period;
+    collector_return_t ret = intern_identity(provider, metric, ns, name, tl);
+    if(ret == COLLECTOR_SUCCESS)
+        ret = add_metric(provider, metric);
+    if(ret != COLLECTOR_SUCCESS) {
+        free_metric(provider, metric);
+        return ret;
+    }
+    if(metric->sampling_period > 0)
+        sampler_add_metric(provider, metric);
 
-    fprintf(stderr, "\nCreated metric %d of type %d\n", id, metric->type);
-    fprintf(stderr, "Num metrics is: %lu\n", provider->num_metrics);
+    margo_debug(provider->mid, "Created metric %s:%s (id %" PRIu64 ", type %d)", ns, name, id, metric->type);
 
 #ifdef USE_AGGREGATOR
     //aggregator_stream_id stream_id = aggregator_stream_create(string name, ...); //va_arg string list
@@ -202,12 +453,120 @@ collector_return_t collector_provider_metric_create(const char *ns, const char *
     return COLLECTOR_SUCCESS;
 }
 
+/* Copies the latest (at most n) samples of a metric into dst and sets
+ * *count to how many were copied, along with the sequence numbers of the
+ * first one and of the next sample to be recorded */
+static collector_return_t copy_latest_samples(collector_metric* metric, uint64_t n, collector_metric_sample* dst, uint64_t* count, uint64_t* first_seq, uint64_t* next_seq)
+{
+    collector_return_t ret;
+
+    if(metric->shards) {
+        /* sequence numbers of a sharded metric count the samples of all its shards */
+        collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+        size_t i, num_stores = collector_metric_stores(metric, stores);
+        *next_seq = 0;
+        for(i = 0; i < num_stores; i++)
+            *next_seq += collector_store_size(stores[i]);
+        ret = collector_store_merge_latest(stores, num_stores, n, dst, count);
+        if(ret != COLLECTOR_SUCCESS)
+            return ret;
+        *first_seq = *next_seq - *count;
+    } else {
+        *count = collector_store_copy_latest(&metric->store, n, dst, first_seq);
+        *next_seq = *first_seq + *count;
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+/* Number of samples currently retained by a metric */
+static uint64_t retained_samples(const collector_metric* metric)
+{
+    collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+    size_t i, num_stores = collector_metric_stores(metric, stores);
+    uint64_t count, total = 0;
+
+    for(i = 0; i < num_stores; i++) {
+        count = collector_store_size(stores[i]);
+        total += count - collector_store_first(stores[i], count);
+    }
+    return total;
+}
+
+/* Sets *selected (to free) to the metrics matching a selector, sorted by
+ * serial, or to all the metrics if the selector is empty */
+static collector_return_t select_metrics(collector_provider_t provider, const collector_selector* sel, collector_metric*** selected, size_t* num_selected)
+{
+    collector_metric *r, *tmp;
+    size_t count;
+
+    if(!collector_selector_empty(sel))
+        return collector_index_select(&provider->index, &provider->strings, sel, 0, selected, num_selected);
+    count = HASH_COUNT(provider->metrics);
+    *num_selected = 0;
+    *selected = (collector_metric**)malloc((count ? count : 1)*sizeof(**selected));
+    if(!*selected)
+        return COLLECTOR_ERR_ALLOCATION;
+    HASH_ITER(hh, provider->metrics, r, tmp)
+        (*selected)[(*num_selected)++] = r;
+    return COLLECTOR_SUCCESS;
+}
+
+/* Pushes samples [first, last) of a store to a client's bulk region
+ * straight from the store's chunks, with one transfer per chunk */
+static hg_return_t push_samples(margo_instance_id mid, hg_addr_t addr, hg_bulk_t remote_bulk, collector_sample_store* store, uint64_t first, uint64_t last)
+{
+    size_t num_reqs = 0, i;
+    size_t offset = 0;
+    uint64_t j, len;
+    hg_return_t hret = HG_SUCCESS, wret;
+    margo_request* reqs = (margo_request*)calloc((last - first) / COLLECTOR_CHUNK_SAMPLES + 2, sizeof(*reqs));
+
+    if(!reqs)
+        return HG_NOMEM;
+
+    for(j = first; j < last; j += len) {
+        len = COLLECTOR_CHUNK_SAMPLES - (j % COLLECTOR_CHUNK_SAMPLES);
+        if(len > last - j) len = last - j;
+        hg_bulk_t bulk = collector_chunk_bulk(store->pool, collector_store_chunk(store, j));
+        if(bulk == HG_BULK_NULL) {
+            hret = HG_NOMEM;
+            break;
+        }
+        hret = margo_bulk_itransfer(mid, HG_BULK_PUSH, addr, remote_bulk, offset,
+                                    bulk, (j % COLLECTOR_CHUNK_SAMPLES)*sizeof(collector_metric_sample),
+                                    len*sizeof(collector_metric_sample), &reqs[num_reqs]);
+        if(hret != HG_SUCCESS)
+            break;
+        num_reqs += 1;
+        offset += len*sizeof(collector_metric_sample);
+    }
+    for(i = 0; i < num_reqs; i++) {
+        wret = margo_wait(reqs[i]);
+        if(hret == HG_SUCCESS) hret = wret;
+    }
+    free(reqs);
+    return hret;
+}
+
 static void collector_metric_fetch_ult(hg_handle_t h)
 {
-    hg_return_t hret;
+    hg_return_t hret = HG_SUCCESS;
     metric_fetch_in_t  in;
     metric_fetch_out_t out;
-    hg_bulk_t local_bulk;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_metric_buffer b = NULL;
+    void* encoded = NULL;
+    void* data;
+    uint64_t count;
+    out.name = NULL;
+    out.ns = NULL;
+    out.actual_count = 0;
+    out.first_seq = 0;
+    out.next_seq = 0;
+    out.encoding = COLLECTOR_ENCODING_RAW;
+    out.size = 0;
+    out.num_inline = 0;
+    out.inline_data = NULL;
 
     /* find the margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -224,17 +583,6 @@ static void collector_metric_fetch_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* create a bulk region */
-    collector_metric_buffer b = calloc(in.count, sizeof(collector_metric_sample));
-    hg_size_t buf_size = in.count * sizeof(collector_metric_sample);
-    hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
-
-    if(hret != HG_SUCCESS) {
-        margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
-        out.ret = COLLECTOR_ERR_FROM_MERCURY;
-        goto finish;
-    }
-
     collector_metric_id_t requested_id = in.metric_id;
     collector_metric* metric = find_metric(provider, &(requested_id));
     if(!metric) {
@@ -243,22 +591,59 @@ static void collector_metric_fetch_ult(hg_handle_t h)
     }
 
 
-    out.name = (char*)malloc(36*sizeof(char));
-    out.ns = (char*)malloc(36*sizeof(char));
-    strcpy(out.name, metric->name);
-    strcpy(out.ns, metric->ns);
+    out.name = strdup(collector_intern_str(&provider->strings, metric->cold->name));
+    out.ns = strdup(collector_intern_str(&provider->strings, metric->cold->ns));
+
+    /* small fetches get the samples in the response instead of a bulk transfer */
+    int inline_fetch = (in.bulk == HG_BULK_NULL);
+    if(inline_fetch && in.count > COLLECTOR_FETCH_INLINE_MAX)
+        in.count = COLLECTOR_FETCH_INLINE_MAX;
+
+    /* samples of an unbounded store never change once appended: expose
+     * them to a client that only takes raw samples as they are, without
+     * copying them (the client expects records, which only the raw chunks
+     * of a row store hold) */
+    if(!inline_fetch && in.encodings == COLLECTOR_ENCODING_RAW
+    && !metric->shards && !metric->store.max_samples && !metric->store.columnar && !metric->store.compressed) {
+        out.next_seq = collector_store_size(&metric->store);
+        out.first_seq = out.next_seq > (uint64_t)in.count ? out.next_seq - in.count : 0;
+        out.actual_count = out.next_seq - out.first_seq;
+        out.size = out.actual_count*sizeof(collector_metric_sample);
+        hret = push_samples(mid, info->addr, in.bulk, &metric->store, out.first_seq, out.next_seq);
+        if(hret == HG_SUCCESS) {
+            out.ret = COLLECTOR_SUCCESS;
+            goto finish;
+        }
+        margo_info(provider->mid, "Could not expose samples (mercury error %d), copying them", hret);
+    }
 
-    /* copyout metric buffer of requested size */
-    if(metric->buffer_index < in.count) {
-        out.actual_count = metric->buffer_index;
-        memcpy(b, metric->buffer, out.actual_count*sizeof(collector_metric_sample));
-    } else {
-	out.actual_count = in.count;
-        memcpy(b, metric->buffer + (metric->buffer_index - out.actual_count), out.actual_count*sizeof(collector_metric_sample));
+    b = calloc(in.count, sizeof(collector_metric_sample));
+    if(!b && in.count) {
+        out.actual_count = 0;
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
     }
 
+    /* copyout the last samples of the metric, chunk by chunk */
+    out.ret = copy_latest_samples(metric, in.count, b, &count, &out.first_seq, &out.next_seq);
+    if(out.ret != COLLECTOR_SUCCESS)
+        goto finish;
+    out.actual_count = count;
+
+    /* encode them as the client allows */
+    encoded = collector_encode_best(in.encodings, b, out.actual_count, &out.encoding, &out.size);
+    data = encoded ? encoded : (void*)b;
+
     /* do the bulk transfer */
-    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+    if(inline_fetch) {
+        out.num_inline = out.actual_count;
+        out.inline_data = data;
+    } else if(out.actual_count) {
+        hg_size_t buf_size = out.size;
+        hret = margo_bulk_create(mid, 1, &data, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, out.size);
+    }
     if(hret != HG_SUCCESS) {
         margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
         out.ret = COLLECTOR_ERR_FROM_MERCURY;
@@ -269,141 +654,1328 @@ static void collector_metric_fetch_ult(hg_handle_t h)
     out.ret = COLLECTOR_SUCCESS;
 
 finish:
-    free(b);
     hret = margo_respond(h, &out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
-    margo_bulk_free(local_bulk);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(b);
+    free(encoded);
+    free(out.name);
+    free(out.ns);
 }
 static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_ult)
 
-collector_return_t collector_provider_metric_destroy(collector_metric_t m, collector_provider_t provider)
+static void collector_metric_fetch_range_ult(hg_handle_t h)
 {
+    hg_return_t hret;
+    metric_fetch_range_in_t  in;
+    metric_fetch_range_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_metric_buffer b = NULL;
+    uint64_t first_seq, count;
+    out.actual_count = 0;
+    out.total = 0;
 
-    /* find the metric */
-    collector_metric* metric = find_metric(provider, &m->id);
-    if(!metric) {
-        return COLLECTOR_ERR_INVALID_METRIC;
-    }
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
 
-#ifdef USE_AGGREGATOR
-    //aggregator_stream_detach_buffer(aggregator_stream_id stream_id);
-    //aggregator_stream_destroy(aggregator_stream_id stream_id);
-#endif
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
 
-    /* remove the metric from the provider */
-    remove_metric(provider, &metric->id);
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
 
-    ABT_mutex_free(&metric->metric_mutex);
-    free(metric->buffer);
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+    if(in.count < 0) {
+        out.ret = COLLECTOR_ERR_INVALID_ARGS;
+        goto finish;
+    }
 
-    return COLLECTOR_SUCCESS;
-}
+    /* copy the first samples in [t_start, t_end), found by binary search */
+    if(in.count) {
+        b = calloc(in.count, sizeof(collector_metric_sample));
+        if(!b) {
+            out.ret = COLLECTOR_ERR_ALLOCATION;
+            goto finish;
+        }
+    }
+    if(metric->shards) {
+        collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+        size_t num_stores = collector_metric_stores(metric, stores);
+        out.ret = collector_store_merge_range(stores, num_stores, in.t_start, in.t_end,
+                                              in.count, b, &count, &out.total);
+        if(out.ret != COLLECTOR_SUCCESS)
+            goto finish;
+        out.actual_count = count;
+    } else {
+        out.actual_count = collector_store_copy_range(&metric->store, in.t_start, in.t_end,
+                                                      in.count, b, &first_seq, &out.total);
+    }
 
-collector_return_t collector_provider_destroy_all_metrics(collector_provider_t provider)
-{
+    /* do the bulk transfer */
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count * sizeof(collector_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not transfer samples (mercury error %d)", hret);
+            out.actual_count = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
 
-    remove_all_metrics(provider);
+    /* set the response */
+    out.ret = COLLECTOR_SUCCESS;
 
-    return COLLECTOR_SUCCESS;
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(b);
 }
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_range_ult)
 
-static void collector_list_metrics_ult(hg_handle_t h)
+static void collector_metric_fetch_downsampled_ult(hg_handle_t h)
 {
     hg_return_t hret;
-    list_metrics_in_t  in;
-    list_metrics_out_t out;
-    out.ids = NULL;
+    metric_fetch_downsampled_in_t  in;
+    metric_fetch_downsampled_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_metric_buffer b = NULL;
+    collector_store_merge it;
+    uint64_t count;
+    int it_init = 0;
+    out.actual_count = 0;
+    out.total = 0;
 
-    /* find margo instance */
+    /* find the margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
 
-    /* find provider */
+    /* find the provider */
     const struct hg_info* info = margo_get_info(h);
     collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
 
     /* deserialize the input */
     hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
-        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
         out.ret = COLLECTOR_ERR_FROM_MERCURY;
         goto finish;
     }
 
-    /* allocate array of metric ids */
-    out.ret   = COLLECTOR_SUCCESS;
-    out.count = provider->num_metrics < in.max_ids ? provider->num_metrics : in.max_ids;
-    out.ids   = (collector_metric_id_t*)calloc(provider->num_metrics, sizeof(*out.ids));
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+    if(in.count < 0 || in.count > COLLECTOR_DOWNSAMPLE_MAX_POINTS) {
+        out.ret = COLLECTOR_ERR_INVALID_ARGS;
+        goto finish;
+    }
 
-    /* iterate over the hash of metrics to fill the array of metric ids */
-    unsigned i = 0;
-    collector_metric *r, *tmp;
-    HASH_ITER(hh, provider->metrics, r, tmp) {
-        out.ids[i++] = r->id;
+    /* summarize the samples in [t_start, t_end), merged by timestamp */
+    collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+    size_t num_stores = collector_metric_stores(metric, stores);
+    out.ret = collector_store_merge_init_range(&it, stores, num_stores, in.t_start, in.t_end);
+    if(out.ret != COLLECTOR_SUCCESS)
+        goto finish;
+    it_init = 1;
+    out.total = collector_store_merge_remaining(&it);
+    b = calloc(in.count ? in.count : 1, sizeof(collector_metric_sample));
+    if(!b) {
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
     }
+    out.ret = collector_downsample(&it, in.method, in.count, b, &count);
+    if(out.ret != COLLECTOR_SUCCESS)
+        goto finish;
+    out.actual_count = count;
 
-    margo_debug(mid, "Listed metrics");
+    /* do the bulk transfer */
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count * sizeof(collector_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not transfer samples (mercury error %d)", hret);
+            out.actual_count = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
 
 finish:
     hret = margo_respond(h, &out);
     hret = margo_free_input(h, &in);
-    free(out.ids);
     margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    if(it_init)
+        collector_store_merge_finalize(&it);
+    free(b);
 }
-static DEFINE_MARGO_RPC_HANDLER(collector_list_metrics_ult)
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_downsampled_ult)
 
-collector_return_t collector_provider_register_backend()
+/* Returns the number of fields selected by a mask of COLLECTOR_COLUMN_* flags */
+static inline size_t num_columns(uint32_t columns)
 {
-    return COLLECTOR_SUCCESS;
+    return __builtin_popcount(columns & COLLECTOR_COLUMN_ALL);
 }
 
-static inline collector_metric* find_metric(
-        collector_provider_t provider,
-        const collector_metric_id_t* id)
+/* Sets the arrays of the selected fields in a region holding count
+ * samples per selected field, in the order of types.h's column fetch */
+static void column_arrays(void* region, uint64_t count, uint32_t columns, double** time, double** val, uint64_t** sample_id)
 {
-    collector_metric* metric = NULL;
-
-    HASH_FIND(hh, provider->metrics, id, sizeof(collector_metric_id_t), metric);
-    return metric;
+    char* p = (char*)region;
+    *time = *val = NULL;
+    *sample_id = NULL;
+    if(columns & COLLECTOR_COLUMN_TIME)      { *time      = (double*)p;   p += count*sizeof(double); }
+    if(columns & COLLECTOR_COLUMN_VAL)       { *val       = (double*)p;   p += count*sizeof(double); }
+    if(columns & COLLECTOR_COLUMN_SAMPLE_ID) { *sample_id = (uint64_t*)p; }
 }
 
-static inline collector_return_t add_metric(
-        collector_provider_t provider,
-        collector_metric* metric)
+/* Same as copy_latest_samples, copying the selected fields into separate
+ * arrays and setting *count to the number of samples copied */
+static collector_return_t copy_latest_columns(collector_metric* metric, uint64_t n, uint32_t columns, double* time, double* val, uint64_t* sample_id, uint64_t* count, uint64_t* first_seq, uint64_t* next_seq)
 {
-
-    collector_metric* existing = find_metric(provider, &(metric->id));
-    if(existing) {
-        return COLLECTOR_ERR_INVALID_METRIC;
+    collector_metric_sample* s;
+    collector_return_t ret;
+    uint64_t i;
+
+    *count = 0;
+    if(!metric->shards) {
+        *count = collector_store_copy_latest_columns(&metric->store, n, columns, time, val, sample_id, first_seq);
+        *next_seq = *first_seq + *count;
+        return COLLECTOR_SUCCESS;
     }
-    HASH_ADD(hh, provider->metrics, id, sizeof(collector_metric_id_t), metric);
-    provider->num_metrics += 1;
 
-    return COLLECTOR_SUCCESS;
+    /* the shards are merged as records, then split */
+    s = (collector_metric_sample*)calloc(n ? n : 1, sizeof(*s));
+    if(!s)
+        return COLLECTOR_ERR_ALLOCATION;
+    ret = copy_latest_samples(metric, n, s, count, first_seq, next_seq);
+    for(i = 0; i < *count; i++) {
+        if(time)      time[i]      = s[i].time;
+        if(val)       val[i]       = s[i].val;
+        if(sample_id) sample_id[i] = s[i].sample_id;
+    }
+    free(s);
+    return ret;
 }
 
-static inline collector_return_t remove_metric(
-        collector_provider_t provider,
-        const collector_metric_id_t* id)
+/* Pushes the selected fields of samples [first, last) of a columnar store
+ * to a client's bulk region straight from the store's chunks, with one
+ * transfer per chunk and field; the client's region holds count samples
+ * per selected field */
+static hg_return_t push_columns(margo_instance_id mid, hg_addr_t addr, hg_bulk_t remote_bulk, collector_sample_store* store, uint64_t first, uint64_t last, uint64_t count, uint32_t columns)
 {
-    collector_metric* metric = find_metric(provider, id);
-    if(!metric) {
-        return COLLECTOR_ERR_INVALID_METRIC;
+    const size_t field_offsets[3] = {
+        offsetof(collector_chunk, columns.time) - offsetof(collector_chunk, samples),
+        offsetof(collector_chunk, columns.val) - offsetof(collector_chunk, samples),
+        offsetof(collector_chunk, columns.sample_id) - offsetof(collector_chunk, samples)
+    };
+    size_t num_reqs = 0, i, f, k;
+    uint64_t j, len;
+    hg_return_t hret = HG_SUCCESS, wret;
+    margo_request* reqs = (margo_request*)calloc(3*((last - first) / COLLECTOR_CHUNK_SAMPLES + 2), sizeof(*reqs));
+
+    if(!reqs)
+        return HG_NOMEM;
+
+    for(j = first; j < last && hret == HG_SUCCESS; j += len) {
+        len = COLLECTOR_CHUNK_SAMPLES - (j % COLLECTOR_CHUNK_SAMPLES);
+        if(len > last - j) len = last - j;
+        hg_bulk_t bulk = collector_chunk_bulk(store->pool, collector_store_chunk(store, j));
+        if(bulk == HG_BULK_NULL) {
+            hret = HG_NOMEM;
+            break;
+        }
+        /* all the fields are 8 bytes wide */
+        for(f = 0, k = 0; f < 3; f++) {
+            if(!(columns & (1u << f)))
+                continue;
+            hret = margo_bulk_itransfer(mid, HG_BULK_PUSH, addr, remote_bulk, (k*count + j - first)*sizeof(double),
+                                        bulk, field_offsets[f] + (j % COLLECTOR_CHUNK_SAMPLES)*sizeof(double),
+                                        len*sizeof(double), &reqs[num_reqs]);
+            if(hret != HG_SUCCESS)
+                break;
+            num_reqs += 1;
+            k += 1;
+        }
     }
-    collector_return_t ret = COLLECTOR_SUCCESS;
-    HASH_DEL(provider->metrics, metric);
-    free(metric);
-    provider->num_metrics -= 1;
-    return ret;
+    for(i = 0; i < num_reqs; i++) {
+        wret = margo_wait(reqs[i]);
+        if(hret == HG_SUCCESS) hret = wret;
+    }
+    free(reqs);
+    return hret;
 }
 
-static inline void remove_all_metrics(
-        collector_provider_t provider)
+static void collector_metric_fetch_columns_ult(hg_handle_t h)
 {
-    collector_metric *r, *tmp;
-    HASH_ITER(hh, provider->metrics, r, tmp) {
-        HASH_DEL(provider->metrics, r);
-        free(r);
+    hg_return_t hret;
+    metric_fetch_columns_in_t  in;
+    metric_fetch_columns_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    void* b = NULL;
+    double *time, *val;
+    uint64_t *sample_id;
+    uint64_t n, count;
+    size_t width, k;
+    out.actual_count = 0;
+    out.total = 0;
+    out.first_seq = 0;
+    out.next_seq = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
     }
-    provider->num_metrics = 0;
+
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+    width = num_columns(in.columns);
+    if(in.count <= 0 || width == 0 || (in.columns & ~COLLECTOR_COLUMN_ALL)) {
+        out.ret = COLLECTOR_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    /* the client sizes a fetch of all the samples from the total */
+    out.total = retained_samples(metric);
+
+    /* the columns of an unbounded columnar store are exposed as they are */
+    if(!metric->shards && !metric->store.max_samples && metric->store.columnar && !metric->store.compressed) {
+        out.next_seq = collector_store_size(&metric->store);
+        out.first_seq = out.next_seq > (uint64_t)in.count ? out.next_seq - in.count : 0;
+        out.actual_count = out.next_seq - out.first_seq;
+        hret = push_columns(mid, info->addr, in.bulk, &metric->store, out.first_seq, out.next_seq, in.count, in.columns);
+        if(hret == HG_SUCCESS) {
+            out.ret = COLLECTOR_SUCCESS;
+            goto finish;
+        }
+        margo_info(provider->mid, "Could not expose samples (mercury error %d), copying them", hret);
+        out.actual_count = 0;
+    }
+
+    /* copy the selected fields of the last (at most n) samples, one array
+     * per field as in the client's region */
+    n = out.total < (uint64_t)in.count ? out.total : (uint64_t)in.count;
+    hg_size_t buf_size = (n ? n : 1)*width*sizeof(double);
+    b = malloc(buf_size);
+    if(!b) {
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+    column_arrays(b, n, in.columns, &time, &val, &sample_id);
+    out.ret = copy_latest_columns(metric, n, in.columns, time, val, sample_id, &count, &out.first_seq, &out.next_seq);
+    if(out.ret != COLLECTOR_SUCCESS)
+        goto finish;
+    out.actual_count = count;
+
+    /* do the bulk transfer, one per selected field */
+    if(out.actual_count) {
+        hret = margo_bulk_create(mid, 1, &b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        for(k = 0; k < width && hret == HG_SUCCESS; k++) {
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, k*in.count*sizeof(double),
+                                       local_bulk, k*n*sizeof(double), out.actual_count*sizeof(double));
+        }
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not transfer samples (mercury error %d)", hret);
+            out.actual_count = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = COLLECTOR_SUCCESS;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(b);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_columns_ult)
+
+static void collector_metric_fetch_since_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_since_in_t  in;
+    metric_fetch_since_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_metric_buffer b = NULL;
+    uint64_t positions[COLLECTOR_MAX_SHARDS+1];
+    uint64_t n, count, first, copied;
+    out.actual_count = 0;
+    out.dropped = 0;
+    out.total = 0;
+    out.num_positions = 0;
+    out.positions = positions;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+    if(in.count <= 0 || in.num_positions > COLLECTOR_MAX_SHARDS+1) {
+        out.ret = COLLECTOR_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    /* count the samples following the cursor, that the client sizes a
+     * fetch of all of them from; positions of stores created after the
+     * previous fetch start at 0 */
+    collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+    size_t slots[COLLECTOR_MAX_SHARDS+1];
+    uint64_t pos[COLLECTOR_MAX_SHARDS+1];
+    size_t i, num_stores = collector_metric_store_slots(metric, stores, slots);
+    for(i = 0; i < num_stores; i++) {
+        pos[i] = slots[i] < in.num_positions ? in.positions[slots[i]] : 0;
+        count = collector_store_size(stores[i]);
+        first = collector_store_first(stores[i], count);
+        if(pos[i] < count)
+            out.total += count - (pos[i] > first ? pos[i] : first);
+    }
+
+    n = out.total < (uint64_t)in.count ? out.total : (uint64_t)in.count;
+    b = calloc(n ? n : 1, sizeof(collector_metric_sample));
+    if(!b) {
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* copy the samples following the cursor */
+    out.ret = collector_store_merge_since(stores, num_stores, pos, n, b, &copied, &out.dropped);
+    if(out.ret != COLLECTOR_SUCCESS)
+        goto finish;
+    out.actual_count = copied;
+    out.num_positions = slots[num_stores-1] + 1;
+    memset(positions, 0, out.num_positions*sizeof(uint64_t));
+    for(i = 0; i < num_stores; i++)
+        positions[slots[i]] = pos[i];
+
+    /* do the bulk transfer */
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count * sizeof(collector_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not transfer samples (mercury error %d)", hret);
+            out.actual_count = 0;
+            out.num_positions = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = COLLECTOR_SUCCESS;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(b);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_since_ult)
+
+static void collector_metric_fetch_batch_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_batch_in_t  in;
+    metric_fetch_batch_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_metric_buffer b = NULL;
+    collector_metric** metrics = NULL;
+    uint64_t* counts = NULL;
+    uint64_t total = 0, first_seq, next_seq;
+    size_t num_metrics = 0, i;
+    int64_t count;
+    memset(&out, 0, sizeof(out));
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* resolve the metrics and the number of samples to fetch from each */
+    if(in.by_selector) {
+        collector_selector sel = { in.ns, in.name, in.num_tags, in.tags };
+        if(in.count < 0) {
+            out.ret = COLLECTOR_ERR_INVALID_ARGS;
+            goto finish;
+        }
+        out.ret = select_metrics(provider, &sel, &metrics, &num_metrics);
+        if(out.ret != COLLECTOR_SUCCESS)
+            goto finish;
+        counts = (uint64_t*)calloc(num_metrics ? num_metrics : 1, sizeof(uint64_t));
+        if(!counts) {
+            out.ret = COLLECTOR_ERR_ALLOCATION;
+            goto finish;
+        }
+        count = in.count < METRIC_BUFFER_SIZE ? in.count : METRIC_BUFFER_SIZE;
+        for(i = 0; i < num_metrics; i++) {
+            counts[i] = retained_samples(metrics[i]);
+            if(counts[i] > (uint64_t)count)
+                counts[i] = count;
+            total += counts[i];
+        }
+    } else {
+        num_metrics = in.num_metrics;
+        metrics = (collector_metric**)calloc(num_metrics ? num_metrics : 1, sizeof(*metrics));
+        counts = (uint64_t*)calloc(num_metrics ? num_metrics : 1, sizeof(uint64_t));
+        if(!metrics || !counts) {
+            out.ret = COLLECTOR_ERR_ALLOCATION;
+            goto finish;
+        }
+        for(i = 0; i < num_metrics; i++) {
+            if(in.counts[i] < 0) {
+                out.ret = COLLECTOR_ERR_INVALID_ARGS;
+                goto finish;
+            }
+            counts[i] = in.counts[i] < METRIC_BUFFER_SIZE ? in.counts[i] : METRIC_BUFFER_SIZE;
+            metrics[i] = find_metric(provider, &in.ids[i]);
+            /* checked as it grows, so the sum can't wrap */
+            total += counts[i];
+            if(total > COLLECTOR_FETCH_BATCH_MAX_SAMPLES)
+                break;
+        }
+    }
+    if(total > COLLECTOR_FETCH_BATCH_MAX_SAMPLES) {
+        out.ret = COLLECTOR_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    /* the client doesn't know how many metrics a selector matches: let it
+     * retry with a large enough bulk region */
+    if(in.by_selector && total > in.capacity) {
+        out.needed = total;
+        out.ret = COLLECTOR_SUCCESS;
+        goto finish;
+    }
+    if(num_metrics == 0) {
+        out.ret = COLLECTOR_SUCCESS;
+        goto finish;
+    }
+
+    out.ids = (collector_metric_id_t*)calloc(num_metrics, sizeof(collector_metric_id_t));
+    out.offsets = (uint64_t*)calloc(num_metrics + 1, sizeof(uint64_t));
+    out.rets = (int32_t*)calloc(num_metrics, sizeof(int32_t));
+    b = calloc(total ? total : 1, sizeof(collector_metric_sample));
+    if(!out.ids || !out.offsets || !out.rets || !b) {
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.num_metrics = num_metrics;
+
+    /* pack the latest samples of each metric one after the other */
+    for(i = 0; i < num_metrics; i++) {
+        uint64_t n = 0;
+        if(metrics[i]) {
+            out.ids[i] = metrics[i]->id;
+            out.rets[i] = copy_latest_samples(metrics[i], counts[i], b + out.offsets[i], &n, &first_seq, &next_seq);
+        } else {
+            out.ids[i] = in.ids[i];
+            out.rets[i] = COLLECTOR_ERR_INVALID_METRIC;
+        }
+        out.offsets[i+1] = out.offsets[i] + n;
+    }
+
+    /* and send them with a single bulk transfer */
+    if(out.offsets[num_metrics]) {
+        hg_size_t buf_size = out.offsets[num_metrics] * sizeof(collector_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not transfer samples (mercury error %d)", hret);
+            out.num_metrics = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = COLLECTOR_SUCCESS;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(b);
+    free(metrics);
+    free(counts);
+    free(out.ids);
+    free(out.offsets);
+    free(out.rets);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_batch_ult)
+
+collector_return_t collector_provider_metric_destroy(collector_metric_t m, collector_provider_t provider)
+{
+
+    /* find the metric */
+    collector_metric* metric = find_metric(provider, &m->id);
+    if(!metric) {
+        return COLLECTOR_ERR_INVALID_METRIC;
+    }
+
+#ifdef USE_AGGREGATOR
+    //aggregator_stream_detach_buffer(aggregator_stream_id stream_id);
+    //aggregator_stream_destroy(aggregator_stream_id stream_id);
+#endif
+
+    /* remove the metric from the provider */
+    return remove_metric(provider, &metric->id);
+}
+
+collector_return_t collector_provider_destroy_all_metrics(collector_provider_t provider)
+{
+
+    remove_all_metrics(provider);
+
+    return COLLECTOR_SUCCESS;
+}
+
+static void collector_list_metrics_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    list_metrics_in_t  in;
+    list_metrics_out_t out;
+    out.ids = NULL;
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* allocate array of metric ids */
+    out.ret   = COLLECTOR_SUCCESS;
+    out.count = provider->num_metrics < in.max_ids ? provider->num_metrics : in.max_ids;
+    out.ids   = out.count ? (collector_metric_id_t*)calloc(out.count, sizeof(*out.ids)) : NULL;
+    if(out.count && !out.ids) {
+        out.count = 0;
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* iterate over the hash of metrics to fill the array of metric ids */
+    unsigned i = 0;
+    collector_metric *r, *tmp;
+    HASH_ITER(hh, provider->metrics, r, tmp) {
+        if(i == out.count) break;
+        out.ids[i++] = r->id;
+    }
+
+    margo_debug(mid, "Listed metrics");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    free(out.ids);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_list_metrics_ult)
+
+/* Size of the metadata record of a metric (see metric_info_header) */
+static size_t metric_info_size(const collector_intern* strings, const collector_metric* metric)
+{
+    size_t size = sizeof(metric_info_header) + 2;
+    uint32_t j;
+    size += strlen(collector_intern_str(strings, metric->cold->ns));
+    size += strlen(collector_intern_str(strings, metric->cold->name));
+    for(j = 0; j < metric->cold->labels->num_labels; j++)
+        size += strlen(collector_intern_str(strings, metric->cold->labels->labels[j])) + 1;
+    return (size + 7) & ~(size_t)7;
+}
+
+/* Writes the metadata record of a metric to dst, which is zeroed */
+static void metric_info_encode(const collector_intern* strings, const collector_metric* metric, char* dst)
+{
+    metric_info_header header;
+    uint32_t j;
+
+    memset(&header, 0, sizeof(header));
+    header.id = metric->id;
+    header.type = metric->type;
+    header.num_tags = metric->cold->labels->num_labels;
+    header.num_samples = retained_samples(metric);
+    memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+    dst = stpcpy(dst, collector_intern_str(strings, metric->cold->ns)) + 1;
+    dst = stpcpy(dst, collector_intern_str(strings, metric->cold->name)) + 1;
+    for(j = 0; j < metric->cold->labels->num_labels; j++)
+        dst = stpcpy(dst, collector_intern_str(strings, metric->cold->labels->labels[j])) + 1;
+}
+
+/* Appends the metadata record of a metric to a listing if it fits in the
+ * capacity of the client's buffer, otherwise ends the page before it */
+static int list_append(const collector_intern* strings, list_metrics_ext_out_t* out, char* buf, hg_size_t capacity, hg_size_t max_count, const collector_metric* metric)
+{
+    size_t size = metric_info_size(strings, metric);
+    if((max_count && out->count == max_count) || out->size + size > capacity) {
+        if(out->count == 0)
+            out->needed = size;
+        out->next_token = metric->serial;
+        return 0;
+    }
+    metric_info_encode(strings, metric, buf + out->size);
+    out->size += size;
+    out->count += 1;
+    return 1;
+}
+
+static void collector_list_metrics_ext_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    list_metrics_ext_in_t  in;
+    list_metrics_ext_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    hg_size_t capacity;
+    char* buf = NULL;
+    collector_metric** selected = NULL;
+    size_t num_selected = 0, i;
+    out.count = 0;
+    out.next_token = COLLECTOR_LIST_END;
+    out.size = 0;
+    out.needed = 0;
+    out.num_inline = 0;
+    out.records = NULL;
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    capacity = in.capacity;
+    if(in.bulk == HG_BULK_NULL && capacity > COLLECTOR_LIST_INLINE_MAX)
+        capacity = COLLECTOR_LIST_INLINE_MAX;
+    buf = (char*)calloc(capacity ? capacity : 1, 1);
+    if(!buf) {
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* metrics are listed in creation order, so the serial of the first
+     * one that doesn't make it in the page is where the next page starts */
+    collector_selector sel = { in.ns, NULL, in.num_tags, in.tags };
+    if(collector_selector_empty(&sel)) {
+        collector_metric *r, *tmp;
+        HASH_ITER(hh, provider->metrics, r, tmp) {
+            if(r->serial < in.token)
+                continue;
+            if(!list_append(&provider->strings, &out, buf, capacity, in.max_count, r))
+                break;
+        }
+    } else {
+        out.ret = collector_index_select(&provider->index, &provider->strings, &sel, in.token, &selected, &num_selected);
+        if(out.ret != COLLECTOR_SUCCESS)
+            goto finish;
+        for(i = 0; i < num_selected; i++) {
+            if(!list_append(&provider->strings, &out, buf, capacity, in.max_count, selected[i]))
+                break;
+        }
+    }
+
+    if(in.bulk == HG_BULK_NULL) {
+        out.num_inline = out.size;
+        out.records = buf;
+    } else if(out.size) {
+        hg_size_t buf_size = out.size;
+        hret = margo_bulk_create(mid, 1, (void**)&buf, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_error(mid, "Could not transfer metric metadata (mercury error %d)", hret);
+            out.count = 0;
+            out.size = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+    out.ret = COLLECTOR_SUCCESS;
+
+    margo_debug(mid, "Listed metrics");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(selected);
+    free(buf);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_list_metrics_ext_ult)
+
+static void collector_metric_fetch_stats_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_stats_in_t  in;
+    metric_fetch_stats_out_t out;
+    collector_stats_acc acc = COLLECTOR_STATS_ACC_INIT;
+    memset(&out, 0, sizeof(out));
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+
+    /* the samples are summarized where they are, store by store */
+    collector_sample_store* stores[COLLECTOR_MAX_SHARDS+1];
+    size_t i, num_stores = collector_metric_stores(metric, stores);
+    for(i = 0; i < num_stores; i++)
+        collector_store_stats_range(stores[i], in.t_start, in.t_end, in.threshold, &acc);
+
+    out.count     = acc.count;
+    out.num_above = acc.num_above;
+    out.min       = acc.min;
+    out.max       = acc.max;
+    out.sum       = acc.sum;
+    out.mean      = acc.mean;
+    out.variance  = acc.count ? acc.m2 / acc.count : 0;
+    out.ret = COLLECTOR_SUCCESS;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_stats_ult)
+
+/* Size of the record of a series (see query_series_header) */
+static size_t query_series_size(size_t group_len, size_t num_values)
+{
+    return sizeof(query_series_header) + ((group_len + 7) & ~(size_t)7) + num_values*sizeof(double);
+}
+
+static void collector_query_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    query_in_t  in;
+    query_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    collector_metric** selected = NULL;
+    collector_query_group* groups = NULL;
+    size_t num_selected = 0, num_groups = 0, num_windows = 0, num_values, i, size;
+    char* buf = NULL;
+    memset(&out, 0, sizeof(out));
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    out.ret = collector_query_check(in.t_start, in.t_end, in.step, in.num_aggs, in.aggs, &num_windows);
+    if(out.ret != COLLECTOR_SUCCESS || in.grouping > QUERY_GROUP_BY_KEY) {
+        out.ret = COLLECTOR_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    num_values = num_windows*in.num_aggs;
+
+    /* select the metrics */
+    collector_selector sel = { in.ns, in.name, in.num_tags, in.tags };
+    if(in.by_id) {
+        selected = (collector_metric**)malloc(sizeof(*selected));
+        if(!selected) {
+            out.ret = COLLECTOR_ERR_ALLOCATION;
+            goto finish;
+        }
+        selected[0] = find_metric(provider, &in.metric_id);
+        if(!selected[0]) {
+            out.ret = COLLECTOR_ERR_INVALID_METRIC;
+            goto finish;
+        }
+        num_selected = 1;
+    } else {
+        out.ret = select_metrics(provider, &sel, &selected, &num_selected);
+        if(out.ret != COLLECTOR_SUCCESS)
+            goto finish;
+    }
+
+    /* split them into series */
+    if(in.grouping == QUERY_GROUP_BY_KEY) {
+        out.ret = collector_query_group_by(&provider->strings, collector_intern_find(&provider->strings, in.group_by),
+                                           selected, num_selected, &groups, &num_groups);
+        if(out.ret != COLLECTOR_SUCCESS)
+            goto finish;
+    } else {
+        num_groups = in.grouping == QUERY_GROUP_ALL ? (num_selected ? 1 : 0) : num_selected;
+        groups = (collector_query_group*)calloc(num_groups ? num_groups : 1, sizeof(*groups));
+        if(!groups) {
+            out.ret = COLLECTOR_ERR_ALLOCATION;
+            goto finish;
+        }
+        for(i = 0; i < num_groups; i++) {
+            groups[i].first = i;
+            groups[i].count = in.grouping == QUERY_GROUP_ALL ? num_selected : 1;
+        }
+    }
+
+    /* the size of the result is known before aggregating anything, so a
+     * client whose buffer is too small is told how much room to make */
+    size = 0;
+    for(i = 0; i < num_groups; i++) {
+        size_t group_len = 0;
+        if(in.grouping != QUERY_GROUP_NONE)
+            group_len = groups[i].label ? strlen(collector_intern_str(&provider->strings, groups[i].label)) + 1 : 1;
+        size += query_series_size(group_len, num_values);
+    }
+    out.num_windows = num_windows;
+    if(size > in.capacity || (in.bulk == HG_BULK_NULL && size > COLLECTOR_QUERY_INLINE_MAX)) {
+        out.needed = size;
+        out.ret = COLLECTOR_SUCCESS;
+        goto finish;
+    }
+
+    buf = (char*)calloc(size ? size : 1, 1);
+    if(!buf) {
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(i = 0; i < num_groups; i++) {
+        query_series_header header;
+        memset(&header, 0, sizeof(header));
+        header.id = in.grouping == QUERY_GROUP_NONE ? selected[groups[i].first]->id : 0;
+        header.num_metrics = groups[i].count;
+        if(in.grouping != QUERY_GROUP_NONE) {
+            const char* group = groups[i].label ? collector_intern_str(&provider->strings, groups[i].label) : "";
+            header.group_len = strlen(group) + 1;
+            memcpy(buf + out.size + sizeof(header), group, header.group_len);
+        }
+        memcpy(buf + out.size, &header, sizeof(header));
+        out.size += query_series_size(header.group_len, 0);
+        out.ret = collector_query_aggregate(selected + groups[i].first, groups[i].count, in.t_start, in.t_end, in.step,
+                                            num_windows, in.aggs, in.num_aggs, (double*)(buf + out.size));
+        if(out.ret != COLLECTOR_SUCCESS) {
+            out.size = 0;
+            goto finish;
+        }
+        out.size += num_values*sizeof(double);
+    }
+    out.num_series = num_groups;
+
+    if(in.bulk == HG_BULK_NULL) {
+        out.num_inline = out.size;
+        out.records = buf;
+    } else if(out.size) {
+        hg_size_t buf_size = out.size;
+        hret = margo_bulk_create(mid, 1, (void**)&buf, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_error(mid, "Could not transfer query results (mercury error %d)", hret);
+            out.num_series = 0;
+            out.size = 0;
+            out.ret = COLLECTOR_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+    out.ret = COLLECTOR_SUCCESS;
+
+    margo_debug(mid, "Aggregated metrics over windows");
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(groups);
+    free(selected);
+    free(buf);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_query_ult)
+
+static void collector_metric_fetch_histogram_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_histogram_in_t  in;
+    metric_fetch_histogram_out_t out;
+    size_t i;
+    out.num_bounds = 0;
+    out.bounds = NULL;
+    out.counts = NULL;
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+    if(!metric->histogram) {
+        out.ret = COLLECTOR_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* bounds are constant, counts are read one by one while being updated */
+    out.num_bounds = metric->histogram->num_bounds;
+    out.bounds = metric->histogram->bounds;
+    out.counts = (uint64_t*)calloc(out.num_bounds + 1, sizeof(uint64_t));
+    if(!out.counts) {
+        out.num_bounds = 0;
+        out.bounds = NULL;
+        out.ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(i = 0; i <= out.num_bounds; i++)
+        out.counts[i] = __atomic_load_n(&metric->histogram->counts[i], __ATOMIC_RELAXED);
+    out.ret = COLLECTOR_SUCCESS;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    free(out.counts);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_histogram_ult)
+
+static void collector_metric_fetch_sketch_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_sketch_in_t  in;
+    metric_fetch_sketch_out_t out;
+    size_t size = 0;
+    out.size = 0;
+    out.buf = NULL;
+
+    /* find margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find provider */
+    const struct hg_info* info = margo_get_info(h);
+    collector_provider_t provider = (collector_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_error(mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = COLLECTOR_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    collector_metric* metric = find_metric(provider, &in.metric_id);
+    if(!metric) {
+        out.ret = COLLECTOR_ERR_INVALID_METRIC;
+        goto finish;
+    }
+    if(!metric->sketch) {
+        out.ret = COLLECTOR_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* bins are read one by one while being updated */
+    out.ret = collector_sketch_serialize(metric->sketch, &out.buf, &size);
+    out.size = size;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    free(out.buf);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(collector_metric_fetch_sketch_ult)
+
+collector_return_t collector_provider_register_backend()
+{
+    return COLLECTOR_SUCCESS;
+}
+
+static inline collector_metric* find_metric(
+        collector_provider_t provider,
+        const collector_metric_id_t* id)
+{
+    collector_metric* metric = NULL;
+
+    HASH_FIND(hh, provider->metrics, id, sizeof(collector_metric_id_t), metric);
+    return metric;
+}
+
+static inline collector_return_t add_metric(
+        collector_provider_t provider,
+        collector_metric* metric)
+{
+
+    collector_metric* existing = find_metric(provider, &(metric->id));
+    if(existing) {
+        /* identities are made of interned strings and label sets */
+        if(existing->cold->ns == metric->cold->ns && existing->cold->name == metric->cold->name && existing->cold->labels == metric->cold->labels)
+            return COLLECTOR_ERR_METRIC_EXISTS;
+        margo_error(provider->mid, "Metric %s:%s has the same id (%" PRIu64 ") as metric %s:%s",
+                    collector_intern_str(&provider->strings, metric->cold->ns),
+                    collector_intern_str(&provider->strings, metric->cold->name), metric->id,
+                    collector_intern_str(&provider->strings, existing->cold->ns),
+                    collector_intern_str(&provider->strings, existing->cold->name));
+        return COLLECTOR_ERR_ID_COLLISION;
+    }
+    metric->serial = provider->next_serial++;
+    collector_return_t ret = collector_index_add(&provider->index, metric);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    HASH_ADD(hh, provider->metrics, id, sizeof(collector_metric_id_t), metric);
+    provider->num_metrics += 1;
+
+    return COLLECTOR_SUCCESS;
+}
+
+static inline collector_return_t remove_metric(
+        collector_provider_t provider,
+        const collector_metric_id_t* id)
+{
+    collector_metric* metric = find_metric(provider, id);
+    if(!metric) {
+        return COLLECTOR_ERR_INVALID_METRIC;
+    }
+    collector_return_t ret = COLLECTOR_SUCCESS;
+    HASH_DEL(provider->metrics, metric);
+    collector_index_remove(&provider->index, metric);
+    sampler_remove_metric(provider, metric);
+    free_metric(provider, metric);
+    provider->num_metrics -= 1;
+    return ret;
+}
+
+static inline void remove_all_metrics(
+        collector_provider_t provider)
+{
+    collector_metric *r, *tmp;
+    ABT_mutex_lock(provider->sampler_mutex);
+    provider->sampled_metrics = NULL;
+    ABT_mutex_unlock(provider->sampler_mutex);
+    HASH_ITER(hh, provider->metrics, r, tmp) {
+        HASH_DEL(provider->metrics, r);
+        free_metric(provider, r);
+    }
+    collector_index_finalize(&provider->index);
+    provider->num_metrics = 0;
+}
+
+static inline void free_metric(
+        collector_provider_t provider,
+        collector_metric* metric)
+{
+    size_t i;
+    collector_intern_release(&provider->strings, metric->cold->ns);
+    collector_intern_release(&provider->strings, metric->cold->name);
+    collector_labelset_put(&provider->strings, metric->cold->labels);
+    if(metric->shards) {
+        for(i = 0; i < COLLECTOR_MAX_SHARDS; i++) {
+            if(!metric->shards[i]) continue;
+            collector_store_destroy(metric->shards[i]);
+            free(metric->shards[i]);
+        }
+        free(metric->shards);
+    }
+    collector_store_destroy(&metric->store);
+    collector_histogram_destroy(metric->histogram);
+    if(metric->sketch)
+        collector_sketch_destroy(metric->sketch);
+    collector_rollup_destroy(metric->rollup);
+    ABT_mutex_free(&metric->metric_mutex);
+    free(metric->cold);
+    collector_slab_free(&provider->metric_slab, metric);
+}
+
+/* Maximum time (in seconds) the sampler sleeps, so that it notices
+ * newly added metrics and the finalization of the provider */
+#define COLLECTOR_SAMPLER_MAX_SLEEP 0.1
+
+static void collector_sampler_ult(void* arg)
+{
+    collector_provider_t provider = (collector_provider_t)arg;
+    ABT_unit_id self_id;
+
+    ABT_self_get_thread_id(&self_id);
+
+    while(!__atomic_load_n(&provider->sampler_stop, __ATOMIC_ACQUIRE)) {
+        double now = ABT_get_wtime();
+        double next_wakeup = now + COLLECTOR_SAMPLER_MAX_SLEEP;
+        double val;
+        collector_metric* m;
+
+        /* the sampler is the only writer of the stores of sampled metrics */
+        ABT_mutex_lock(provider->sampler_mutex);
+        for(m = provider->sampled_metrics; m; m = m->next_sampled) {
+            if(m->next_sample_time <= now) {
+                __atomic_load(&m->value, &val, __ATOMIC_RELAXED);
+                collector_store_append(&m->store, now, val, self_id);
+                if(m->rollup)
+                    collector_rollup_age(m->rollup, &m->store);
+                /* skip the periods we missed rather than catching up */
+                m->next_sample_time += m->sampling_period;
+                if(m->next_sample_time <= now)
+                    m->next_sample_time = now + m->sampling_period;
+            }
+            if(m->next_sample_time < next_wakeup)
+                next_wakeup = m->next_sample_time;
+        }
+        ABT_mutex_unlock(provider->sampler_mutex);
+
+        margo_thread_sleep(provider->mid, (next_wakeup - now)*1000.0);
+    }
+}
+
+static inline void sampler_add_metric(
+        collector_provider_t provider,
+        collector_metric* metric)
+{
+    ABT_mutex_lock(provider->sampler_mutex);
+    metric->next_sample_time = ABT_get_wtime() + metric->sampling_period;
+    metric->next_sampled = provider->sampled_metrics;
+    provider->sampled_metrics = metric;
+    if(provider->sampler == ABT_THREAD_NULL) {
+        ABT_pool pool = provider->pool;
+        if(pool == ABT_POOL_NULL)
+            margo_get_handler_pool(provider->mid, &pool);
+        ABT_thread_create(pool, collector_sampler_ult, provider,
+                          ABT_THREAD_ATTR_NULL, &provider->sampler);
+    }
+    ABT_mutex_unlock(provider->sampler_mutex);
+}
+
+static inline void sampler_remove_metric(
+        collector_provider_t provider,
+        collector_metric* metric)
+{
+    collector_metric** m;
+    if(metric->sampling_period <= 0)
+        return;
+    ABT_mutex_lock(provider->sampler_mutex);
+    for(m = &provider->sampled_metrics; *m; m = &(*m)->next_sampled) {
+        if(*m == metric) {
+            *m = metric->next_sampled;
+            break;
+        }
+    }
+    ABT_mutex_unlock(provider->sampler_mutex);
+}
+
+static inline void sampler_stop(
+        collector_provider_t provider)
+{
+    if(provider->sampler == ABT_THREAD_NULL)
+        return;
+    __atomic_store_n(&provider->sampler_stop, 1, __ATOMIC_RELEASE);
+    ABT_thread_free(&provider->sampler); /* joins the sampler */
 }
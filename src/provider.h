@@ -10,11 +10,20 @@
 #include <abt-io.h>
 #include "uthash.h"
 #include "types.h"
+#include "index.h"
+#include "intern.h"
+#include "slab.h"
+#include "query.h"
+#include "downsample.h"
+#include "collector/collector-metric.h"
 #ifdef USE_AGGREGATOR
 #include <aggregator/aggregator-provider-handle.h>
 #include <aggregator/aggregator-client.h>
 #endif
 
+/* Number of metrics allocated at once by a provider's metric slab */
+#define COLLECTOR_METRIC_SLAB_SIZE 64
+
 typedef struct collector_provider {
     /* Margo/Argobots/Mercury environment */
     margo_instance_id  mid;                 // Margo instance
@@ -23,10 +32,30 @@ typedef struct collector_provider {
     abt_io_instance_id abtio;               // ABT-IO instance
     /* Resources and backend types */
     size_t               num_metrics;     // number of metrics
+    uint64_t             next_serial;     // serial of the next metric created
     collector_metric*      metrics;         // hash of metrics by id
+    collector_index        index;           // metrics by namespace, name and tag
+    collector_intern       strings;         // namespaces, names and tags of the metrics
+    collector_chunk_pool   chunk_pool;      // chunks shared by the metrics' sample stores
+    collector_slab         metric_slab;     // metrics, packed in cache-line aligned blocks
+    /* Sampler snapshotting the value of sampled metrics */
+    ABT_mutex          sampler_mutex;
+    collector_metric*  sampled_metrics;     // list of metrics with a sampling period
+    ABT_thread         sampler;             // sampler ULT, created with the first sampled metric
+    int                sampler_stop;
     /* RPC identifiers for clients */
     hg_id_t list_metrics_id;
+    hg_id_t list_metrics_ext_id;
     hg_id_t metric_fetch_id;
+    hg_id_t metric_fetch_range_id;
+    hg_id_t metric_fetch_downsampled_id;
+    hg_id_t metric_fetch_columns_id;
+    hg_id_t metric_fetch_since_id;
+    hg_id_t metric_fetch_batch_id;
+    hg_id_t metric_fetch_stats_id;
+    hg_id_t metric_fetch_histogram_id;
+    hg_id_t metric_fetch_sketch_id;
+    hg_id_t query_id;
     /* ... add other RPC identifiers here ... */
     uint8_t use_aggregator;
 #ifdef USE_AGGREGATOR
@@ -35,7 +64,7 @@ typedef struct collector_provider {
 #endif
 } collector_provider;
 
-collector_return_t collector_provider_metric_create(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t tl, collector_metric_t* m, collector_provider_t provider);
+collector_return_t collector_provider_metric_create(const char *ns, const char *name, collector_metric_type_t t, const char *desc, collector_taglist_t tl, const struct collector_metric_args* args, collector_metric_t* m, collector_provider_t provider);
 
 collector_return_t collector_provider_metric_destroy(collector_metric_t m, collector_provider_t provider);
 
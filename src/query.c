@@ -0,0 +1,284 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "query.h"
+
+collector_return_t collector_query_check(double t_start, double t_end, double step, size_t num_aggs, const collector_agg* aggs, size_t* num_windows)
+{
+    double n;
+    size_t a;
+
+    /* written so that NaNs are rejected */
+    if(!isfinite(t_start) || !isfinite(t_end) || !(t_end > t_start) || !(step > 0))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    if(num_aggs == 0 || num_aggs > COLLECTOR_QUERY_MAX_AGGS)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    for(a = 0; a < num_aggs; a++) {
+        if(aggs[a].type < COLLECTOR_AGG_COUNT || aggs[a].type > COLLECTOR_AGG_LAST)
+            return COLLECTOR_ERR_INVALID_ARGS;
+        if(aggs[a].type == COLLECTOR_AGG_QUANTILE && !(aggs[a].q >= 0 && aggs[a].q <= 1))
+            return COLLECTOR_ERR_INVALID_ARGS;
+    }
+    n = ceil((t_end - t_start) / step);
+    if(!(n <= COLLECTOR_QUERY_MAX_WINDOWS))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    *num_windows = n < 1 ? 1 : (size_t)n;
+    return COLLECTOR_SUCCESS;
+}
+
+/* Values of the samples of the current window, for quantiles */
+typedef struct query_values {
+    double* v;
+    size_t  size;
+    size_t  capacity;
+} query_values;
+
+static int values_reserve(query_values* vals, size_t n)
+{
+    size_t capacity;
+    double* v;
+
+    if(vals->size + n <= vals->capacity)
+        return 1;
+    capacity = vals->capacity ? 2*vals->capacity : 1024;
+    while(capacity < vals->size + n)
+        capacity *= 2;
+    v = (double*)realloc(vals->v, capacity*sizeof(double));
+    if(!v)
+        return 0;
+    vals->v = v;
+    vals->capacity = capacity;
+    return 1;
+}
+
+/* Adds the samples of a store whose time is in [t0, t1) to win, and their
+ * values to vals if it isn't NULL. The search starts from *pos, where the
+ * previous window ended, and *pos is set to where this one ends. */
+static collector_return_t window_add(const collector_sample_store* store, double t0, double t1, uint64_t* pos, collector_rollup_bucket* win, query_values* vals)
+{
+    collector_rollup_bucket window;
+    collector_metric_sample last;
+    uint64_t count, first, lo, hi;
+    size_t size = vals ? vals->size : 0;
+
+    for(;;) {
+        memset(&window, 0, sizeof(window));
+        count = collector_store_size(store);
+        first = collector_store_first(store, count);
+        lo = collector_store_lower_bound(store, *pos > first ? *pos : first, count, t0);
+        hi = collector_store_lower_bound(store, lo, count, t1);
+        collector_store_stats(store, lo, hi, INFINITY, &window.acc);
+        if(hi > lo) {
+            last = collector_store_get(store, hi - 1);
+            window.last_time = last.time;
+            window.last      = last.val;
+        }
+        if(vals) {
+            vals->size = size;
+            if(!values_reserve(vals, hi - lo))
+                return COLLECTOR_ERR_ALLOCATION;
+            collector_store_copy_columns(store, lo, hi - lo, COLLECTOR_COLUMN_VAL, NULL, vals->v + size, NULL);
+            vals->size = size + (hi - lo);
+        }
+        /* in ring mode, search again from the oldest sample if the writer
+         * lapped us */
+        if(!collector_store_overwritten(store, lo))
+            break;
+        *pos = 0;
+    }
+
+    *pos = hi;
+    collector_rollup_merge(win, &window);
+    return COLLECTOR_SUCCESS;
+}
+
+/* Returns the k-th smallest of n values, partially reordering them
+ * (quickselect with Hoare partitioning) */
+static double select_kth(double* v, size_t n, size_t k)
+{
+    int64_t lo = 0, hi = (int64_t)n - 1, i, j;
+    double pivot, tmp;
+
+    while(lo < hi) {
+        pivot = v[lo + (hi - lo) / 2];
+        i = lo;
+        j = hi;
+        while(i <= j) {
+            while(v[i] < pivot) i++;
+            while(v[j] > pivot) j--;
+            if(i <= j) {
+                tmp = v[i]; v[i] = v[j]; v[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if((int64_t)k <= j)
+            hi = j;
+        else if((int64_t)k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return v[k];
+}
+
+static double agg_value(const collector_agg* agg, const collector_rollup_bucket* win, query_values* vals)
+{
+    const collector_stats_acc* acc = &win->acc;
+    size_t rank;
+
+    switch(agg->type) {
+    case COLLECTOR_AGG_COUNT:
+        return (double)acc->count;
+    case COLLECTOR_AGG_SUM:
+        return acc->sum;
+    case COLLECTOR_AGG_MIN:
+        return acc->count ? acc->min : NAN;
+    case COLLECTOR_AGG_MAX:
+        return acc->count ? acc->max : NAN;
+    case COLLECTOR_AGG_AVG:
+        return acc->count ? acc->mean : NAN;
+    case COLLECTOR_AGG_STDDEV:
+        return acc->count ? sqrt(acc->m2 / acc->count) : NAN;
+    case COLLECTOR_AGG_QUANTILE:
+        if(!vals->size)
+            return NAN;
+        /* nearest rank: the smallest value such that a fraction q of the
+         * values are lower or equal */
+        rank = (size_t)ceil(agg->q * vals->size);
+        return select_kth(vals->v, vals->size, rank ? rank - 1 : 0);
+    case COLLECTOR_AGG_LAST:
+        return acc->count ? win->last : NAN;
+    }
+    return NAN;
+}
+
+collector_return_t collector_query_aggregate(collector_metric* const* metrics, size_t num_metrics, double t_start, double t_end, double step, size_t num_windows, const collector_agg* aggs, size_t num_aggs, double* values)
+{
+    collector_return_t ret = COLLECTOR_SUCCESS;
+    collector_sample_store** stores;
+    query_values vals = { NULL, 0, 0 };
+    collector_rollup_bucket* windows = NULL;
+    collector_rollup_bucket win;
+    uint64_t* pos;
+    size_t num_stores = 0, i, w, a;
+    int need_vals = 0;
+    double t0, t1;
+
+    for(a = 0; a < num_aggs; a++) {
+        if(aggs[a].type == COLLECTOR_AGG_QUANTILE)
+            need_vals = 1;
+    }
+
+    stores = (collector_sample_store**)malloc((num_metrics ? num_metrics : 1)*(COLLECTOR_MAX_SHARDS+1)*sizeof(*stores));
+    pos = (uint64_t*)calloc((num_metrics ? num_metrics : 1)*(COLLECTOR_MAX_SHARDS+1), sizeof(*pos));
+    if(!stores || !pos) {
+        ret = COLLECTOR_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(i = 0; i < num_metrics; i++)
+        num_stores += collector_metric_stores(metrics[i], stores + num_stores);
+
+    /* the samples that left the rings are in the rollups, which can't
+     * answer quantiles (they are merged before reading the stores, so that
+     * a sample leaving a ring meanwhile is missed rather than counted twice) */
+    for(i = 0; i < num_metrics && !need_vals; i++) {
+        if(!metrics[i]->rollup)
+            continue;
+        if(!windows && !(windows = (collector_rollup_bucket*)calloc(num_windows, sizeof(*windows)))) {
+            ret = COLLECTOR_ERR_ALLOCATION;
+            goto finish;
+        }
+        collector_rollup_windows(metrics[i]->rollup, t_start, t_end, step, num_windows, windows);
+    }
+
+    for(w = 0; w < num_windows; w++) {
+        /* the end of a window is computed like the start of the next one,
+         * so that no sample falls between them */
+        t0 = t_start + w*step;
+        t1 = t_start + (w+1)*step;
+        if(w + 1 == num_windows || t1 > t_end)
+            t1 = t_end;
+        if(windows)
+            win = windows[w];
+        else
+            memset(&win, 0, sizeof(win));
+        vals.size = 0;
+        for(i = 0; i < num_stores; i++) {
+            ret = window_add(stores[i], t0, t1, &pos[i], &win, need_vals ? &vals : NULL);
+            if(ret != COLLECTOR_SUCCESS)
+                goto finish;
+        }
+        for(a = 0; a < num_aggs; a++)
+            values[w*num_aggs + a] = agg_value(&aggs[a], &win, &vals);
+    }
+
+finish:
+    free(windows);
+    free(vals.v);
+    free(pos);
+    free(stores);
+    return ret;
+}
+
+typedef struct query_member {
+    uint32_t          label;
+    collector_metric* metric;
+} query_member;
+
+static int compare_members(const void* a, const void* b)
+{
+    const query_member* x = (const query_member*)a;
+    const query_member* y = (const query_member*)b;
+    if(x->label != y->label)
+        return x->label < y->label ? -1 : 1;
+    return x->metric->serial < y->metric->serial ? -1 : x->metric->serial > y->metric->serial;
+}
+
+collector_return_t collector_query_group_by(const collector_intern* strings, uint32_t key, collector_metric** metrics, size_t num_metrics, collector_query_group** groups, size_t* num_groups)
+{
+    query_member* members;
+    collector_query_group* g;
+    size_t i, n = 0;
+
+    *groups = NULL;
+    *num_groups = 0;
+    if(num_metrics == 0)
+        return COLLECTOR_SUCCESS;
+
+    members = (query_member*)malloc(num_metrics*sizeof(*members));
+    g = (collector_query_group*)malloc(num_metrics*sizeof(*g));
+    if(!members || !g) {
+        free(members);
+        free(g);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+
+    /* a key that isn't interned is the key of no label */
+    for(i = 0; i < num_metrics; i++) {
+        members[i].label  = key ? collector_labelset_find_key(strings, metrics[i]->cold->labels, key) : 0;
+        members[i].metric = metrics[i];
+    }
+    qsort(members, num_metrics, sizeof(*members), compare_members);
+
+    for(i = 0; i < num_metrics; i++) {
+        metrics[i] = members[i].metric;
+        if(i == 0 || members[i].label != members[i-1].label) {
+            g[n].label = members[i].label;
+            g[n].first = i;
+            g[n].count = 0;
+            n += 1;
+        }
+        g[n-1].count += 1;
+    }
+
+    free(members);
+    *groups = g;
+    *num_groups = n;
+    return COLLECTOR_SUCCESS;
+}
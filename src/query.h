@@ -0,0 +1,47 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __QUERY_H
+#define __QUERY_H
+
+#include "types.h"
+#include "intern.h"
+
+/**
+ * @brief Checks the arguments of a query and sets *num_windows to the
+ * number of windows of length step that cover [t_start, t_end).
+ */
+collector_return_t collector_query_check(double t_start, double t_end, double step, size_t num_aggs, const collector_agg* aggs, size_t* num_windows);
+
+/**
+ * @brief Aggregates the samples of a set of metrics over the windows
+ * [t_start + w*step, t_start + (w+1)*step), the last one ending at t_end:
+ * values[w*num_aggs + a] is aggregation a over window w. The windows are
+ * visited in order, each store being searched from where the previous
+ * window ended, and only the values of the current window are copied
+ * (for quantiles). Without quantiles, the rollups of the metrics are
+ * merged into the windows first (see collector_rollup_windows).
+ */
+collector_return_t collector_query_aggregate(collector_metric* const* metrics, size_t num_metrics, double t_start, double t_end, double step, size_t num_windows, const collector_agg* aggs, size_t num_aggs, double* values);
+
+/**
+ * @brief Group of metrics metrics[first] to metrics[first+count-1] having
+ * the same label (0 if they don't have the key).
+ */
+typedef struct collector_query_group {
+    uint32_t label;
+    size_t   first;
+    size_t   count;
+} collector_query_group;
+
+/**
+ * @brief Sorts metrics by their label with the given key (in creation
+ * order within a label) and splits them into groups.
+ *
+ * @param[out] groups array to free, or NULL if num_groups is 0
+ */
+collector_return_t collector_query_group_by(const collector_intern* strings, uint32_t key, collector_metric** metrics, size_t num_metrics, collector_query_group** groups, size_t* num_groups);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "collector/collector-metric.h"
+#include "rollup.h"
+
+collector_return_t collector_rollup_create(const struct collector_rollup_tier_args* tiers, size_t num_tiers, collector_rollup** rollup)
+{
+    collector_rollup* r;
+    double capacity;
+    size_t i;
+
+    if(num_tiers == 0 || num_tiers > COLLECTOR_ROLLUP_MAX_TIERS || !tiers)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    /* written so that NaNs are rejected */
+    for(i = 0; i < num_tiers; i++) {
+        if(!(tiers[i].resolution > 0) || !isfinite(tiers[i].resolution) || !(tiers[i].retention >= tiers[i].resolution))
+            return COLLECTOR_ERR_INVALID_ARGS;
+        if(i && !(tiers[i].resolution > tiers[i-1].resolution))
+            return COLLECTOR_ERR_INVALID_ARGS;
+        capacity = ceil(tiers[i].retention / tiers[i].resolution);
+        if(!(capacity <= COLLECTOR_ROLLUP_MAX_BUCKETS))
+            return COLLECTOR_ERR_INVALID_ARGS;
+    }
+
+    r = (collector_rollup*)calloc(1, sizeof(*r) + num_tiers*sizeof(collector_rollup_tier));
+    if(!r)
+        return COLLECTOR_ERR_ALLOCATION;
+    r->num_tiers = num_tiers;
+    for(i = 0; i < num_tiers; i++) {
+        r->tiers[i].resolution = tiers[i].resolution;
+        r->tiers[i].capacity   = (uint64_t)ceil(tiers[i].retention / tiers[i].resolution);
+        r->tiers[i].buckets    = (collector_rollup_bucket*)malloc(r->tiers[i].capacity*sizeof(collector_rollup_bucket));
+        if(!r->tiers[i].buckets) {
+            collector_rollup_destroy(r);
+            return COLLECTOR_ERR_ALLOCATION;
+        }
+    }
+    if(ABT_mutex_create(&r->mutex) != ABT_SUCCESS) {
+        r->mutex = ABT_MUTEX_NULL;
+        collector_rollup_destroy(r);
+        return COLLECTOR_ERR_FROM_ARGOBOTS;
+    }
+    *rollup = r;
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_rollup_destroy(collector_rollup* rollup)
+{
+    size_t i;
+
+    if(!rollup)
+        return;
+    for(i = 0; i < rollup->num_tiers; i++)
+        free(rollup->tiers[i].buckets);
+    if(rollup->mutex != ABT_MUTEX_NULL)
+        ABT_mutex_free(&rollup->mutex);
+    free(rollup);
+}
+
+/* Adds a bucket (or a sample, as a bucket of one sample) to the open
+ * bucket of tier i, closing it first if b starts in a later bucket */
+static void tier_add(collector_rollup* r, size_t i, const collector_rollup_bucket* b)
+{
+    collector_rollup_tier* tier = &r->tiers[i];
+    double time = floor(b->time / tier->resolution) * tier->resolution;
+    collector_rollup_bucket* slot;
+
+    if(tier->open.acc.count && time > tier->open.time) {
+        slot = &tier->buckets[tier->count % tier->capacity];
+        /* the bucket overwritten by the closed one moves to the next tier */
+        if(tier->count >= tier->capacity && i + 1 < r->num_tiers)
+            tier_add(r, i + 1, slot);
+        *slot = tier->open;
+        tier->count += 1;
+        tier->open.acc.count = 0;
+    }
+    if(tier->open.acc.count == 0) {
+        memset(&tier->open, 0, sizeof(tier->open));
+        tier->open.time = time;
+    }
+    collector_rollup_merge(&tier->open, b);
+}
+
+void collector_rollup_age(collector_rollup* rollup, const collector_sample_store* store)
+{
+    uint64_t first = collector_store_first(store, collector_store_size(store));
+    collector_rollup_bucket b;
+    collector_metric_sample s;
+
+    if(rollup->aged >= first)
+        return;
+    ABT_mutex_lock(rollup->mutex);
+    for(; rollup->aged < first; rollup->aged++) {
+        s = collector_store_get(store, rollup->aged);
+        b.time          = s.time;
+        b.last_time     = s.time;
+        b.last          = s.val;
+        b.acc.count     = 1;
+        b.acc.num_above = 0;
+        b.acc.min       = s.val;
+        b.acc.max       = s.val;
+        b.acc.sum       = s.val;
+        b.acc.mean      = s.val;
+        b.acc.m2        = 0;
+        tier_add(rollup, 0, &b);
+    }
+    ABT_mutex_unlock(rollup->mutex);
+}
+
+static inline void window_merge(double t_start, double step, size_t num_windows, collector_rollup_bucket* windows, const collector_rollup_bucket* b)
+{
+    size_t w = (size_t)((b->time - t_start) / step);
+    if(w >= num_windows)
+        w = num_windows - 1;
+    collector_rollup_merge(&windows[w], b);
+}
+
+void collector_rollup_windows(collector_rollup* rollup, double t_start, double t_end, double step, size_t num_windows, collector_rollup_bucket* windows)
+{
+    collector_rollup_tier* tier;
+    const collector_rollup_bucket* b;
+    uint64_t lo, hi, mid;
+    size_t i;
+
+    ABT_mutex_lock(rollup->mutex);
+    for(i = 0; i < rollup->num_tiers; i++) {
+        tier = &rollup->tiers[i];
+        if(tier->resolution > step)
+            break;
+        /* closed buckets are sorted by time: find the first one in range */
+        lo = tier->count > tier->capacity ? tier->count - tier->capacity : 0;
+        hi = tier->count;
+        while(lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if(tier->buckets[mid % tier->capacity].time < t_start)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for(; lo < tier->count; lo++) {
+            b = &tier->buckets[lo % tier->capacity];
+            if(b->time >= t_end)
+                break;
+            window_merge(t_start, step, num_windows, windows, b);
+        }
+        b = &tier->open;
+        if(b->acc.count && b->time >= t_start && b->time < t_end)
+            window_merge(t_start, step, num_windows, windows, b);
+    }
+    ABT_mutex_unlock(rollup->mutex);
+}
@@ -0,0 +1,90 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __ROLLUP_H
+#define __ROLLUP_H
+
+#include <abt.h>
+#include "kernels.h"
+#include "store.h"
+
+struct collector_rollup_tier_args;
+
+/* Largest number of tiers of a metric and of buckets of a tier */
+#define COLLECTOR_ROLLUP_MAX_TIERS   8
+#define COLLECTOR_ROLLUP_MAX_BUCKETS 16777216
+
+/**
+ * @brief Summary of the samples of a bucket of a rollup tier, or of a
+ * query window.
+ */
+typedef struct collector_rollup_bucket {
+    double              time;      /* start of the bucket, a multiple of the resolution */
+    double              last_time; /* time and value of the latest sample */
+    double              last;
+    collector_stats_acc acc;
+} collector_rollup_bucket;
+
+typedef struct collector_rollup_tier {
+    double                   resolution;
+    uint64_t                 capacity; /* buckets retained */
+    uint64_t                 count;    /* buckets closed so far */
+    collector_rollup_bucket  open;     /* bucket being filled, if its count isn't 0 */
+    collector_rollup_bucket* buckets;  /* ring of the latest closed buckets */
+} collector_rollup_tier;
+
+/**
+ * @brief Rollup tiers of a ring-mode store (see collector_rollup_tier_args).
+ *
+ * The tiers are fed by the writer of the store, after each append, with
+ * the samples that left the ring: a sample is added to the open bucket
+ * of the first tier, which is closed when a sample falls in a later
+ * bucket, and the closed bucket that a full tier evicts is added to the
+ * next tier in the same way. The tiers thus summarize disjoint, older
+ * and older parts of the samples, each one bucket at a time.
+ */
+typedef struct collector_rollup {
+    ABT_mutex             mutex; /* between the writer and queries */
+    uint64_t              aged;  /* samples of the store added to the first tier */
+    size_t                num_tiers;
+    collector_rollup_tier tiers[];
+} collector_rollup;
+
+/**
+ * @brief Checks the tiers of a metric's arguments and creates its rollup.
+ */
+collector_return_t collector_rollup_create(const struct collector_rollup_tier_args* tiers, size_t num_tiers, collector_rollup** rollup);
+
+void collector_rollup_destroy(collector_rollup* rollup);
+
+/**
+ * @brief Adds the samples that left a ring-mode store since the previous
+ * call to the first tier. Called by the writer of the store, which hasn't
+ * overwritten them yet, after each append.
+ */
+void collector_rollup_age(collector_rollup* rollup, const collector_sample_store* store);
+
+/**
+ * @brief Merges the buckets of the tiers with a resolution of at most
+ * step that start in [t_start, t_end) into windows[w] for the window
+ * [t_start + w*step, t_start + (w+1)*step) of their start.
+ */
+void collector_rollup_windows(collector_rollup* rollup, double t_start, double t_end, double step, size_t num_windows, collector_rollup_bucket* windows);
+
+/**
+ * @brief Merges bucket b into bucket a.
+ */
+static inline void collector_rollup_merge(collector_rollup_bucket* a, const collector_rollup_bucket* b)
+{
+    if(b->acc.count == 0)
+        return;
+    if(a->acc.count == 0 || b->last_time >= a->last_time) {
+        a->last_time = b->last_time;
+        a->last      = b->last;
+    }
+    collector_stats_merge(&a->acc, &b->acc);
+}
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "sketch.h"
+
+/* Serialized sketch: a header followed by num_entries (key, count) pairs
+ * for the non-empty bins. Fields are in host byte order. */
+#define COLLECTOR_SKETCH_MAGIC   0x4b534444 /* "DDSK" */
+#define COLLECTOR_SKETCH_VERSION 1
+
+typedef struct sketch_header {
+    uint32_t magic;
+    uint32_t version;
+    double   relative_accuracy;
+    double   min_value;
+    uint64_t zero_count;
+    uint64_t num_entries;
+} sketch_header;
+
+typedef struct sketch_entry {
+    int64_t  key;
+    uint64_t count;
+} sketch_entry;
+
+static collector_return_t sketch_alloc(double relative_accuracy, double min_value, collector_sketch_t* sketch)
+{
+    if(!(relative_accuracy > 0 && relative_accuracy < 1) || !(min_value > 0))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    collector_sketch_t s = (collector_sketch_t)calloc(1, sizeof(*s));
+    if(!s)
+        return COLLECTOR_ERR_ALLOCATION;
+    s->relative_accuracy = relative_accuracy;
+    s->gamma_ln  = log((1 + relative_accuracy) / (1 - relative_accuracy));
+    s->min_value = min_value;
+    *sketch = s;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_sketch_create(double relative_accuracy, collector_sketch_t* sketch)
+{
+    return sketch_alloc(relative_accuracy, COLLECTOR_SKETCH_MIN_VALUE, sketch);
+}
+
+collector_return_t collector_sketch_create_fixed(double relative_accuracy, double min_value, double max_value, collector_sketch_t* sketch)
+{
+    collector_return_t ret;
+
+    if(!(max_value > min_value))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    ret = sketch_alloc(relative_accuracy, min_value, sketch);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+
+    collector_sketch_t s = *sketch;
+    s->fixed      = 1;
+    s->key_offset = collector_sketch_key(s, min_value);
+    s->num_bins   = collector_sketch_key(s, max_value) - s->key_offset + 1;
+    s->bins       = (uint64_t*)calloc(s->num_bins, sizeof(uint64_t));
+    if(!s->bins) {
+        free(s);
+        return COLLECTOR_ERR_ALLOCATION;
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_sketch_destroy(collector_sketch_t sketch)
+{
+    if(sketch == COLLECTOR_SKETCH_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    free(sketch->bins);
+    free(sketch);
+    return COLLECTOR_SUCCESS;
+}
+
+/* Makes the bins of a non-fixed sketch cover keys [lo, hi] */
+static collector_return_t sketch_extend(collector_sketch_t sketch, int64_t lo, int64_t hi)
+{
+    int64_t  new_offset, new_end;
+    size_t   new_num_bins;
+    uint64_t* new_bins;
+
+    if(sketch->num_bins) {
+        new_offset = lo < sketch->key_offset ? lo : sketch->key_offset;
+        new_end    = (int64_t)sketch->key_offset + (int64_t)sketch->num_bins - 1;
+        new_end    = hi > new_end ? hi : new_end;
+    } else {
+        new_offset = lo;
+        new_end    = hi;
+    }
+    new_num_bins = (size_t)(new_end - new_offset + 1);
+    if(new_offset == sketch->key_offset && new_num_bins == sketch->num_bins)
+        return COLLECTOR_SUCCESS;
+
+    new_bins = (uint64_t*)calloc(new_num_bins, sizeof(uint64_t));
+    if(!new_bins)
+        return COLLECTOR_ERR_ALLOCATION;
+    if(sketch->num_bins)
+        memcpy(new_bins + (sketch->key_offset - new_offset), sketch->bins,
+               sketch->num_bins*sizeof(uint64_t));
+    free(sketch->bins);
+    sketch->bins       = new_bins;
+    sketch->num_bins   = new_num_bins;
+    sketch->key_offset = (int32_t)new_offset;
+    return COLLECTOR_SUCCESS;
+}
+
+/* Adds count to the bin of key, clamping the key into the range of fixed sketches */
+static void sketch_add(collector_sketch_t sketch, int64_t key, uint64_t count)
+{
+    int64_t index = key - sketch->key_offset;
+    if(index < 0)
+        index = 0;
+    else if(index >= (int64_t)sketch->num_bins)
+        index = sketch->num_bins - 1;
+    sketch->bins[index] += count;
+}
+
+static int same_accuracy(const collector_sketch* a, double relative_accuracy)
+{
+    return fabs(a->relative_accuracy - relative_accuracy) <= 1e-12;
+}
+
+collector_return_t collector_sketch_merge(collector_sketch_t dst, collector_sketch_t src)
+{
+    size_t i, first = 0, last = 0;
+    int empty = 1;
+    collector_return_t ret;
+
+    if(dst == COLLECTOR_SKETCH_NULL || src == COLLECTOR_SKETCH_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+    if(!same_accuracy(dst, src->relative_accuracy))
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    for(i = 0; i < src->num_bins; i++) {
+        if(!src->bins[i]) continue;
+        if(empty) first = i;
+        last = i;
+        empty = 0;
+    }
+    if(!empty) {
+        if(!dst->fixed) {
+            ret = sketch_extend(dst, (int64_t)src->key_offset + first, (int64_t)src->key_offset + last);
+            if(ret != COLLECTOR_SUCCESS)
+                return ret;
+        }
+        for(i = first; i <= last; i++) {
+            if(src->bins[i])
+                sketch_add(dst, (int64_t)src->key_offset + i, src->bins[i]);
+        }
+    }
+    dst->zero_count += src->zero_count;
+    return COLLECTOR_SUCCESS;
+}
+
+uint64_t collector_sketch_count(collector_sketch_t sketch)
+{
+    uint64_t count = sketch->zero_count;
+    size_t i;
+    for(i = 0; i < sketch->num_bins; i++)
+        count += sketch->bins[i];
+    return count;
+}
+
+collector_return_t collector_sketch_quantile(collector_sketch_t sketch, double q, double* value)
+{
+    uint64_t count, rank, seen;
+    size_t i;
+
+    if(sketch == COLLECTOR_SKETCH_NULL || !(q >= 0 && q <= 1))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    count = collector_sketch_count(sketch);
+    if(count == 0)
+        return COLLECTOR_ERR_INVALID_VALUE;
+
+    rank = (uint64_t)(q*(count - 1));
+    seen = sketch->zero_count;
+    if(rank < seen) {
+        *value = 0;
+        return COLLECTOR_SUCCESS;
+    }
+    for(i = 0; i < sketch->num_bins; i++) {
+        seen += sketch->bins[i];
+        if(rank < seen)
+            break;
+    }
+    /* the bin of key k holds (gamma^(k-1), gamma^k], whose value with
+     * the lowest relative error is 2*gamma^k/(gamma+1) */
+    double gamma = exp(sketch->gamma_ln);
+    *value = 2*exp(((int64_t)sketch->key_offset + (int64_t)i)*sketch->gamma_ln)/(gamma + 1);
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_sketch_serialize(collector_sketch_t sketch, void** buf, size_t* size)
+{
+    sketch_header header;
+    sketch_entry* entries;
+    size_t i;
+
+    if(sketch == COLLECTOR_SKETCH_NULL)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    header.magic             = COLLECTOR_SKETCH_MAGIC;
+    header.version           = COLLECTOR_SKETCH_VERSION;
+    header.relative_accuracy = sketch->relative_accuracy;
+    header.min_value         = sketch->min_value;
+    header.zero_count        = __atomic_load_n(&sketch->zero_count, __ATOMIC_RELAXED);
+    header.num_entries       = 0;
+    for(i = 0; i < sketch->num_bins; i++) {
+        if(__atomic_load_n(&sketch->bins[i], __ATOMIC_RELAXED))
+            header.num_entries += 1;
+    }
+
+    *size = sizeof(header) + header.num_entries*sizeof(sketch_entry);
+    *buf  = malloc(*size);
+    if(!*buf)
+        return COLLECTOR_ERR_ALLOCATION;
+
+    /* bins updated between the two passes are skipped, not overflowed */
+    entries = (sketch_entry*)((char*)(*buf) + sizeof(header));
+    uint64_t n = 0;
+    for(i = 0; i < sketch->num_bins && n < header.num_entries; i++) {
+        uint64_t count = __atomic_load_n(&sketch->bins[i], __ATOMIC_RELAXED);
+        if(!count) continue;
+        entries[n].key   = (int64_t)sketch->key_offset + (int64_t)i;
+        entries[n].count = count;
+        n++;
+    }
+    header.num_entries = n;
+    memcpy(*buf, &header, sizeof(header));
+    *size = sizeof(header) + n*sizeof(sketch_entry);
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_sketch_deserialize(const void* buf, size_t size, collector_sketch_t* sketch)
+{
+    sketch_header header;
+    const sketch_entry* entries;
+    collector_return_t ret;
+    uint64_t i;
+
+    if(!buf || size < sizeof(header))
+        return COLLECTOR_ERR_INVALID_ARGS;
+    memcpy(&header, buf, sizeof(header));
+    /* written so that a large num_entries can't wrap the size */
+    if(header.magic != COLLECTOR_SKETCH_MAGIC || header.version != COLLECTOR_SKETCH_VERSION
+    || header.num_entries > (size - sizeof(header)) / sizeof(sketch_entry))
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    ret = sketch_alloc(header.relative_accuracy, header.min_value, sketch);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    (*sketch)->zero_count = header.zero_count;
+    if(header.num_entries == 0)
+        return COLLECTOR_SUCCESS;
+
+    /* entries are sorted by key */
+    entries = (const sketch_entry*)((const char*)buf + sizeof(header));
+    ret = sketch_extend(*sketch, entries[0].key, entries[header.num_entries-1].key);
+    if(ret != COLLECTOR_SUCCESS) {
+        collector_sketch_destroy(*sketch);
+        return ret;
+    }
+    for(i = 0; i < header.num_entries; i++)
+        sketch_add(*sketch, entries[i].key, entries[i].count);
+    return COLLECTOR_SUCCESS;
+}
@@ -0,0 +1,67 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __SKETCH_H
+#define __SKETCH_H
+
+#include <math.h>
+#include "collector/collector-sketch.h"
+
+/* Range of values distinguished by a sketch by default */
+#define COLLECTOR_SKETCH_MIN_VALUE 1e-9
+#define COLLECTOR_SKETCH_MAX_VALUE 1e9
+
+/**
+ * @brief DDSketch with a dense array of bins. Value x > min_value falls in
+ * the bin of key ceil(log_gamma(x)), with gamma = (1+a)/(1-a); the values
+ * lower than min_value (including 0 and negative values) are counted in
+ * zero_count.
+ *
+ * The sketch of a metric has a fixed key range, covering [min_value,
+ * max_value], so that updates are a single atomic increment; values out
+ * of that range are clamped to the first or last bin. Sketches created on
+ * the client side grow their range as they are merged into.
+ */
+typedef struct collector_sketch {
+    double    relative_accuracy;
+    double    gamma_ln;       /* ln((1+a)/(1-a)) */
+    double    min_value;
+    int32_t   key_offset;     /* key of bins[0] */
+    size_t    num_bins;
+    uint64_t* bins;
+    uint64_t  zero_count;
+    int       fixed;          /* key range can't grow, updated atomically */
+} collector_sketch;
+
+/**
+ * @brief Creates a sketch with a fixed key range, for a metric.
+ */
+collector_return_t collector_sketch_create_fixed(double relative_accuracy, double min_value, double max_value, collector_sketch_t* sketch);
+
+static inline int32_t collector_sketch_key(const collector_sketch* sketch, double val)
+{
+    return (int32_t)ceil(log(val) / sketch->gamma_ln);
+}
+
+/**
+ * @brief Adds a value to a fixed sketch (lock-free).
+ */
+static inline void collector_sketch_update(collector_sketch* sketch, double val)
+{
+    int64_t index;
+
+    if(!(val >= sketch->min_value)) {
+        __atomic_fetch_add(&sketch->zero_count, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    index = (int64_t)collector_sketch_key(sketch, val) - sketch->key_offset;
+    if(index < 0)
+        index = 0;
+    else if(index >= (int64_t)sketch->num_bins)
+        index = sketch->num_bins - 1;
+    __atomic_fetch_add(&sketch->bins[index], 1, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+#include "store.h"
+
+collector_return_t collector_slab_init(collector_slab* slab, size_t object_size, size_t objects_per_block)
+{
+    memset(slab, 0, sizeof(*slab));
+    if(object_size < sizeof(void*))
+        object_size = sizeof(void*);
+    slab->object_size = (object_size + COLLECTOR_CACHE_LINE_SIZE - 1) & ~(size_t)(COLLECTOR_CACHE_LINE_SIZE - 1);
+    slab->objects_per_block = objects_per_block ? objects_per_block : 1;
+    if(ABT_mutex_create(&slab->mutex) != ABT_SUCCESS)
+        return COLLECTOR_ERR_FROM_ARGOBOTS;
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_slab_finalize(collector_slab* slab)
+{
+    void* block = slab->blocks;
+    while(block) {
+        void* next = *(void**)block;
+        free(block);
+        block = next;
+    }
+    slab->blocks = NULL;
+    slab->free_list = NULL;
+    slab->num_free = 0;
+    ABT_mutex_free(&slab->mutex);
+}
+
+void* collector_slab_alloc(collector_slab* slab)
+{
+    void* obj = NULL;
+    size_t i;
+
+    ABT_mutex_spinlock(slab->mutex);
+    if(!slab->free_list) {
+        /* the first slot of a block links it to the previous one */
+        char* block = (char*)aligned_alloc(COLLECTOR_CACHE_LINE_SIZE,
+                                           (slab->objects_per_block + 1)*slab->object_size);
+        if(!block) {
+            ABT_mutex_unlock(slab->mutex);
+            return NULL;
+        }
+        *(void**)block = slab->blocks;
+        slab->blocks = block;
+        for(i = slab->objects_per_block; i > 0; i--) {
+            void* o = block + i*slab->object_size;
+            *(void**)o = slab->free_list;
+            slab->free_list = o;
+        }
+        slab->num_free += slab->objects_per_block;
+        slab->num_allocated += slab->objects_per_block;
+    }
+    obj = slab->free_list;
+    slab->free_list = *(void**)obj;
+    slab->num_free -= 1;
+    ABT_mutex_unlock(slab->mutex);
+
+    memset(obj, 0, slab->object_size);
+    return obj;
+}
+
+void collector_slab_free(collector_slab* slab, void* obj)
+{
+    if(!obj)
+        return;
+    ABT_mutex_spinlock(slab->mutex);
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->num_free += 1;
+    ABT_mutex_unlock(slab->mutex);
+}
@@ -0,0 +1,41 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include <stddef.h>
+#include <abt.h>
+#include "collector/collector-common.h"
+
+/**
+ * @brief Allocator of fixed-size objects, carved out of cache-line
+ * aligned blocks. Objects are rounded up to a multiple of the cache
+ * line size, so that objects packed in the same block never share a
+ * cache line, and freed objects are reused before allocating new blocks.
+ * Blocks are only released when the slab is finalized.
+ */
+typedef struct collector_slab {
+    ABT_mutex mutex;
+    size_t    object_size;
+    size_t    objects_per_block;
+    void*     blocks;     /* list of blocks, linked through their first slot */
+    void*     free_list;  /* list of free objects, linked through their first word */
+    size_t    num_free;
+    size_t    num_allocated;
+} collector_slab;
+
+collector_return_t collector_slab_init(collector_slab* slab, size_t object_size, size_t objects_per_block);
+
+void collector_slab_finalize(collector_slab* slab);
+
+/**
+ * @brief Returns a zeroed object, or NULL on allocation error.
+ */
+void* collector_slab_alloc(collector_slab* slab);
+
+void collector_slab_free(collector_slab* slab, void* obj);
+
+#endif
@@ -0,0 +1,929 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "store.h"
+
+/* Initial number of slots in a chunk directory */
+#define COLLECTOR_CHUNK_DIR_INIT 8
+
+/* Number of values of a row store gathered at a time for the kernels */
+#define COLLECTOR_STORE_GATHER 512
+
+collector_return_t collector_chunk_pool_init(collector_chunk_pool* pool, margo_instance_id mid)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->mid = mid;
+    if(ABT_mutex_create(&pool->mutex) != ABT_SUCCESS)
+        return COLLECTOR_ERR_FROM_ARGOBOTS;
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_chunk_pool_finalize(collector_chunk_pool* pool)
+{
+    collector_chunk* chunk = pool->free_list;
+    while(chunk) {
+        collector_chunk* next = chunk->next;
+        if(chunk->bulk != HG_BULK_NULL)
+            margo_bulk_free(chunk->bulk);
+        free(chunk);
+        chunk = next;
+    }
+    pool->free_list = NULL;
+    pool->num_free = 0;
+    ABT_mutex_free(&pool->mutex);
+}
+
+collector_chunk* collector_chunk_pool_get(collector_chunk_pool* pool)
+{
+    collector_chunk* chunk = NULL;
+
+    ABT_mutex_spinlock(pool->mutex);
+    if(pool->free_list) {
+        chunk = pool->free_list;
+        pool->free_list = chunk->next;
+        pool->num_free -= 1;
+    }
+    ABT_mutex_unlock(pool->mutex);
+
+    if(!chunk) {
+        /* no calloc: pages are only touched as samples get written */
+        chunk = (collector_chunk*)malloc(sizeof(*chunk));
+        if(!chunk) return NULL;
+        chunk->bulk = HG_BULK_NULL;
+        ABT_mutex_spinlock(pool->mutex);
+        pool->num_allocated += 1;
+        ABT_mutex_unlock(pool->mutex);
+    }
+    chunk->next = NULL;
+    return chunk;
+}
+
+void collector_chunk_pool_put(collector_chunk_pool* pool, collector_chunk* chunk)
+{
+    ABT_mutex_spinlock(pool->mutex);
+    chunk->next = pool->free_list;
+    pool->free_list = chunk;
+    pool->num_free += 1;
+    ABT_mutex_unlock(pool->mutex);
+}
+
+hg_bulk_t collector_chunk_bulk(collector_chunk_pool* pool, collector_chunk* chunk)
+{
+    hg_bulk_t bulk = __atomic_load_n(&chunk->bulk, __ATOMIC_ACQUIRE);
+    hg_bulk_t expected = HG_BULK_NULL;
+    void*     ptr  = chunk->samples;
+    hg_size_t size = sizeof(chunk->samples);
+
+    if(bulk != HG_BULK_NULL)
+        return bulk;
+    if(margo_bulk_create(pool->mid, 1, &ptr, &size, HG_BULK_READ_ONLY, &bulk) != HG_SUCCESS)
+        return HG_BULK_NULL;
+    /* another ULT may have registered the chunk in the meantime */
+    if(!__atomic_compare_exchange_n(&chunk->bulk, &expected, bulk, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        margo_bulk_free(bulk);
+        bulk = expected;
+    }
+    return bulk;
+}
+
+/* The packed chunks of a compressed store's directory follow its chunks */
+static collector_chunk_dir* chunk_dir_create(size_t capacity, int compressed)
+{
+    collector_chunk_dir* dir = (collector_chunk_dir*)calloc(1,
+            sizeof(*dir) + capacity*sizeof(collector_chunk*)
+            + (compressed ? capacity*sizeof(collector_packed_chunk*) : 0));
+    if(!dir)
+        return NULL;
+    dir->capacity = capacity;
+    if(compressed)
+        dir->packed = (collector_packed_chunk**)(dir->chunks + capacity);
+    return dir;
+}
+
+collector_return_t collector_store_init(collector_sample_store* store, collector_chunk_pool* pool, uint64_t max_samples, int columnar, int compressed)
+{
+    size_t capacity = COLLECTOR_CHUNK_DIR_INIT;
+
+    /* chunks are reused in place in ring mode */
+    if(compressed && max_samples)
+        return COLLECTOR_ERR_INVALID_ARGS;
+
+    /* in ring mode the directory never grows: one spare chunk is kept
+     * so that appending never clobbers one of the retained samples */
+    if(max_samples)
+        capacity = (max_samples + COLLECTOR_CHUNK_SAMPLES - 1) / COLLECTOR_CHUNK_SAMPLES + 1;
+
+    store->pool        = pool;
+    store->count       = 0;
+    store->max_samples = max_samples;
+    store->columnar    = columnar ? 1 : 0;
+    store->compressed  = compressed ? 1 : 0;
+    store->dir         = chunk_dir_create(capacity, compressed);
+    if(!store->dir)
+        return COLLECTOR_ERR_ALLOCATION;
+    return COLLECTOR_SUCCESS;
+}
+
+void collector_store_destroy(collector_sample_store* store)
+{
+    collector_chunk_dir* dir = store->dir;
+    uint64_t num_chunks = (store->count + COLLECTOR_CHUNK_SAMPLES - 1) / COLLECTOR_CHUNK_SAMPLES;
+    uint64_t i;
+
+    if(num_chunks > dir->capacity)
+        num_chunks = dir->capacity; /* ring mode wrapped around */
+    for(i = 0; i < num_chunks; i++) {
+        if(dir->chunks[i])
+            collector_chunk_pool_put(store->pool, dir->chunks[i]);
+        if(dir->packed && dir->packed[i]) {
+            __atomic_fetch_sub(&store->pool->packed_bytes, dir->packed[i]->num_words*sizeof(uint64_t), __ATOMIC_RELAXED);
+            free(dir->packed[i]);
+        }
+    }
+
+    while(dir) {
+        collector_chunk_dir* prev = dir->prev;
+        free(dir);
+        dir = prev;
+    }
+    store->dir   = NULL;
+    store->count = 0;
+}
+
+/* Encodes a full chunk, or returns NULL if it doesn't get smaller */
+static collector_packed_chunk* chunk_pack(const collector_sample_store* store, const collector_chunk* chunk)
+{
+    size_t capacity = COLLECTOR_CHUNK_SAMPLES*sizeof(collector_metric_sample)/sizeof(uint64_t);
+    collector_packed_chunk* p = (collector_packed_chunk*)malloc(sizeof(*p) + capacity*sizeof(uint64_t));
+    collector_packed_chunk* shrunk;
+    collector_gorilla_encoder enc;
+    size_t k;
+    int ok = 1;
+
+    if(!p)
+        return NULL;
+    collector_gorilla_encoder_init(&enc, p->words, capacity);
+    for(k = 0; ok && k < COLLECTOR_CHUNK_SAMPLES; k++) {
+        if(store->columnar)
+            ok = collector_gorilla_put(&enc, chunk->columns.time[k], chunk->columns.val[k], chunk->columns.sample_id[k]);
+        else
+            ok = collector_gorilla_put(&enc, chunk->samples[k].time, chunk->samples[k].val, chunk->samples[k].sample_id);
+    }
+    if(!ok) {
+        free(p);
+        return NULL;
+    }
+    p->num_words = collector_gorilla_words(&enc);
+    shrunk = (collector_packed_chunk*)realloc(p, sizeof(*p) + p->num_words*sizeof(uint64_t));
+    return shrunk ? shrunk : p;
+}
+
+/* Replaces full chunk c of a compressed store by its packed version in
+ * the directory and in the retired ones, then recycles the raw chunk:
+ * readers holding it find the packed chunk when they check it afterwards.
+ * A chunk that doesn't compress stays as it is. */
+static void store_seal(collector_sample_store* store, collector_chunk_dir* dir, uint64_t c)
+{
+    collector_chunk* chunk = dir->chunks[c];
+    collector_packed_chunk* p = chunk_pack(store, chunk);
+    collector_chunk_dir* d;
+
+    if(!p)
+        return;
+    __atomic_fetch_add(&store->pool->packed_bytes, p->num_words*sizeof(uint64_t), __ATOMIC_RELAXED);
+    for(d = dir; d && c < d->capacity; d = d->prev)
+        __atomic_store_n(&d->packed[c], p, __ATOMIC_RELEASE);
+    for(d = dir; d && c < d->capacity; d = d->prev)
+        __atomic_store_n(&d->chunks[c], NULL, __ATOMIC_RELEASE);
+    collector_chunk_pool_put(store->pool, chunk);
+}
+
+collector_return_t collector_store_append(collector_sample_store* store, double time, double val, uint64_t sample_id)
+{
+    uint64_t index = store->count;
+    uint64_t c     = index / COLLECTOR_CHUNK_SAMPLES;
+    collector_chunk_dir* dir = store->dir;
+
+    if(store->max_samples) {
+        /* ring mode: chunks are allocated during the first lap only */
+        c %= dir->capacity;
+        if(index % COLLECTOR_CHUNK_SAMPLES == 0 && index < dir->capacity*COLLECTOR_CHUNK_SAMPLES) {
+            collector_chunk* chunk = collector_chunk_pool_get(store->pool);
+            if(!chunk)
+                return COLLECTOR_ERR_ALLOCATION;
+            dir->chunks[c] = chunk;
+        }
+    } else if(index % COLLECTOR_CHUNK_SAMPLES == 0) {
+        /* previous chunk is full (or there is none yet) */
+        if(c == dir->capacity) {
+            collector_chunk_dir* new_dir = chunk_dir_create(2*dir->capacity, store->compressed);
+            if(!new_dir)
+                return COLLECTOR_ERR_ALLOCATION;
+            memcpy(new_dir->chunks, dir->chunks, dir->capacity*sizeof(collector_chunk*));
+            if(dir->packed)
+                memcpy(new_dir->packed, dir->packed, dir->capacity*sizeof(collector_packed_chunk*));
+            new_dir->prev = dir;
+            __atomic_store_n(&store->dir, new_dir, __ATOMIC_RELEASE);
+            dir = new_dir;
+        }
+        collector_chunk* chunk = collector_chunk_pool_get(store->pool);
+        if(!chunk)
+            return COLLECTOR_ERR_ALLOCATION;
+        dir->chunks[c] = chunk;
+        if(store->compressed && c > 0)
+            store_seal(store, dir, c - 1);
+    }
+
+    collector_chunk* chunk = dir->chunks[c];
+    uint64_t k = index % COLLECTOR_CHUNK_SAMPLES;
+    if(store->columnar) {
+        chunk->columns.time[k]      = time;
+        chunk->columns.val[k]       = val;
+        chunk->columns.sample_id[k] = sample_id;
+    } else {
+        chunk->samples[k].time      = time;
+        chunk->samples[k].val       = val;
+        chunk->samples[k].sample_id = sample_id;
+    }
+
+    __atomic_store_n(&store->count, index + 1, __ATOMIC_RELEASE);
+
+    return COLLECTOR_SUCCESS;
+}
+
+/* Returns the number of samples in [i, i+len) of a chunk, with len
+ * going at most to the end of the chunk */
+static inline uint64_t chunk_span(uint64_t i, uint64_t n)
+{
+    uint64_t left_in_chunk = COLLECTOR_CHUNK_SAMPLES - (i % COLLECTOR_CHUNK_SAMPLES);
+    return n < left_in_chunk ? n : left_in_chunk;
+}
+
+/* Destination of the samples read from a compressed store: the fields
+ * of sample j go to time[j*stride], val[j*stride] and sample_id[j*stride],
+ * fields whose array is NULL are skipped */
+typedef struct sample_sink {
+    double*   time;
+    double*   val;
+    uint64_t* sample_id;
+    size_t    stride;
+} sample_sink;
+
+static inline void sink_put(const sample_sink* sink, uint64_t j, double time, double val, uint64_t sample_id)
+{
+    if(sink->time)      sink->time[j*sink->stride]      = time;
+    if(sink->val)       sink->val[j*sink->stride]       = val;
+    if(sink->sample_id) sink->sample_id[j*sink->stride] = sample_id;
+}
+
+/* Reads samples [i, i+n) of a compressed store, which must be in the same
+ * chunk, into a sink. A sealed chunk is decoded from its start; the
+ * samples of a raw chunk are read again if it got sealed meanwhile. */
+static void packed_read(const collector_sample_store* store, uint64_t i, uint64_t n, const sample_sink* sink)
+{
+    uint64_t c = i / COLLECTOR_CHUNK_SAMPLES;
+    uint64_t k = i % COLLECTOR_CHUNK_SAMPLES;
+    uint64_t j;
+    collector_chunk_dir* dir;
+    collector_packed_chunk* p;
+    collector_chunk* chunk;
+    collector_gorilla_decoder dec;
+    double time, val;
+    uint64_t sample_id;
+
+    for(;;) {
+        dir = __atomic_load_n(&store->dir, __ATOMIC_ACQUIRE);
+        p   = __atomic_load_n(&dir->packed[c], __ATOMIC_ACQUIRE);
+        if(p) {
+            collector_gorilla_decoder_init(&dec, p->words, p->num_words);
+            for(j = 0; j < k + n && collector_gorilla_get(&dec, &time, &val, &sample_id); j++) {
+                if(j >= k)
+                    sink_put(sink, j - k, time, val, sample_id);
+            }
+            return;
+        }
+        chunk = __atomic_load_n(&dir->chunks[c], __ATOMIC_ACQUIRE);
+        if(!chunk)
+            continue; /* being sealed */
+        for(j = 0; j < n; j++) {
+            if(store->columnar)
+                sink_put(sink, j, chunk->columns.time[k+j], chunk->columns.val[k+j], chunk->columns.sample_id[k+j]);
+            else
+                sink_put(sink, j, chunk->samples[k+j].time, chunk->samples[k+j].val, chunk->samples[k+j].sample_id);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(!__atomic_load_n(&dir->packed[c], __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+collector_metric_sample collector_store_get_packed(const collector_sample_store* store, uint64_t i)
+{
+    collector_metric_sample s;
+    sample_sink sink = { &s.time, &s.val, &s.sample_id, 0 };
+    packed_read(store, i, 1, &sink);
+    return s;
+}
+
+/* Reads samples [i, i+n) of a compressed store chunk by chunk */
+static void packed_copy(const collector_sample_store* store, uint64_t i, uint64_t n, sample_sink sink)
+{
+    uint64_t last = i + n;
+    uint64_t len;
+
+    for(; i < last; i += len) {
+        len = chunk_span(i, last - i);
+        packed_read(store, i, len, &sink);
+        if(sink.time)      sink.time      += len*sink.stride;
+        if(sink.val)       sink.val       += len*sink.stride;
+        if(sink.sample_id) sink.sample_id += len*sink.stride;
+    }
+}
+
+void collector_store_copy(const collector_sample_store* store, uint64_t i, uint64_t n, collector_metric_sample* dst)
+{
+    uint64_t last = i + n;
+    uint64_t len, j, k;
+
+    if(store->compressed) {
+        sample_sink sink = { &dst->time, &dst->val, &dst->sample_id, sizeof(*dst)/sizeof(double) };
+        packed_copy(store, i, n, sink);
+        return;
+    }
+
+    for(; i < last; i += len) {
+        collector_chunk* chunk = collector_store_chunk(store, i);
+        k   = i % COLLECTOR_CHUNK_SAMPLES;
+        len = chunk_span(i, last - i);
+        if(store->columnar) {
+            for(j = 0; j < len; j++) {
+                dst[j].time      = chunk->columns.time[k+j];
+                dst[j].val       = chunk->columns.val[k+j];
+                dst[j].sample_id = chunk->columns.sample_id[k+j];
+            }
+        } else {
+            memcpy(dst, &chunk->samples[k], len*sizeof(*dst));
+        }
+        dst += len;
+    }
+}
+
+void collector_store_copy_columns(const collector_sample_store* store, uint64_t i, uint64_t n, uint32_t columns, double* time, double* val, uint64_t* sample_id)
+{
+    uint64_t last = i + n;
+    uint64_t len, j, k;
+
+    if(store->compressed) {
+        sample_sink sink = {
+            columns & COLLECTOR_COLUMN_TIME ? time : NULL,
+            columns & COLLECTOR_COLUMN_VAL ? val : NULL,
+            columns & COLLECTOR_COLUMN_SAMPLE_ID ? sample_id : NULL,
+            1
+        };
+        packed_copy(store, i, n, sink);
+        return;
+    }
+
+    for(; i < last; i += len) {
+        collector_chunk* chunk = collector_store_chunk(store, i);
+        k   = i % COLLECTOR_CHUNK_SAMPLES;
+        len = chunk_span(i, last - i);
+        if(store->columnar) {
+            if(columns & COLLECTOR_COLUMN_TIME)
+                memcpy(time, &chunk->columns.time[k], len*sizeof(double));
+            if(columns & COLLECTOR_COLUMN_VAL)
+                memcpy(val, &chunk->columns.val[k], len*sizeof(double));
+            if(columns & COLLECTOR_COLUMN_SAMPLE_ID)
+                memcpy(sample_id, &chunk->columns.sample_id[k], len*sizeof(uint64_t));
+        } else {
+            const collector_metric_sample* src = &chunk->samples[k];
+            if(columns & COLLECTOR_COLUMN_TIME)
+                for(j = 0; j < len; j++) time[j] = src[j].time;
+            if(columns & COLLECTOR_COLUMN_VAL)
+                for(j = 0; j < len; j++) val[j] = src[j].val;
+            if(columns & COLLECTOR_COLUMN_SAMPLE_ID)
+                for(j = 0; j < len; j++) sample_id[j] = src[j].sample_id;
+        }
+        if(columns & COLLECTOR_COLUMN_TIME)      time += len;
+        if(columns & COLLECTOR_COLUMN_VAL)       val += len;
+        if(columns & COLLECTOR_COLUMN_SAMPLE_ID) sample_id += len;
+    }
+}
+
+/* Returns how many of the n samples copied from sample first of a
+ * ring-mode store must be dropped because their slot has been reused
+ * since we started copying; the writer may also be rewriting the slot
+ * of sample (count - capacity) right now */
+static uint64_t store_dropped_samples(const collector_sample_store* store, uint64_t first, uint64_t n)
+{
+    uint64_t slots, count, dropped = 0;
+
+    if(!store->max_samples)
+        return 0;
+    slots = store->dir->capacity*COLLECTOR_CHUNK_SAMPLES;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    count = __atomic_load_n(&store->count, __ATOMIC_RELAXED);
+    if(count >= slots && first <= count - slots) {
+        dropped = count - slots + 1 - first;
+        if(dropped > n) dropped = n;
+    }
+    return dropped;
+}
+
+/* Returns the range of the latest (at most n) samples of a store */
+static uint64_t store_latest(const collector_sample_store* store, uint64_t n, uint64_t* first)
+{
+    uint64_t count = collector_store_size(store);
+    *first = collector_store_first(store, count);
+    if(count - *first > n)
+        *first = count - n;
+    return count - *first;
+}
+
+uint64_t collector_store_copy_latest(const collector_sample_store* store, uint64_t n, collector_metric_sample* dst, uint64_t* first_seq)
+{
+    uint64_t first, dropped;
+
+    n = store_latest(store, n, &first);
+    collector_store_copy(store, first, n, dst);
+
+    dropped = store_dropped_samples(store, first, n);
+    memmove(dst, dst + dropped, (n - dropped)*sizeof(*dst));
+
+    *first_seq = first + dropped;
+    return n - dropped;
+}
+
+uint64_t collector_store_copy_latest_columns(const collector_sample_store* store, uint64_t n, uint32_t columns, double* time, double* val, uint64_t* sample_id, uint64_t* first_seq)
+{
+    uint64_t first, dropped;
+
+    n = store_latest(store, n, &first);
+    collector_store_copy_columns(store, first, n, columns, time, val, sample_id);
+
+    dropped = store_dropped_samples(store, first, n);
+    if(dropped) {
+        if(columns & COLLECTOR_COLUMN_TIME)
+            memmove(time, time + dropped, (n - dropped)*sizeof(double));
+        if(columns & COLLECTOR_COLUMN_VAL)
+            memmove(val, val + dropped, (n - dropped)*sizeof(double));
+        if(columns & COLLECTOR_COLUMN_SAMPLE_ID)
+            memmove(sample_id, sample_id + dropped, (n - dropped)*sizeof(uint64_t));
+    }
+
+    *first_seq = first + dropped;
+    return n - dropped;
+}
+
+/* Calls f on the values of samples [first, last), in blocks of contiguous
+ * values of at most a chunk */
+static void store_for_each_vals(const collector_sample_store* store, uint64_t first, uint64_t last,
+                                void (*f)(const double* vals, size_t n, void* arg), void* arg)
+{
+    double buf[COLLECTOR_STORE_GATHER];
+    const double* vals;
+    size_t stride;
+    uint64_t i, j, len;
+
+    /* the values of a compressed store are decoded a chunk at a time (or,
+     * without memory for a chunk, a buffer at a time) */
+    if(store->compressed) {
+        double* chunk_vals = (double*)malloc(COLLECTOR_CHUNK_SAMPLES*sizeof(double));
+        uint64_t room = chunk_vals ? COLLECTOR_CHUNK_SAMPLES : COLLECTOR_STORE_GATHER;
+        sample_sink sink = { NULL, chunk_vals ? chunk_vals : buf, NULL, 1 };
+        for(i = first; i < last; i += len) {
+            len = chunk_span(i, last - i);
+            if(len > room)
+                len = room;
+            packed_read(store, i, len, &sink);
+            f(sink.val, len, arg);
+        }
+        free(chunk_vals);
+        return;
+    }
+
+    for(i = first; i < last; i += len) {
+        len = collector_store_span_val(store, i, last - i, &vals, &stride);
+        if(stride == 1) {
+            f(vals, len, arg);
+            continue;
+        }
+        if(len > COLLECTOR_STORE_GATHER)
+            len = COLLECTOR_STORE_GATHER;
+        for(j = 0; j < len; j++)
+            buf[j] = vals[j*stride];
+        f(buf, len, arg);
+    }
+}
+
+struct min_max_args {
+    const collector_kernels* k;
+    double min, max;
+};
+
+static void min_max_block(const double* vals, size_t n, void* arg)
+{
+    struct min_max_args* a = (struct min_max_args*)arg;
+    double lo, hi, sum;
+    a->k->min_max_sum(vals, n, &lo, &hi, &sum);
+    a->min = lo < a->min ? lo : a->min;
+    a->max = hi > a->max ? hi : a->max;
+}
+
+void collector_store_min_max(const collector_sample_store* store, uint64_t first, uint64_t last, double* min, double* max)
+{
+    struct min_max_args a;
+    a.k   = collector_kernels_get();
+    a.min = a.max = collector_store_val(store, first);
+    store_for_each_vals(store, first, last, min_max_block, &a);
+    *min = a.min;
+    *max = a.max;
+}
+
+struct stats_args {
+    const collector_kernels* k;
+    collector_stats_acc*     acc;
+    double                   threshold;
+};
+
+static void stats_block(const double* vals, size_t n, void* arg)
+{
+    struct stats_args* a = (struct stats_args*)arg;
+    collector_stats_add(a->k, a->acc, vals, n, a->threshold);
+}
+
+void collector_store_stats(const collector_sample_store* store, uint64_t first, uint64_t last, double threshold, collector_stats_acc* acc)
+{
+    struct stats_args a;
+    a.k         = collector_kernels_get();
+    a.acc       = acc;
+    a.threshold = threshold;
+    store_for_each_vals(store, first, last, stats_block, &a);
+}
+
+struct bucket_args {
+    const collector_kernels* k;
+    double    min, range;
+    size_t    num_buckets;
+    uint64_t* counts;
+};
+
+static void bucket_block(const double* vals, size_t n, void* arg)
+{
+    struct bucket_args* a = (struct bucket_args*)arg;
+    a->k->bucket(vals, n, a->min, a->range, a->num_buckets, a->counts);
+}
+
+void collector_store_bucket(const collector_sample_store* store, uint64_t first, uint64_t last, double min, double range, size_t num_buckets, uint64_t* counts)
+{
+    struct bucket_args a;
+    a.k           = collector_kernels_get();
+    a.min         = min;
+    a.range       = range;
+    a.num_buckets = num_buckets;
+    a.counts      = counts;
+    store_for_each_vals(store, first, last, bucket_block, &a);
+}
+
+/* Binary search over the chunks of a compressed store on the time of
+ * their first sample, which is cheap to decode, then over the times of
+ * a single chunk, decoded at once */
+static uint64_t packed_lower_bound(const collector_sample_store* store, uint64_t lo, uint64_t hi, double t)
+{
+    uint64_t c_lo, c_hi, mid, a, b;
+    double* times;
+
+    while(lo < hi) {
+        c_lo = lo / COLLECTOR_CHUNK_SAMPLES;
+        c_hi = (hi - 1) / COLLECTOR_CHUNK_SAMPLES;
+        if(c_lo == c_hi)
+            break;
+        mid = (c_lo + (c_hi - c_lo + 1) / 2) * COLLECTOR_CHUNK_SAMPLES;
+        if(collector_store_time(store, mid) < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo == hi)
+        return lo;
+
+    times = (double*)malloc((hi - lo)*sizeof(double));
+    if(!times) {
+        /* decode the chunk sample by sample */
+        while(lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if(collector_store_time(store, mid) < t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+    sample_sink sink = { times, NULL, NULL, 1 };
+    packed_read(store, lo, hi - lo, &sink);
+    a = 0;
+    b = hi - lo;
+    while(a < b) {
+        mid = a + (b - a) / 2;
+        if(times[mid] < t)
+            a = mid + 1;
+        else
+            b = mid;
+    }
+    free(times);
+    return lo + a;
+}
+
+uint64_t collector_store_lower_bound(const collector_sample_store* store, uint64_t lo, uint64_t hi, double t)
+{
+    if(store->compressed)
+        return packed_lower_bound(store, lo, hi, t);
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if(collector_store_time(store, mid) < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+uint64_t collector_store_copy_range(const collector_sample_store* store, double t_start, double t_end, uint64_t n, collector_metric_sample* dst, uint64_t* first_seq, uint64_t* total)
+{
+    uint64_t count, first, last;
+
+    do {
+        count = collector_store_size(store);
+        first = collector_store_first(store, count);
+        first = collector_store_lower_bound(store, first, count, t_start);
+        last  = collector_store_lower_bound(store, first, count, t_end);
+        *total = last - first;
+        if(last - first > n)
+            last = first + n;
+        collector_store_copy(store, first, last - first, dst);
+        /* in ring mode, start over if the writer lapped us: the binary
+         * search may have been misled by overwritten samples as well */
+    } while(collector_store_overwritten(store, first));
+
+    *first_seq = first;
+    return last - first;
+}
+
+void collector_store_stats_range(const collector_sample_store* store, double t_start, double t_end, double threshold, collector_stats_acc* acc)
+{
+    collector_stats_acc range;
+    uint64_t count, first, last;
+
+    do {
+        memset(&range, 0, sizeof(range));
+        count = collector_store_size(store);
+        first = collector_store_first(store, count);
+        first = collector_store_lower_bound(store, first, count, t_start);
+        last  = collector_store_lower_bound(store, first, count, t_end);
+        collector_store_stats(store, first, last, threshold, &range);
+    } while(collector_store_overwritten(store, first));
+
+    collector_stats_merge(acc, &range);
+}
+
+collector_return_t collector_store_merge_latest(collector_sample_store* const* stores, size_t num_stores, uint64_t n, collector_metric_sample* dst, uint64_t* count)
+{
+    uint64_t* pos   = (uint64_t*)calloc(2*num_stores, sizeof(uint64_t));
+    uint64_t* first = pos + num_stores;
+    uint64_t  out;
+    size_t    i, j = 0;
+    int       retry;
+
+    *count = 0;
+    if(!pos) return COLLECTOR_ERR_ALLOCATION;
+
+    do {
+        for(i = 0; i < num_stores; i++) {
+            pos[i]   = collector_store_size(stores[i]);
+            first[i] = collector_store_first(stores[i], pos[i]);
+        }
+        /* walk the stores backward, always taking the most recent sample,
+         * and fill dst from its end */
+        for(out = n; out > 0; out--) {
+            int found = 0;
+            double latest = 0;
+            for(i = 0; i < num_stores; i++) {
+                if(pos[i] == first[i]) continue;
+                double t = collector_store_time(stores[i], pos[i] - 1);
+                if(!found || t > latest) {
+                    found = 1;
+                    latest = t;
+                    j = i;
+                }
+            }
+            if(!found) break;
+            dst[out - 1] = collector_store_get(stores[j], pos[j] - 1);
+            pos[j] -= 1;
+        }
+        /* start over if a ring-mode store lapped us while merging */
+        retry = 0;
+        for(i = 0; i < num_stores; i++) {
+            if(collector_store_overwritten(stores[i], pos[i]))
+                retry = 1;
+        }
+    } while(retry);
+
+    free(pos);
+    memmove(dst, dst + out, (n - out)*sizeof(*dst));
+    *count = n - out;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_store_merge_range(collector_sample_store* const* stores, size_t num_stores, double t_start, double t_end, uint64_t n, collector_metric_sample* dst, uint64_t* count, uint64_t* total)
+{
+    collector_store_merge it;
+    collector_return_t ret;
+    uint64_t* first = (uint64_t*)calloc(num_stores, sizeof(uint64_t));
+    uint64_t  out;
+    size_t    i;
+    int       retry;
+
+    *count = 0;
+    *total = 0;
+    if(!first) return COLLECTOR_ERR_ALLOCATION;
+
+    do {
+        ret = collector_store_merge_init_range(&it, stores, num_stores, t_start, t_end);
+        if(ret != COLLECTOR_SUCCESS) {
+            free(first);
+            *total = 0;
+            return ret;
+        }
+        memcpy(first, it.pos, num_stores*sizeof(uint64_t));
+        *total = collector_store_merge_remaining(&it);
+        for(out = 0; out < n && collector_store_merge_next(&it, &dst[out]); out++)
+            ;
+        collector_store_merge_finalize(&it);
+        /* start over if a ring-mode store lapped us while merging */
+        retry = 0;
+        for(i = 0; i < num_stores; i++) {
+            if(collector_store_overwritten(stores[i], first[i]))
+                retry = 1;
+        }
+    } while(retry);
+
+    free(first);
+    *count = out;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_store_merge_since(collector_sample_store* const* stores, size_t num_stores, uint64_t* pos, uint64_t n, collector_metric_sample* dst, uint64_t* count, uint64_t* dropped)
+{
+    collector_store_merge it;
+    uint64_t* start = (uint64_t*)calloc(3*num_stores, sizeof(uint64_t));
+    uint64_t  out, first;
+    size_t    i;
+    int       retry;
+
+    *count = 0;
+    *dropped = 0;
+    if(!start) return COLLECTOR_ERR_ALLOCATION;
+
+    it.stores     = stores;
+    it.num_stores = num_stores;
+    it.pos        = start + num_stores;
+    it.end        = start + 2*num_stores;
+    it.start      = start;
+    it.buf        = NULL;
+
+    do {
+        *dropped = 0;
+        for(i = 0; i < num_stores; i++) {
+            it.end[i] = collector_store_size(stores[i]);
+            first     = collector_store_first(stores[i], it.end[i]);
+            start[i]  = pos[i];
+            if(start[i] > it.end[i])
+                start[i] = it.end[i]; /* cursor of another incarnation of the metric */
+            if(start[i] < first) {
+                *dropped += first - start[i];
+                start[i] = first;
+            }
+            it.pos[i] = start[i];
+        }
+        if(num_stores == 1) {
+            out = it.end[0] - it.pos[0];
+            if(out > n) out = n;
+            collector_store_copy(stores[0], it.pos[0], out, dst);
+            it.pos[0] += out;
+        } else {
+            for(out = 0; out < n && collector_store_merge_next(&it, &dst[out]); out++)
+                ;
+        }
+        /* start over if a ring-mode store lapped us while copying */
+        retry = 0;
+        for(i = 0; i < num_stores; i++) {
+            if(it.pos[i] > start[i] && collector_store_overwritten(stores[i], start[i]))
+                retry = 1;
+        }
+    } while(retry);
+
+    memcpy(pos, it.pos, num_stores*sizeof(uint64_t));
+    free(start);
+    *count = out;
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_store_merge_init(collector_store_merge* it, collector_sample_store* const* stores, size_t num_stores)
+{
+    size_t i;
+    it->stores     = stores;
+    it->num_stores = num_stores;
+    it->pos        = (uint64_t*)calloc(3*num_stores, sizeof(uint64_t));
+    if(!it->pos)
+        return COLLECTOR_ERR_ALLOCATION;
+    it->end   = it->pos + num_stores;
+    it->start = it->pos + 2*num_stores;
+    for(i = 0; i < num_stores; i++) {
+        it->end[i]   = collector_store_size(stores[i]);
+        it->pos[i]   = collector_store_first(stores[i], it->end[i]);
+        it->start[i] = it->pos[i];
+    }
+    /* without the buffer, samples are decoded one by one */
+    it->buf       = NULL;
+    it->buf_first = 0;
+    it->buf_len   = 0;
+    if(num_stores == 1 && stores[0]->compressed)
+        it->buf = (collector_metric_sample*)malloc(COLLECTOR_CHUNK_SAMPLES*sizeof(*it->buf));
+    return COLLECTOR_SUCCESS;
+}
+
+collector_return_t collector_store_merge_init_range(collector_store_merge* it, collector_sample_store* const* stores, size_t num_stores, double t_start, double t_end)
+{
+    size_t i;
+    collector_return_t ret = collector_store_merge_init(it, stores, num_stores);
+    if(ret != COLLECTOR_SUCCESS)
+        return ret;
+    for(i = 0; i < num_stores; i++) {
+        it->pos[i]   = collector_store_lower_bound(stores[i], it->pos[i], it->end[i], t_start);
+        it->end[i]   = collector_store_lower_bound(stores[i], it->pos[i], it->end[i], t_end);
+        it->start[i] = it->pos[i];
+    }
+    return COLLECTOR_SUCCESS;
+}
+
+uint64_t collector_store_merge_remaining(const collector_store_merge* it)
+{
+    uint64_t n = 0;
+    size_t i;
+    for(i = 0; i < it->num_stores; i++)
+        n += it->end[i] - it->pos[i];
+    return n;
+}
+
+int collector_store_merge_next(collector_store_merge* it, collector_metric_sample* s)
+{
+    int found = 0;
+    double earliest = 0;
+    size_t i, j = 0;
+
+    if(it->buf) {
+        if(it->pos[0] == it->end[0])
+            return 0;
+        if(it->pos[0] >= it->buf_first + it->buf_len) {
+            it->buf_first = it->pos[0];
+            it->buf_len   = chunk_span(it->pos[0], it->end[0] - it->pos[0]);
+            collector_store_copy(it->stores[0], it->buf_first, it->buf_len, it->buf);
+        }
+        *s = it->buf[it->pos[0] - it->buf_first];
+        it->pos[0] += 1;
+        return 1;
+    }
+    for(i = 0; i < it->num_stores; i++) {
+        if(it->pos[i] == it->end[i]) continue;
+        double t = collector_store_time(it->stores[i], it->pos[i]);
+        if(!found || t < earliest) {
+            found = 1;
+            earliest = t;
+            j = i;
+        }
+    }
+    if(!found)
+        return 0;
+    *s = collector_store_get(it->stores[j], it->pos[j]);
+    it->pos[j] += 1;
+    return 1;
+}
+
+void collector_store_merge_rewind(collector_store_merge* it)
+{
+    memcpy(it->pos, it->start, it->num_stores*sizeof(uint64_t));
+    it->buf_first = 0;
+    it->buf_len   = 0;
+}
+
+void collector_store_merge_finalize(collector_store_merge* it)
+{
+    free(it->buf);
+    it->buf = NULL;
+    free(it->pos);
+    it->pos = it->end = it->start = NULL;
+}
@@ -0,0 +1,417 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef __STORE_H
+#define __STORE_H
+
+#include <abt.h>
+#include <margo.h>
+#include "collector/collector-common.h"
+#include "kernels.h"
+#include "gorilla.h"
+
+/* Number of samples held by a single chunk (96 KiB of samples) */
+#define COLLECTOR_CHUNK_SAMPLES 4096
+
+#define COLLECTOR_CACHE_LINE_SIZE 64
+
+/**
+ * @brief Fixed-size block of samples. Chunks are handed out by a
+ * collector_chunk_pool and returned to it when a metric is destroyed.
+ * The samples of a chunk are registered for bulk transfers the first time
+ * they are fetched, and stay registered while the chunk is reused.
+ *
+ * The samples are stored as an array of records, or, in the chunks of a
+ * columnar store, as one array per field: scans over the values of a
+ * columnar store then read contiguous doubles, and vectorize.
+ */
+typedef struct collector_chunk {
+    struct collector_chunk* next; /* link in the pool's free list */
+    hg_bulk_t               bulk; /* samples exposed for bulk transfers, or HG_BULK_NULL */
+    union {
+        collector_metric_sample samples[COLLECTOR_CHUNK_SAMPLES];
+        struct {
+            double   time[COLLECTOR_CHUNK_SAMPLES];
+            double   val[COLLECTOR_CHUNK_SAMPLES];
+            uint64_t sample_id[COLLECTOR_CHUNK_SAMPLES];
+        } columns;
+    };
+} collector_chunk;
+
+_Static_assert(sizeof(((collector_chunk*)0)->columns) == sizeof(((collector_chunk*)0)->samples),
+               "both layouts of a chunk must have the same size");
+
+/**
+ * @brief Pool of chunks shared by all the metrics of a provider.
+ * The pool's mutex is taken with ABT_mutex_spinlock so that appending
+ * to a store never yields (see the lock-free sharded update path).
+ */
+typedef struct collector_chunk_pool {
+    margo_instance_id mid;
+    ABT_mutex        mutex;
+    collector_chunk* free_list;
+    size_t           num_free;      /* chunks currently in the free list */
+    size_t           num_allocated; /* chunks allocated by the pool in total */
+    size_t           packed_bytes;  /* size of the compressed chunks of the stores, updated atomically */
+} collector_chunk_pool;
+
+/**
+ * @brief Full chunk of a compressed store, encoded by collector_gorilla.
+ * Packed chunks are immutable and freed with their store.
+ */
+typedef struct collector_packed_chunk {
+    size_t   num_words;
+    uint64_t words[];
+} collector_packed_chunk;
+
+/**
+ * @brief Directory of chunks. When the directory is full, a new one
+ * twice as large is published and the old one is kept around until
+ * the store is destroyed, so that readers never see freed memory.
+ */
+typedef struct collector_chunk_dir {
+    struct collector_chunk_dir* prev;   /* retired directory */
+    size_t                      capacity;
+    collector_packed_chunk**    packed; /* compressed stores: the sealed chunks, NULL for the others */
+    collector_chunk*            chunks[];
+} collector_chunk_dir;
+
+/**
+ * @brief Segmented, append-only sample storage. Chunks are taken from
+ * the pool only when the previous chunk is full, so the memory used by
+ * a metric tracks the number of samples it actually recorded.
+ *
+ * Every sample gets a sequence number, its position in the stream of
+ * samples ever appended. In ring mode (max_samples != 0) the directory
+ * has a fixed number of chunks that are reused in a circular fashion,
+ * and only the latest max_samples samples are retained. One chunk more
+ * than needed is kept so that the retained samples are not the ones
+ * being overwritten by the next append.
+ *
+ * A store has a single writer at a time (the caller serializes appends)
+ * but may be read concurrently: the directory and the sample count are
+ * published with release semantics after the sample is written.
+ *
+ * In a compressed store (unbounded only), the writer seals each chunk
+ * when it fills up: the chunk is encoded into a collector_packed_chunk,
+ * published in the directory (and in the retired directories, which
+ * readers may still hold), and the raw chunk goes back to the pool. Only
+ * the chunk being written is kept uncompressed. Readers decode sealed
+ * chunks from their start; after copying samples from a raw chunk, they
+ * check that it wasn't sealed meanwhile, and read it again otherwise.
+ *
+ * Samples are read through the accessors below, which work with both
+ * chunk layouts and with compressed stores.
+ */
+typedef struct collector_sample_store {
+    collector_chunk_pool* pool;
+    collector_chunk_dir*  dir;
+    uint64_t              count;       /* number of samples ever appended (next sequence number) */
+    /* bit fields keep a store in 32 bytes, within the first cache line of a metric */
+    uint64_t              max_samples : 62; /* samples retained in ring mode, 0 if unbounded */
+    uint64_t              columnar : 1;     /* chunks store samples as columns */
+    uint64_t              compressed : 1;   /* full chunks are compressed */
+} collector_sample_store;
+
+collector_return_t collector_chunk_pool_init(collector_chunk_pool* pool, margo_instance_id mid);
+
+void collector_chunk_pool_finalize(collector_chunk_pool* pool);
+
+collector_chunk* collector_chunk_pool_get(collector_chunk_pool* pool);
+
+void collector_chunk_pool_put(collector_chunk_pool* pool, collector_chunk* chunk);
+
+/**
+ * @brief Returns a read-only bulk handle exposing the samples of a chunk,
+ * registering them on first use, or HG_BULK_NULL on error.
+ */
+hg_bulk_t collector_chunk_bulk(collector_chunk_pool* pool, collector_chunk* chunk);
+
+/**
+ * @brief Initializes a store. Compression is only supported by unbounded
+ * stores (max_samples = 0).
+ */
+collector_return_t collector_store_init(collector_sample_store* store, collector_chunk_pool* pool, uint64_t max_samples, int columnar, int compressed);
+
+void collector_store_destroy(collector_sample_store* store);
+
+collector_return_t collector_store_append(collector_sample_store* store, double time, double val, uint64_t sample_id);
+
+/**
+ * @brief Returns the number of samples that can safely be read.
+ */
+static inline uint64_t collector_store_size(const collector_sample_store* store)
+{
+    return __atomic_load_n(&store->count, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Returns the sequence number of the oldest sample still retained
+ * by a store that contains count samples.
+ */
+static inline uint64_t collector_store_first(const collector_sample_store* store, uint64_t count)
+{
+    if(store->max_samples && count > store->max_samples)
+        return count - store->max_samples;
+    return 0;
+}
+
+/**
+ * @brief Returns the chunk holding the sample with sequence number i
+ * (NULL if it has been sealed, in a compressed store).
+ */
+static inline collector_chunk* collector_store_chunk(const collector_sample_store* store, uint64_t i)
+{
+    collector_chunk_dir* dir = __atomic_load_n(&store->dir, __ATOMIC_ACQUIRE);
+    uint64_t c = i / COLLECTOR_CHUNK_SAMPLES;
+    if(store->max_samples)
+        c %= dir->capacity;
+    return dir->chunks[c];
+}
+
+/**
+ * @brief Returns 1 if sample i of a ring-mode store may have been
+ * overwritten since the reader loaded the store's count: a reader checks
+ * this after reading samples from i on, and reads them again if needed.
+ */
+static inline int collector_store_overwritten(const collector_sample_store* store, uint64_t i)
+{
+    uint64_t slots, count;
+    if(!store->max_samples)
+        return 0;
+    slots = store->dir->capacity*COLLECTOR_CHUNK_SAMPLES;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    count = __atomic_load_n(&store->count, __ATOMIC_RELAXED);
+    return count >= slots && i <= count - slots;
+}
+
+/**
+ * @brief Reads a sample of a compressed store, decoding its chunk from
+ * the start if it is sealed: prefer the functions that read ranges of
+ * samples, which decode each chunk once.
+ */
+collector_metric_sample collector_store_get_packed(const collector_sample_store* store, uint64_t i);
+
+/* The following accessors read the sample with sequence number i, which
+ * must be in [collector_store_first(), collector_store_size()) */
+
+static inline double collector_store_time(const collector_sample_store* store, uint64_t i)
+{
+    if(store->compressed)
+        return collector_store_get_packed(store, i).time;
+    collector_chunk* chunk = collector_store_chunk(store, i);
+    i %= COLLECTOR_CHUNK_SAMPLES;
+    return store->columnar ? chunk->columns.time[i] : chunk->samples[i].time;
+}
+
+static inline double collector_store_val(const collector_sample_store* store, uint64_t i)
+{
+    if(store->compressed)
+        return collector_store_get_packed(store, i).val;
+    collector_chunk* chunk = collector_store_chunk(store, i);
+    i %= COLLECTOR_CHUNK_SAMPLES;
+    return store->columnar ? chunk->columns.val[i] : chunk->samples[i].val;
+}
+
+static inline collector_metric_sample collector_store_get(const collector_sample_store* store, uint64_t i)
+{
+    if(store->compressed)
+        return collector_store_get_packed(store, i);
+    collector_chunk* chunk = collector_store_chunk(store, i);
+    collector_metric_sample s;
+    i %= COLLECTOR_CHUNK_SAMPLES;
+    if(!store->columnar)
+        return chunk->samples[i];
+    s.time      = chunk->columns.time[i];
+    s.val       = chunk->columns.val[i];
+    s.sample_id = chunk->columns.sample_id[i];
+    return s;
+}
+
+/**
+ * @brief Sets *vals to the value of sample i and *stride to the distance,
+ * in doubles, between consecutive values (1 in a columnar store), and
+ * returns how many samples (at most n) follow in the same chunk. Used to
+ * walk the values of a range of samples of an uncompressed store chunk by
+ * chunk without copying:
+ *
+ *     for(i = first; i < last; i += len) {
+ *         len = collector_store_span_val(store, i, last - i, &vals, &stride);
+ *         for(j = 0; j < len; j++)
+ *             ... vals[j*stride] ...
+ *     }
+ */
+static inline uint64_t collector_store_span_val(const collector_sample_store* store, uint64_t i, uint64_t n, const double** vals, size_t* stride)
+{
+    collector_chunk* chunk = collector_store_chunk(store, i);
+    uint64_t k = i % COLLECTOR_CHUNK_SAMPLES;
+    uint64_t left_in_chunk = COLLECTOR_CHUNK_SAMPLES - k;
+    if(store->columnar) {
+        *vals   = &chunk->columns.val[k];
+        *stride = 1;
+    } else {
+        *vals   = &chunk->samples[k].val;
+        *stride = sizeof(collector_metric_sample)/sizeof(double);
+    }
+    return n < left_in_chunk ? n : left_in_chunk;
+}
+
+/* The following reductions over the values of samples [first, last) run
+ * the vector kernels of kernels.h chunk by chunk; the values of a row
+ * store are gathered into a buffer first */
+
+/**
+ * @brief Computes the minimum and maximum of the values, which must not
+ * be empty.
+ */
+void collector_store_min_max(const collector_sample_store* store, uint64_t first, uint64_t last, double* min, double* max);
+
+/**
+ * @brief Adds the values to a statistics accumulator.
+ */
+void collector_store_stats(const collector_sample_store* store, uint64_t first, uint64_t last, double threshold, collector_stats_acc* acc);
+
+/**
+ * @brief Adds the values to linear buckets, see collector_kernels.bucket.
+ */
+void collector_store_bucket(const collector_sample_store* store, uint64_t first, uint64_t last, double min, double range, size_t num_buckets, uint64_t* counts);
+
+/**
+ * @brief Adds the values of the samples whose time is in [t_start, t_end)
+ * to a statistics accumulator. In ring mode, the samples are summarized
+ * again if a concurrent writer overwrote some of them meanwhile.
+ */
+void collector_store_stats_range(const collector_sample_store* store, double t_start, double t_end, double threshold, collector_stats_acc* acc);
+
+/**
+ * @brief Copies the n samples starting at sample i into dst.
+ */
+void collector_store_copy(const collector_sample_store* store, uint64_t i, uint64_t n, collector_metric_sample* dst);
+
+/**
+ * @brief Copies the given fields of the n samples starting at sample i
+ * into separate arrays; the arrays of the other fields may be NULL.
+ *
+ * @param columns mask of COLLECTOR_COLUMN_* flags
+ */
+void collector_store_copy_columns(const collector_sample_store* store, uint64_t i, uint64_t n, uint32_t columns, double* time, double* val, uint64_t* sample_id);
+
+/**
+ * @brief Same as collector_store_copy_latest, copying the given fields
+ * of the samples into separate arrays (see collector_store_copy_columns).
+ */
+uint64_t collector_store_copy_latest_columns(const collector_sample_store* store, uint64_t n, uint32_t columns, double* time, double* val, uint64_t* sample_id, uint64_t* first_seq);
+
+/**
+ * @brief Copies the latest (at most n) samples of the store into dst, in
+ * order. In ring mode, samples overwritten by a concurrent writer while
+ * being copied are dropped from the front of the result.
+ *
+ * @param[out] first_seq sequence number of dst[0]
+ *
+ * @return the number of samples copied
+ */
+uint64_t collector_store_copy_latest(const collector_sample_store* store, uint64_t n, collector_metric_sample* dst, uint64_t* first_seq);
+
+/**
+ * @brief Returns the sequence number of the first sample in [lo, hi)
+ * whose time is >= t (hi if none), by binary search: the samples of a
+ * store are appended in time order.
+ */
+uint64_t collector_store_lower_bound(const collector_sample_store* store, uint64_t lo, uint64_t hi, double t);
+
+/**
+ * @brief Copies the first (at most n) samples of the store whose time is
+ * in [t_start, t_end) into dst, in order.
+ *
+ * @param[out] first_seq sequence number of dst[0]
+ * @param[out] total number of samples of the store in [t_start, t_end)
+ *
+ * @return the number of samples copied
+ */
+uint64_t collector_store_copy_range(const collector_sample_store* store, double t_start, double t_end, uint64_t n, collector_metric_sample* dst, uint64_t* first_seq, uint64_t* total);
+
+/**
+ * @brief Copies the latest (at most n) samples of a set of stores into
+ * dst, merged by timestamp. The samples of each store must be in time
+ * order, which is the case of a store appended to by a single execution
+ * stream.
+ *
+ * @param[out] count number of samples copied
+ *
+ * @return COLLECTOR_SUCCESS or COLLECTOR_ERR_ALLOCATION
+ */
+collector_return_t collector_store_merge_latest(collector_sample_store* const* stores, size_t num_stores, uint64_t n, collector_metric_sample* dst, uint64_t* count);
+
+/**
+ * @brief Copies the first (at most n) samples of a set of stores whose
+ * time is in [t_start, t_end) into dst, merged by timestamp.
+ *
+ * @param[out] count number of samples copied
+ * @param[out] total number of samples of the stores in [t_start, t_end)
+ *
+ * @return COLLECTOR_SUCCESS or COLLECTOR_ERR_ALLOCATION
+ */
+collector_return_t collector_store_merge_range(collector_sample_store* const* stores, size_t num_stores, double t_start, double t_end, uint64_t n, collector_metric_sample* dst, uint64_t* count, uint64_t* total);
+
+/**
+ * @brief Copies the (at most n) samples following a cursor into dst, merged
+ * by timestamp if there are several stores. pos[i] is the sequence number
+ * of the next sample to read from stores[i] and is advanced past the
+ * samples copied.
+ *
+ * @param[out] count number of samples copied
+ * @param[out] dropped number of samples after the cursor that ring-mode
+ * stores no longer retain
+ *
+ * @return COLLECTOR_SUCCESS or COLLECTOR_ERR_ALLOCATION
+ */
+collector_return_t collector_store_merge_since(collector_sample_store* const* stores, size_t num_stores, uint64_t* pos, uint64_t n, collector_metric_sample* dst, uint64_t* count, uint64_t* dropped);
+
+/**
+ * @brief Iterator over the samples of a set of stores, in time order.
+ * The samples appended after collector_store_merge_init are not visited.
+ */
+typedef struct collector_store_merge {
+    collector_sample_store* const* stores;
+    size_t                         num_stores;
+    uint64_t*                      pos;
+    uint64_t*                      end;
+    uint64_t*                      start; /* initial positions, see collector_store_merge_rewind */
+    /* a single compressed store is read chunk by chunk through buf, which
+     * holds samples [buf_first, buf_first + buf_len) */
+    collector_metric_sample*       buf;
+    uint64_t                       buf_first;
+    uint64_t                       buf_len;
+} collector_store_merge;
+
+collector_return_t collector_store_merge_init(collector_store_merge* it, collector_sample_store* const* stores, size_t num_stores);
+
+/**
+ * @brief Same as collector_store_merge_init, only visiting the samples
+ * whose time is in [t_start, t_end).
+ */
+collector_return_t collector_store_merge_init_range(collector_store_merge* it, collector_sample_store* const* stores, size_t num_stores, double t_start, double t_end);
+
+/**
+ * @brief Returns the number of samples left to visit.
+ */
+uint64_t collector_store_merge_remaining(const collector_store_merge* it);
+
+/**
+ * @brief Copies the next sample in time order into *s and returns 1,
+ * or returns 0 at the end.
+ */
+int collector_store_merge_next(collector_store_merge* it, collector_metric_sample* s);
+
+/**
+ * @brief Restarts an iterator from its first sample, so that the same
+ * samples can be visited again.
+ */
+void collector_store_merge_rewind(collector_store_merge* it);
+
+void collector_store_merge_finalize(collector_store_merge* it);
+
+#endif
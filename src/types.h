@@ -6,6 +6,7 @@
 #ifndef _PARAMS_H
 #define _PARAMS_H
 
+#include <stddef.h>
 #include <mercury.h>
 #include <abt.h>
 #include <mercury_macros.h>
@@ -13,6 +14,11 @@
 #include <mercury_proc_string.h>
 #include "collector/collector-common.h"
 #include "uthash.h"
+#include "store.h"
+#include "histogram.h"
+#include "sketch.h"
+#include "rollup.h"
+#include "intern.h"
 
 static inline hg_return_t hg_proc_collector_metric_id_t(hg_proc_t proc, collector_metric_id_t *id);
 
@@ -55,17 +61,553 @@ static inline hg_return_t hg_proc_list_metrics_out_t(hg_proc_t proc, void *data)
     return ret;
 }
 
+/* Array of n elements of the given size, allocated when decoding */
+static inline hg_return_t hg_proc_collector_array(hg_proc_t proc, hg_size_t n, size_t size, void** ptr)
+{
+    hg_return_t ret = HG_SUCCESS;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        *ptr = n ? calloc(n, size) : NULL;
+        if(n && !*ptr) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        if(n)
+            ret = hg_proc_memcpy(proc, *ptr, n*size);
+        break;
+    case HG_FREE:
+        free(*ptr);
+        break;
+    }
+    return ret;
+}
+
+/* Lists of metric metadata are sent inline if the client's bulk is
+ * HG_BULK_NULL, otherwise pushed to it. Each record is a
+ * metric_info_header followed by the ns, the name and the tags of the
+ * metric as null-terminated strings, padded to a multiple of 8 bytes. */
+typedef struct metric_info_header {
+    collector_metric_id_t id;
+    int32_t               type;
+    uint32_t              num_tags;
+    uint64_t              num_samples;
+} metric_info_header;
+
+typedef struct list_metrics_ext_in_t {
+    hg_string_t ns;       /* only metrics of this namespace ("" for any) */
+    hg_size_t   num_tags; /* only metrics with all these tags */
+    char**      tags;
+    uint64_t    token;    /* serial of the first metric to consider */
+    hg_size_t   max_count;
+    hg_size_t   capacity; /* size of the client's bulk region */
+    hg_bulk_t   bulk;
+} list_metrics_ext_in_t;
+
+static inline hg_return_t hg_proc_list_metrics_ext_in_t(hg_proc_t proc, void *data)
+{
+    list_metrics_ext_in_t* in = (list_metrics_ext_in_t*)data;
+    hg_return_t ret;
+    hg_size_t i;
+
+    ret = hg_proc_hg_string_t(proc, &(in->ns));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->num_tags));
+    if(ret != HG_SUCCESS) return ret;
+    if(hg_proc_get_op(proc) == HG_DECODE) {
+        in->tags = in->num_tags ? (char**)calloc(in->num_tags, sizeof(char*)) : NULL;
+        if(in->num_tags && !in->tags) return HG_NOMEM;
+    }
+    for(i = 0; i < in->num_tags; i++) {
+        ret = hg_proc_hg_string_t(proc, &(in->tags[i]));
+        if(ret != HG_SUCCESS) return ret;
+    }
+    if(hg_proc_get_op(proc) == HG_FREE)
+        free(in->tags);
+    ret = hg_proc_uint64_t(proc, &(in->token));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->max_count));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->capacity));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_hg_bulk_t(proc, &(in->bulk));
+}
+
+typedef struct list_metrics_ext_out_t {
+    int32_t   ret;
+    hg_size_t count;      /* number of records */
+    uint64_t  next_token; /* COLLECTOR_LIST_END if there are no more metrics */
+    hg_size_t size;       /* size of the records */
+    hg_size_t needed;     /* if no record fit in the client's capacity, size of the first one */
+    hg_size_t num_inline; /* size of the records sent inline */
+    char*     records;
+} list_metrics_ext_out_t;
+
+static inline hg_return_t hg_proc_list_metrics_ext_out_t(hg_proc_t proc, void *data)
+{
+    list_metrics_ext_out_t* out = (list_metrics_ext_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->count));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(out->next_token));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->size));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->needed));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->num_inline));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_collector_array(proc, out->num_inline, 1, (void**)&(out->records));
+}
+
 MERCURY_GEN_PROC(metric_fetch_in_t,
         ((collector_metric_id_t)(metric_id))\
 	((int64_t)(count))\
+	((uint32_t)(encodings))\
+	((hg_bulk_t)(bulk)))
+
+/* Fetches of at most COLLECTOR_FETCH_INLINE_MAX samples don't use bulk
+ * transfers (the request's bulk is HG_BULK_NULL): the samples are sent
+ * in inline_data. Either way, the actual_count samples take size bytes
+ * in the given encoding, one of the request's encodings, and a bulk
+ * transfer pushes them to the start of the client's region */
+typedef struct metric_fetch_out_t {
+    int64_t     actual_count;
+    uint64_t    first_seq;
+    uint64_t    next_seq;
+    hg_string_t name;
+    hg_string_t ns;
+    int32_t     ret;
+    uint32_t    encoding;
+    hg_size_t   size;
+    hg_size_t   num_inline;
+    void*       inline_data; /* size bytes of an inline fetch */
+} metric_fetch_out_t;
+
+static inline hg_return_t hg_proc_metric_fetch_out_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_out_t* out = (metric_fetch_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_int64_t(proc, &(out->actual_count));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(out->first_seq));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(out->next_seq));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(out->name));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(out->ns));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint32_t(proc, &(out->encoding));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->size));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->num_inline));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_collector_array(proc, out->num_inline ? out->size : 0, 1, &(out->inline_data));
+}
+
+/* The columns selected by a column fetch are transferred one after the
+ * other, each with room for count samples: the fields of sample i are at
+ * i, count + i, ... in the client's bulk region */
+MERCURY_GEN_PROC(metric_fetch_columns_in_t,
+        ((collector_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((uint32_t)(columns))\
 	((hg_bulk_t)(bulk)))
 
-MERCURY_GEN_PROC(metric_fetch_out_t,
+MERCURY_GEN_PROC(metric_fetch_columns_out_t,
 	((int64_t)(actual_count))\
-	((hg_string_t)(name))\
-	((hg_string_t)(ns))\
+	((uint64_t)(total))\
+	((uint64_t)(first_seq))\
+	((uint64_t)(next_seq))\
         ((int32_t)(ret)))
 
+MERCURY_GEN_PROC(metric_fetch_range_in_t,
+        ((collector_metric_id_t)(metric_id))\
+	((double)(t_start))\
+	((double)(t_end))\
+	((int64_t)(count))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_range_out_t,
+	((int64_t)(actual_count))\
+	((uint64_t)(total))\
+        ((int32_t)(ret)))
+
+/* The points of a downsampled fetch are pushed to the client's bulk,
+ * which has room for count points */
+MERCURY_GEN_PROC(metric_fetch_downsampled_in_t,
+        ((collector_metric_id_t)(metric_id))\
+	((double)(t_start))\
+	((double)(t_end))\
+	((uint32_t)(method))\
+	((int64_t)(count))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_downsampled_out_t,
+	((int64_t)(actual_count))\
+	((uint64_t)(total))\
+        ((int32_t)(ret)))
+
+/* Cursor of an incremental fetch: the number of samples already fetched
+ * from each store of the metric, indexed by store slot (see
+ * collector_metric_store_slots); missing positions are 0 */
+static inline hg_return_t hg_proc_collector_cursor_positions(hg_proc_t proc, hg_size_t* num_positions, uint64_t** positions)
+{
+    hg_return_t ret;
+
+    ret = hg_proc_hg_size_t(proc, num_positions);
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        *positions = *num_positions ? (uint64_t*)calloc(*num_positions, sizeof(uint64_t)) : NULL;
+        if(*num_positions && !*positions) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        if(*num_positions)
+            ret = hg_proc_memcpy(proc, *positions, *num_positions*sizeof(uint64_t));
+        break;
+    case HG_FREE:
+        free(*positions);
+        break;
+    }
+    return ret;
+}
+
+typedef struct metric_fetch_since_in_t {
+    collector_metric_id_t metric_id;
+    int64_t   count;
+    hg_size_t num_positions;
+    uint64_t* positions;
+    hg_bulk_t bulk;
+} metric_fetch_since_in_t;
+
+typedef struct metric_fetch_since_out_t {
+    int64_t   actual_count;
+    uint64_t  dropped; /* samples after the cursor that a ring-mode metric no longer retains */
+    uint64_t  total;   /* samples after the cursor that the metric retains */
+    hg_size_t num_positions;
+    uint64_t* positions;
+    int32_t   ret;
+} metric_fetch_since_out_t;
+
+static inline hg_return_t hg_proc_metric_fetch_since_in_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_since_in_t* in = (metric_fetch_since_in_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_collector_metric_id_t(proc, &(in->metric_id));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_int64_t(proc, &(in->count));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_collector_cursor_positions(proc, &(in->num_positions), &(in->positions));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_hg_bulk_t(proc, &(in->bulk));
+}
+
+static inline hg_return_t hg_proc_metric_fetch_since_out_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_since_out_t* out = (metric_fetch_since_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_int64_t(proc, &(out->actual_count));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(out->dropped));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(out->total));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_collector_cursor_positions(proc, &(out->num_positions), &(out->positions));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_hg_int32_t(proc, &(out->ret));
+}
+
+typedef struct metric_fetch_batch_in_t {
+    hg_size_t num_metrics;
+    collector_metric_id_t* ids;
+    int64_t*  counts;      /* maximum number of samples to fetch from each metric */
+    uint8_t   by_selector; /* fetch the metrics matching ns, name and tags rather than ids */
+    hg_string_t ns;        /* "" for any */
+    hg_string_t name;      /* "" for any */
+    hg_size_t num_tags;
+    char**    tags;
+    int64_t   count;       /* with a selector, maximum number of samples to fetch from each metric */
+    uint64_t  capacity;    /* with a selector, number of samples the client's bulk has room for */
+    hg_bulk_t bulk;        /* room for the sum of the counts, or for capacity samples */
+} metric_fetch_batch_in_t;
+
+static inline hg_return_t hg_proc_metric_fetch_batch_in_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_batch_in_t* in = (metric_fetch_batch_in_t*)data;
+    hg_return_t ret;
+    hg_size_t i;
+
+    ret = hg_proc_hg_size_t(proc, &(in->num_metrics));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_collector_array(proc, in->num_metrics, sizeof(*(in->ids)), (void**)&(in->ids));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_collector_array(proc, in->num_metrics, sizeof(*(in->counts)), (void**)&(in->counts));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint8_t(proc, &(in->by_selector));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(in->ns));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(in->name));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->num_tags));
+    if(ret != HG_SUCCESS) return ret;
+    if(hg_proc_get_op(proc) == HG_DECODE) {
+        in->tags = in->num_tags ? (char**)calloc(in->num_tags, sizeof(char*)) : NULL;
+        if(in->num_tags && !in->tags) return HG_NOMEM;
+    }
+    for(i = 0; i < in->num_tags; i++) {
+        ret = hg_proc_hg_string_t(proc, &(in->tags[i]));
+        if(ret != HG_SUCCESS) return ret;
+    }
+    if(hg_proc_get_op(proc) == HG_FREE)
+        free(in->tags);
+    ret = hg_proc_int64_t(proc, &(in->count));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(in->capacity));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_hg_bulk_t(proc, &(in->bulk));
+}
+
+typedef struct metric_fetch_batch_out_t {
+    int32_t   ret;
+    hg_size_t num_metrics;
+    uint64_t  needed;  /* if the samples of the selected metrics didn't fit in the client's capacity, their number */
+    collector_metric_id_t* ids; /* ids of the metrics, resolved from the selector if any */
+    uint64_t* offsets; /* num_metrics+1 entries: samples of metric i are at [offsets[i], offsets[i+1]) */
+    int32_t*  rets;    /* status of each metric */
+} metric_fetch_batch_out_t;
+
+static inline hg_return_t hg_proc_metric_fetch_batch_out_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_batch_out_t* out = (metric_fetch_batch_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->num_metrics));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(out->needed));
+    if(ret != HG_SUCCESS) return ret;
+    if(out->num_metrics == 0) return HG_SUCCESS;
+    ret = hg_proc_collector_array(proc, out->num_metrics, sizeof(*(out->ids)), (void**)&(out->ids));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_collector_array(proc, out->num_metrics + 1, sizeof(*(out->offsets)), (void**)&(out->offsets));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_collector_array(proc, out->num_metrics, sizeof(*(out->rets)), (void**)&(out->rets));
+}
+
+MERCURY_GEN_PROC(metric_fetch_stats_in_t,
+        ((collector_metric_id_t)(metric_id))\
+	((double)(t_start))\
+	((double)(t_end))\
+	((double)(threshold)))
+
+MERCURY_GEN_PROC(metric_fetch_stats_out_t,
+	((uint64_t)(count))\
+	((uint64_t)(num_above))\
+	((double)(min))\
+	((double)(max))\
+	((double)(sum))\
+	((double)(mean))\
+	((double)(variance))\
+        ((int32_t)(ret)))
+
+/* How the metrics selected by a query are split into series */
+#define QUERY_GROUP_NONE   0 /* one series per metric */
+#define QUERY_GROUP_ALL    1 /* a single series */
+#define QUERY_GROUP_BY_KEY 2 /* one series per label with key group_by */
+
+/* The series of a query are sent as a sequence of records, each made of a
+ * query_series_header, of the label of the group as a null-terminated
+ * string padded to a multiple of 8 bytes (group_len is 0 if there is no
+ * group), and of the num_windows*num_aggs values of the series. */
+typedef struct query_series_header {
+    collector_metric_id_t id;
+    uint64_t              num_metrics;
+    uint32_t              group_len; /* size of the label with its null terminator */
+    uint32_t              reserved;
+} query_series_header;
+
+typedef struct query_in_t {
+    uint8_t               by_id;     /* query metric_id rather than a selector */
+    collector_metric_id_t metric_id;
+    hg_string_t           ns;        /* "" for any */
+    hg_string_t           name;      /* "" for any */
+    hg_size_t             num_tags;
+    char**                tags;
+    uint8_t               grouping;  /* QUERY_GROUP_* */
+    hg_string_t           group_by;  /* key of the labels of the groups, "" if not grouping by key */
+    double                t_start;
+    double                t_end;
+    double                step;
+    hg_size_t             num_aggs;
+    collector_agg*        aggs;
+    hg_size_t             capacity;  /* size of the client's bulk region */
+    hg_bulk_t             bulk;
+} query_in_t;
+
+static inline hg_return_t hg_proc_query_in_t(hg_proc_t proc, void *data)
+{
+    query_in_t* in = (query_in_t*)data;
+    hg_return_t ret;
+    hg_size_t i;
+
+    ret = hg_proc_uint8_t(proc, &(in->by_id));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_uint64_t(proc, &(in->metric_id));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(in->ns));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(in->name));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->num_tags));
+    if(ret != HG_SUCCESS) return ret;
+    if(hg_proc_get_op(proc) == HG_DECODE) {
+        in->tags = in->num_tags ? (char**)calloc(in->num_tags, sizeof(char*)) : NULL;
+        if(in->num_tags && !in->tags) return HG_NOMEM;
+    }
+    for(i = 0; i < in->num_tags; i++) {
+        ret = hg_proc_hg_string_t(proc, &(in->tags[i]));
+        if(ret != HG_SUCCESS) return ret;
+    }
+    if(hg_proc_get_op(proc) == HG_FREE)
+        free(in->tags);
+    ret = hg_proc_uint8_t(proc, &(in->grouping));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_string_t(proc, &(in->group_by));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_double(proc, &(in->t_start));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_double(proc, &(in->t_end));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_double(proc, &(in->step));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->num_aggs));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_collector_array(proc, in->num_aggs, sizeof(*(in->aggs)), (void**)&(in->aggs));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(in->capacity));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_hg_bulk_t(proc, &(in->bulk));
+}
+
+typedef struct query_out_t {
+    int32_t   ret;
+    hg_size_t num_windows;
+    hg_size_t num_series;
+    hg_size_t size;       /* size of the records */
+    hg_size_t needed;     /* if the records didn't fit in the client's capacity, their size */
+    hg_size_t num_inline; /* size of the records sent inline */
+    char*     records;
+} query_out_t;
+
+static inline hg_return_t hg_proc_query_out_t(hg_proc_t proc, void *data)
+{
+    query_out_t* out = (query_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->num_windows));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->num_series));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->size));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->needed));
+    if(ret != HG_SUCCESS) return ret;
+    ret = hg_proc_hg_size_t(proc, &(out->num_inline));
+    if(ret != HG_SUCCESS) return ret;
+    return hg_proc_collector_array(proc, out->num_inline, 1, (void**)&(out->records));
+}
+
+MERCURY_GEN_PROC(metric_fetch_histogram_in_t,
+        ((collector_metric_id_t)(metric_id)))
+
+typedef struct metric_fetch_histogram_out_t {
+    int32_t ret;
+    hg_size_t num_bounds;
+    double* bounds;
+    uint64_t* counts; /* num_bounds+1 buckets */
+} metric_fetch_histogram_out_t;
+
+static inline hg_return_t hg_proc_metric_fetch_histogram_out_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_histogram_out_t* out = (metric_fetch_histogram_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->num_bounds));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        out->bounds = (double*)calloc(out->num_bounds, sizeof(*(out->bounds)));
+        out->counts = (uint64_t*)calloc(out->num_bounds + 1, sizeof(*(out->counts)));
+        /* fall through */
+    case HG_ENCODE:
+        if(out->bounds)
+            ret = hg_proc_memcpy(proc, out->bounds, sizeof(*(out->bounds))*out->num_bounds);
+        if(ret != HG_SUCCESS) return ret;
+        if(out->counts)
+            ret = hg_proc_memcpy(proc, out->counts, sizeof(*(out->counts))*(out->num_bounds + 1));
+        break;
+    case HG_FREE:
+        free(out->bounds);
+        free(out->counts);
+        break;
+    }
+    return ret;
+}
+
+MERCURY_GEN_PROC(metric_fetch_sketch_in_t,
+        ((collector_metric_id_t)(metric_id)))
+
+typedef struct metric_fetch_sketch_out_t {
+    int32_t ret;
+    hg_size_t size;
+    void* buf; /* see collector_sketch_serialize */
+} metric_fetch_sketch_out_t;
+
+static inline hg_return_t hg_proc_metric_fetch_sketch_out_t(hg_proc_t proc, void *data)
+{
+    metric_fetch_sketch_out_t* out = (metric_fetch_sketch_out_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_int32_t(proc, &(out->ret));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(out->size));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        out->buf = out->size ? malloc(out->size) : NULL;
+        /* fall through */
+    case HG_ENCODE:
+        if(out->buf)
+            ret = hg_proc_memcpy(proc, out->buf, out->size);
+        break;
+    case HG_FREE:
+        free(out->buf);
+        break;
+    }
+    return ret;
+}
+
 /* Extra hand-coded serialization functions */
 
 static inline hg_return_t hg_proc_collector_metric_id_t(
@@ -74,19 +616,97 @@ static inline hg_return_t hg_proc_collector_metric_id_t(
     return hg_proc_memcpy(proc, id, sizeof(*id));
 }
 
+/* Maximum number of per-execution-stream shards of a sharded metric;
+ * execution streams with a higher rank use the metric's locked store */
+#define COLLECTOR_MAX_SHARDS 64
+
+/**
+ * @brief Descriptive metadata of a metric, only read when listing,
+ * creating or destroying metrics, and kept out of the cache lines
+ * touched by updates and lookups.
+ */
+typedef struct collector_metric_cold {
+    /* identity of the metric, as ids of strings interned in the provider's
+     * table (see intern.h): two metrics are the same if these are equal */
+    uint32_t                  ns;
+    uint32_t                  name;
+    const collector_labelset* labels;
+    const collector_intern*   strings; /* the provider's table, to dump the metric */
+    char                      desc[200];
+} collector_metric_cold;
+
+/**
+ * @brief A metric, allocated from the provider's slab (see slab.h) so that
+ * metrics are packed together without sharing cache lines. The first
+ * cache line holds everything an update needs, the second one the
+ * type-specific and sampling state and what lookups compare, the third
+ * one the cold part and the hash handle.
+ */
 typedef struct collector_metric {
+    collector_sample_store store; /* segmented sample storage */
+    collector_sample_store** shards; /* per-ES stores indexed by ES rank, NULL if not sharded */
+    double value; /* current value of a sampled metric or running value of a sharded gauge, updated atomically */
     collector_metric_type_t type;
-    collector_metric_buffer buffer;
-    unsigned int buffer_index;
-    char desc[200];
-    char name[36];
-    char ns[36];
-    collector_taglist_t taglist;
+    ABT_mutex metric_mutex; /* Needed because metric can be updated simulateneously by many ULTs */
+
+    collector_histogram* histogram __attribute__((aligned(COLLECTOR_CACHE_LINE_SIZE))); /* bucket counts of a COLLECTOR_TYPE_HISTOGRAM metric */
+    collector_sketch* sketch; /* quantile sketch of a COLLECTOR_TYPE_SKETCH metric */
+    collector_rollup* rollup; /* rollup tiers of a ring-mode metric, NULL if none */
+    double sampling_period; /* > 0 if value is snapshotted into the store by the provider's sampler */
+    double next_sample_time;
+    struct collector_metric* next_sampled; /* link in the provider's list of sampled metrics */
     collector_metric_id_t id;
+    uint64_t serial; /* creation order in the provider, used as list pagination token */
+
+    collector_metric_cold* cold;
     UT_hash_handle      hh;
-    ABT_mutex metric_mutex; /* Needed because metric can be updated simulateneously by many ULTs */
-} collector_metric;
+} __attribute__((aligned(COLLECTOR_CACHE_LINE_SIZE))) collector_metric;
+
+_Static_assert(offsetof(collector_metric, metric_mutex) + sizeof(ABT_mutex) <= COLLECTOR_CACHE_LINE_SIZE,
+               "the update state of a metric must fit in its first cache line");
 
 typedef collector_metric* collector_metric_t;
 
+/**
+ * @brief Atomically adds diff to *p and returns the new value.
+ */
+static inline double collector_atomic_add_double(double* p, double diff)
+{
+    double old_val, new_val;
+    __atomic_load(p, &old_val, __ATOMIC_RELAXED);
+    do {
+        new_val = old_val + diff;
+    } while(!__atomic_compare_exchange(p, &old_val, &new_val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return new_val;
+}
+
+/**
+ * @brief Fills stores (which must have room for COLLECTOR_MAX_SHARDS+1
+ * entries) with the sample stores of a metric: its own store followed
+ * by the shards created so far. Returns the number of stores.
+ *
+ * If slots is not NULL, it is filled with a stable index for each store:
+ * 0 for the metric's own store, 1+rank for the shard of rank rank.
+ */
+static inline size_t collector_metric_store_slots(const collector_metric* m, collector_sample_store** stores, size_t* slots)
+{
+    size_t i, n = 0;
+    if(slots) slots[n] = 0;
+    stores[n++] = (collector_sample_store*)&m->store;
+    if(m->shards) {
+        for(i = 0; i < COLLECTOR_MAX_SHARDS; i++) {
+            collector_sample_store* shard = __atomic_load_n(&m->shards[i], __ATOMIC_ACQUIRE);
+            if(!shard) continue;
+            if(slots) slots[n] = i + 1;
+            stores[n++] = shard;
+        }
+    }
+    return n;
+}
+
+static inline size_t collector_metric_stores(const collector_metric* m, collector_sample_store** stores)
+{
+    return collector_metric_store_slots(m, stores, NULL);
+}
+
 #endif
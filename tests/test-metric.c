@@ -0,0 +1,1425 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <margo.h>
+#include <collector/collector-server.h>
+#include <collector/collector-client.h>
+#include <collector/collector-metric.h>
+#include <collector/collector-dump.h>
+#include "munit/munit.h"
+#include "types.h"
+#include "encoding.h"
+
+struct test_context {
+    margo_instance_id     mid;
+    hg_addr_t             addr;
+    collector_provider_t  provider;
+    collector_client_t    client;
+    collector_taglist_t   taglist;
+};
+
+static const uint16_t provider_id = 42;
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    collector_return_t ret;
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    // create margo instance
+    context->mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(context->mid);
+    // get address of current process
+    hg_return_t hret = margo_addr_self(context->mid, &context->addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register collector provider
+    struct collector_provider_args args = COLLECTOR_PROVIDER_ARGS_INIT;
+    ret = collector_provider_register(
+            context->mid, provider_id, &args,
+            &context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // create a client
+    ret = collector_client_init(context->mid, &context->client);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // create a taglist shared by the metrics of the tests
+    ret = collector_taglist_create(&context->taglist, 2, "tag1", "tag2");
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    collector_metric_destroy_all(context->provider);
+    collector_taglist_destroy(context->taglist);
+    collector_client_finalize(context->client);
+    margo_addr_free(context->mid, context->addr);
+    margo_finalize(context->mid);
+    free(context);
+}
+
+static collector_metric_handle_t open_metric(struct test_context* context, const char* name)
+{
+    collector_metric_id_t id;
+    collector_metric_handle_t rh;
+    collector_return_t ret;
+    ret = collector_remote_metric_get_id("test", (char*)name, context->taglist, &id);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    return rh;
+}
+
+static MunitResult test_fetch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    // create a metric and record more samples than fit in a chunk
+    ret = collector_metric_create("test", "fetch", COLLECTOR_TYPE_GAUGE,
+            "unbounded metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // fetch the latest samples across chunk boundaries
+    collector_metric_handle_t rh = open_metric(context, "fetch");
+    int64_t count = 5000;
+    collector_metric_buffer buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 5000);
+    munit_assert_string_equal(name, "fetch");
+    munit_assert_string_equal(ns, "test");
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(5000 + i));
+    free(buf);
+    free(name);
+    free(ns);
+    // small fetches are sent inline in the response
+    count = 10;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 10);
+    munit_assert_string_equal(name, "fetch");
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(9990 + i));
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+    // names of any length are returned whole
+    const char* long_name = "a_metric_name_longer_than_thirty_six_characters";
+    ret = collector_metric_create("test", long_name, COLLECTOR_TYPE_GAUGE,
+            "long name", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    collector_metric_update(m, 1.0);
+    rh = open_metric(context, long_name);
+    count = 10;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 1);
+    munit_assert_string_equal(name, long_name);
+    munit_assert_string_equal(ns, "test");
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_encodings(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i, k;
+    ret = collector_metric_create("test", "encodings", COLLECTOR_TYPE_GAUGE,
+            "encoded metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, (double)(i / 10));
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    ret = collector_client_set_fetch_encodings(context->client, 0x100);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    // raw, delta and Gorilla transfers, with a bulk and inline, decode to
+    // the same samples, the regular series being sent encoded when allowed
+    collector_metric_handle_t rh = open_metric(context, "encodings");
+    uint32_t encodings[] = { COLLECTOR_ENCODING_RAW, COLLECTOR_ENCODING_DELTA, COLLECTOR_ENCODING_ALL };
+    int64_t counts[] = { 10000, 100 };
+    for(k = 0; k < 2; k++) {
+        collector_metric_buffer ref = NULL;
+        for(i = 0; i < 3; i++) {
+            int64_t count = counts[k];
+            collector_metric_buffer buf;
+            char *name, *ns;
+            ret = collector_client_set_fetch_encodings(context->client, encodings[i]);
+            munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+            ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+            munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+            munit_assert_int(count, ==, counts[k]);
+            munit_assert_double(buf[count-1].val, ==, 999.0);
+            // the encoding the provider picks for these samples
+            uint32_t encoding;
+            size_t size;
+            void* encoded = collector_encode_best(encodings[i], buf, count, &encoding, &size);
+            if(encodings[i] == COLLECTOR_ENCODING_ALL)
+                munit_assert_uint32(encoding, !=, COLLECTOR_ENCODING_RAW);
+            else
+                munit_assert_uint32(encoding, ==, encodings[i]);
+            free(encoded);
+            if(ref) {
+                munit_assert_memory_equal(count*sizeof(*buf), buf, ref);
+                free(buf);
+            } else
+                ref = buf;
+            free(name);
+            free(ns);
+        }
+        free(ref);
+    }
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_range(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    ret = collector_metric_create("test", "range", COLLECTOR_TYPE_GAUGE,
+            "unbounded metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++)
+        collector_metric_update(m, (double)i);
+    // get the timestamps of all the samples
+    collector_metric_handle_t rh = open_metric(context, "range");
+    int64_t count = 10000;
+    collector_metric_buffer all, buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch(rh, &count, &all, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    free(name);
+    free(ns);
+    double t_start = all[2000].time;
+    double t_end   = all[7000].time;
+    int64_t expected = 0, first = -1;
+    for(i = 0; i < 10000; i++) {
+        if(all[i].time < t_start || all[i].time >= t_end) continue;
+        if(first < 0) first = i;
+        expected++;
+    }
+    // fetch the whole range without knowing its size
+    count = -1;
+    ret = collector_remote_metric_fetch_range(rh, t_start, t_end, &count, &buf);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, expected);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, all[first + i].val);
+    free(buf);
+    // fetch the beginning of the range
+    count = 10;
+    ret = collector_remote_metric_fetch_range(rh, t_start, t_end, &count, &buf);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 10);
+    munit_assert_double(buf[0].val, ==, all[first].val);
+    free(buf);
+    free(all);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_downsampled(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i, k, found;
+    // a ramp with a single peak
+    ret = collector_metric_create("test", "downsampled", COLLECTOR_TYPE_GAUGE,
+            "downsampled metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, i == 5000 ? 1e6 : (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    collector_metric_handle_t rh = open_metric(context, "downsampled");
+    collector_metric_buffer buf;
+    int64_t num_points = 0;
+    ret = collector_remote_metric_fetch_downsampled(rh, -INFINITY, INFINITY, COLLECTOR_DOWNSAMPLE_LTTB, &num_points, &buf);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    // both methods keep the peak, in at most the requested number of points
+    uint32_t methods[] = { COLLECTOR_DOWNSAMPLE_LTTB, COLLECTOR_DOWNSAMPLE_MINMAX };
+    for(k = 0; k < 2; k++) {
+        num_points = 100;
+        ret = collector_remote_metric_fetch_downsampled(rh, -INFINITY, INFINITY, methods[k], &num_points, &buf);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        munit_assert_int(num_points, <=, 100);
+        munit_assert_int(num_points, >=, 50);
+        munit_assert_double(buf[0].val, ==, 0);
+        for(i = 0, found = 0; i < num_points; i++) {
+            if(buf[i].val == 1e6) found = 1;
+            if(i) munit_assert_double(buf[i].time, >=, buf[i-1].time);
+        }
+        munit_assert_true(found);
+        free(buf);
+    }
+    // LTTB keeps the first and last samples
+    num_points = 100;
+    ret = collector_remote_metric_fetch_downsampled(rh, -INFINITY, INFINITY, COLLECTOR_DOWNSAMPLE_LTTB, &num_points, &buf);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_points, ==, 100);
+    munit_assert_double(buf[99].val, ==, 9999);
+    free(buf);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_dump(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    char filename[] = "/tmp/test-metric-dump-XXXXXX";
+    collector_metric_t m, e;
+    collector_return_t ret;
+    collector_dump_t dump;
+    collector_dump_info info;
+    const double *time, *val;
+    const uint64_t* sample_id;
+    uint64_t c, i, n, count;
+    double prev = -INFINITY;
+    // more samples than fit in a chunk, the last one being partial
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.columnar = 1;
+    ret = collector_metric_create_ext("test", "dump", COLLECTOR_TYPE_GAUGE,
+            "dumped metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    int fd = mkstemp(filename);
+    munit_assert_int(fd, >=, 0);
+    close(fd);
+    ret = collector_metric_dump_raw_data(m, filename);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // the dump holds the metadata and, chunk by chunk, the samples in order
+    ret = collector_dump_open(filename, &dump);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_dump_get_info(dump, &info);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_string_equal(info.ns, "test");
+    munit_assert_string_equal(info.name, "dump");
+    munit_assert_string_equal(info.desc, "dumped metric");
+    munit_assert_int(info.type, ==, COLLECTOR_TYPE_GAUGE);
+    munit_assert_int(info.num_samples, ==, 10000);
+    munit_assert_int(info.num_tags, ==, 2);
+    munit_assert_string_equal(info.tags[0], "tag1");
+    munit_assert_string_equal(info.tags[1], "tag2");
+    for(c = 0, count = 0; c < info.num_chunks; c++) {
+        n = collector_dump_chunk(dump, c, &time, &val, &sample_id);
+        munit_assert_int(n, >, 0);
+        for(i = 0; i < n; i++, count++) {
+            munit_assert_double(val[i], ==, (double)count);
+            munit_assert_double(time[i], >=, prev);
+            prev = time[i];
+        }
+    }
+    munit_assert_int(count, ==, 10000);
+    munit_assert_int(collector_dump_chunk(dump, info.num_chunks, &time, &val, &sample_id), ==, 0);
+    collector_dump_close(dump);
+    // an empty metric has an empty dump
+    ret = collector_metric_create("test", "empty", COLLECTOR_TYPE_GAUGE,
+            "", NULL, &e, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_dump_raw_data(e, filename);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_dump_open(filename, &dump);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    collector_dump_get_info(dump, &info);
+    munit_assert_int(info.num_samples, ==, 0);
+    munit_assert_int(info.num_chunks, ==, 0);
+    munit_assert_int(info.num_tags, ==, 0);
+    collector_dump_close(dump);
+    remove(filename);
+    // missing files aren't dumps
+    ret = collector_dump_open(filename, &dump);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_IO);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_since(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m, r;
+    collector_return_t ret;
+    collector_cursor_t cursor;
+    collector_metric_buffer buf;
+    int64_t count;
+    uint64_t dropped;
+    int i;
+    ret = collector_metric_create("test", "since", COLLECTOR_TYPE_GAUGE,
+            "unbounded metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 100; i++)
+        collector_metric_update(m, (double)i);
+    // the first fetch returns everything
+    collector_metric_handle_t rh = open_metric(context, "since");
+    collector_cursor_create(&cursor);
+    count = 1000;
+    ret = collector_remote_metric_fetch_since(rh, cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 100);
+    munit_assert_int(dropped, ==, 0);
+    free(buf);
+    // the next ones only the new samples
+    for(i = 100; i < 150; i++)
+        collector_metric_update(m, (double)i);
+    count = 1000;
+    ret = collector_remote_metric_fetch_since(rh, cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 50);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(100 + i));
+    free(buf);
+    count = 1000;
+    ret = collector_remote_metric_fetch_since(rh, cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 0);
+    free(buf);
+    // fetching all of them sizes the buffer from the provider's count
+    for(i = 150; i < 5150; i++)
+        collector_metric_update(m, (double)i);
+    count = 0;
+    ret = collector_remote_metric_fetch_since(rh, cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 5000);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(150 + i));
+    free(buf);
+    count = 0;
+    ret = collector_remote_metric_fetch_since(rh, cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 0);
+    free(buf);
+    collector_cursor_destroy(cursor);
+    collector_remote_metric_handle_release(rh);
+    // samples a ring-mode metric no longer has are reported as dropped
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.max_samples = 100;
+    ret = collector_metric_create_ext("test", "since_ring", COLLECTOR_TYPE_GAUGE,
+            "ring metric", context->taglist, &args, &r, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 250; i++)
+        collector_metric_update(r, (double)i);
+    rh = open_metric(context, "since_ring");
+    collector_cursor_create(&cursor);
+    count = 1000;
+    ret = collector_remote_metric_fetch_since(rh, cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 100);
+    munit_assert_int(dropped, ==, 150);
+    munit_assert_double(buf[0].val, ==, 150.0);
+    free(buf);
+    collector_cursor_destroy(cursor);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_batch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m1, m2;
+    collector_return_t ret;
+    int i;
+    ret = collector_metric_create("test", "batch1", COLLECTOR_TYPE_GAUGE,
+            "batch metric", context->taglist, &m1, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_create("test", "batch2", COLLECTOR_TYPE_GAUGE,
+            "batch metric", context->taglist, &m2, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 50; i++) {
+        collector_metric_update(m1, (double)i);
+        collector_metric_update(m2, (double)(1000 + i));
+    }
+    // fetch both metrics and an unknown one at once
+    collector_metric_id_t ids[3];
+    int64_t counts[3] = { 10, 10, 100 };
+    uint64_t offsets[4];
+    collector_return_t rets[3];
+    collector_metric_buffer buf;
+    collector_remote_metric_get_id("test", "batch1", context->taglist, &ids[0]);
+    collector_remote_metric_get_id("test", "unknown", context->taglist, &ids[1]);
+    collector_remote_metric_get_id("test", "batch2", context->taglist, &ids[2]);
+    ret = collector_remote_metric_fetch_batch(context->client, context->addr, provider_id,
+            3, ids, counts, &buf, offsets, rets);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(rets[0], ==, COLLECTOR_SUCCESS);
+    munit_assert_int(rets[1], ==, COLLECTOR_ERR_INVALID_METRIC);
+    munit_assert_int(rets[2], ==, COLLECTOR_SUCCESS);
+    munit_assert_int(offsets[0], ==, 0);
+    munit_assert_int(offsets[1], ==, 10);
+    munit_assert_int(offsets[2], ==, 10);
+    munit_assert_int(offsets[3], ==, 60);
+    munit_assert_double(buf[0].val, ==, 40.0);
+    munit_assert_double(buf[offsets[2]].val, ==, 1000.0);
+    munit_assert_double(buf[offsets[3]-1].val, ==, 1049.0);
+    free(buf);
+    // counts adding up to more than a batch may hold are rejected
+    int64_t large[3] = { INT64_MAX, INT64_MAX, INT64_MAX };
+    ret = collector_remote_metric_fetch_batch(context->client, context->addr, provider_id,
+            3, ids, large, &buf, offsets, rets);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    // fetch the metrics matching a selector, which the provider resolves
+    size_t num_metrics;
+    collector_metric_id_t* selected;
+    uint64_t* sel_offsets;
+    ret = collector_remote_metric_fetch_batch_select(context->client, context->addr, provider_id,
+            "test", NULL, context->taglist, 10, &num_metrics, &selected, &buf, &sel_offsets);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_metrics, ==, 2);
+    munit_assert_int(selected[0], ==, ids[0]);
+    munit_assert_int(selected[1], ==, ids[2]);
+    munit_assert_int(sel_offsets[1], ==, 10);
+    munit_assert_int(sel_offsets[2], ==, 20);
+    munit_assert_double(buf[0].val, ==, 40.0);
+    munit_assert_double(buf[10].val, ==, 1040.0);
+    free(selected);
+    free(sel_offsets);
+    free(buf);
+    ret = collector_remote_metric_fetch_batch_select(context->client, context->addr, provider_id,
+            NULL, "batch2", NULL, 100, &num_metrics, &selected, &buf, &sel_offsets);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_metrics, ==, 1);
+    munit_assert_int(selected[0], ==, ids[2]);
+    munit_assert_int(sel_offsets[1], ==, 50);
+    free(selected);
+    free(sel_offsets);
+    free(buf);
+    ret = collector_remote_metric_fetch_batch_select(context->client, context->addr, provider_id,
+            "none", NULL, NULL, 10, &num_metrics, &selected, &buf, &sel_offsets);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_metrics, ==, 0);
+    munit_assert_int(sel_offsets[0], ==, 0);
+    free(selected);
+    free(sel_offsets);
+    free(buf);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_async(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m1, m2;
+    collector_return_t ret;
+    int i;
+    ret = collector_metric_create("test", "async1", COLLECTOR_TYPE_GAUGE,
+            "async metric", context->taglist, &m1, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_create("test", "async2", COLLECTOR_TYPE_GAUGE,
+            "async metric", context->taglist, &m2, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 200; i++) {
+        collector_metric_update(m1, 1.0);
+        collector_metric_update(m2, 2.0);
+    }
+    // two fetches in flight
+    collector_metric_handle_t rh[2] = { open_metric(context, "async1"), open_metric(context, "async2") };
+    collector_request_t reqs[2];
+    int64_t counts[2] = { 10, 150 };
+    collector_metric_buffer bufs[2];
+    char *names[2], *nss[2];
+    for(i = 0; i < 2; i++) {
+        ret = collector_remote_metric_ifetch(rh[i], &counts[i], &bufs[i], &names[i], &nss[i], &reqs[i]);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    for(i = 0; i < 2; i++) {
+        size_t index;
+        ret = collector_request_wait_any(2, reqs, &index);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        munit_assert_int(index, <, 2);
+        munit_assert_null(reqs[index]);
+    }
+    munit_assert_int(counts[0], ==, 10);
+    munit_assert_int(counts[1], ==, 150);
+    munit_assert_double(bufs[0][9].val, ==, 1.0);
+    munit_assert_double(bufs[1][149].val, ==, 2.0);
+    munit_assert_string_equal(names[1], "async2");
+    for(i = 0; i < 2; i++) {
+        free(bufs[i]);
+        free(names[i]);
+        free(nss[i]);
+        collector_remote_metric_handle_release(rh[i]);
+    }
+    // non-blocking list
+    collector_metric_id_t ids[8];
+    collector_metric_id_t* p = ids;
+    size_t count = 8;
+    collector_request_t req;
+    int flag = 0;
+    ret = collector_remote_ilist_metrics(context->client, context->addr, provider_id, &p, &count, &req);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    while(!flag) {
+        ret = collector_request_test(req, &flag);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        if(!flag) margo_thread_sleep(context->mid, 1);
+    }
+    ret = collector_request_wait(req);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 2);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_list(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m[5];
+    collector_taglist_t other_tags;
+    collector_return_t ret;
+    char name[16];
+    int i;
+    ret = collector_taglist_create(&other_tags, 2, "tag1", "tag3");
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 4; i++) {
+        sprintf(name, "list%d", i);
+        ret = collector_metric_create("test", name, COLLECTOR_TYPE_GAUGE,
+                "list metric", context->taglist, &m[i], context->provider);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        collector_metric_update(m[i], 1.0);
+    }
+    ret = collector_metric_create("other", "list4", COLLECTOR_TYPE_COUNTER,
+            "list metric", other_tags, &m[4], context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // pages of 2 metrics of namespace "test", sent inline
+    uint64_t token = COLLECTOR_LIST_BEGIN;
+    collector_metric_info* infos;
+    size_t count, total = 0;
+    while(token != COLLECTOR_LIST_END) {
+        count = 2;
+        ret = collector_remote_list_metrics_ext(context->client, context->addr, provider_id,
+                "test", NULL, &token, &count, &infos);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        munit_assert_int(count, <=, 2);
+        for(i = 0; i < (int)count; i++) {
+            sprintf(name, "list%d", (int)total + i);
+            munit_assert_string_equal(infos[i].name, name);
+            munit_assert_string_equal(infos[i].ns, "test");
+            munit_assert_int(infos[i].type, ==, COLLECTOR_TYPE_GAUGE);
+            munit_assert_int(infos[i].num_samples, ==, 1);
+            munit_assert_int(infos[i].num_tags, ==, 2);
+            munit_assert_string_equal(infos[i].tags[1], "tag2");
+        }
+        total += count;
+        free(infos);
+    }
+    munit_assert_int(total, ==, 4);
+    // all the metrics with tag3 in a single page, sent with a bulk transfer
+    token = COLLECTOR_LIST_BEGIN;
+    count = 0;
+    collector_taglist_t filter;
+    collector_taglist_create(&filter, 1, "tag3");
+    ret = collector_remote_list_metrics_ext(context->client, context->addr, provider_id,
+            NULL, filter, &token, &count, &infos);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 1);
+    munit_assert_uint64(token, ==, COLLECTOR_LIST_END);
+    munit_assert_string_equal(infos[0].name, "list4");
+    munit_assert_string_equal(infos[0].tags[1], "tag3");
+    free(infos);
+    // destroyed metrics are no longer selected
+    ret = collector_metric_destroy(m[4], context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    token = COLLECTOR_LIST_BEGIN;
+    count = 0;
+    ret = collector_remote_list_metrics_ext(context->client, context->addr, provider_id,
+            NULL, filter, &token, &count, &infos);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 0);
+    free(infos);
+    collector_taglist_destroy(filter);
+    // the list of ids is limited to the requested count
+    collector_metric_id_t ids[3];
+    collector_metric_id_t* p = ids;
+    count = 3;
+    ret = collector_remote_list_metrics(context->client, context->addr, provider_id, &p, &count);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 3);
+
+    collector_metric_destroy_all(context->provider);
+    collector_taglist_destroy(other_tags);
+    return MUNIT_OK;
+}
+
+static MunitResult test_ids(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_taglist_t permuted, duplicated;
+    collector_metric_id_t id1, id2, id3;
+    collector_metric_t m1, m2;
+    collector_return_t ret;
+    collector_taglist_create(&permuted, 2, "tag2", "tag1");
+    collector_taglist_create(&duplicated, 4, "tag1", "tag1", "tag2", "tag2");
+    // tags are unordered, but duplicates don't cancel out
+    collector_remote_metric_get_id("test", "ids", context->taglist, &id1);
+    collector_remote_metric_get_id("test", "ids", permuted, &id2);
+    collector_remote_metric_get_id("test", "ids", duplicated, &id3);
+    munit_assert_uint64(id1, ==, id2);
+    munit_assert_uint64(id1, !=, id3);
+    collector_remote_metric_get_id("ids", "test", context->taglist, &id3);
+    munit_assert_uint64(id1, !=, id3);
+    // the same metric can't be created twice
+    ret = collector_metric_create("test", "ids", COLLECTOR_TYPE_GAUGE,
+            "ids metric", context->taglist, &m1, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_create("test", "ids", COLLECTOR_TYPE_GAUGE,
+            "ids metric", permuted, &m2, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_METRIC_EXISTS);
+    ret = collector_metric_create("test", "ids", COLLECTOR_TYPE_GAUGE,
+            "ids metric", duplicated, &m2, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // and the client-side id addresses the provider's metric
+    collector_metric_update(m1, 3.0);
+    collector_metric_handle_t rh = open_metric(context, "ids");
+    collector_metric_buffer buf;
+    char *name, *ns;
+    int64_t count = 1;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 1);
+    munit_assert_double(buf[0].val, ==, 3.0);
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+
+    collector_metric_destroy_all(context->provider);
+    collector_taglist_destroy(permuted);
+    collector_taglist_destroy(duplicated);
+    return MUNIT_OK;
+}
+
+static MunitResult test_labels(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_taglist_t labels1, labels2, filter;
+    collector_metric_t m1, m2;
+    collector_return_t ret;
+    ret = collector_taglist_create_labels(&labels1, 2, "rpc", "put", "rank", "0");
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_taglist_create_labels(&labels2, 2, "rank", "0", "rpc", "get");
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_string_equal(labels1->taglist[0], "rpc=put");
+    ret = collector_taglist_create_labels(&filter, 1, "rpc=", "put");
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    ret = collector_metric_create("test", "labels", COLLECTOR_TYPE_GAUGE,
+            "labels metric", labels1, &m1, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_create("test", "labels", COLLECTOR_TYPE_GAUGE,
+            "labels metric", labels2, &m2, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // select by label
+    uint64_t token = COLLECTOR_LIST_BEGIN;
+    size_t count = 0;
+    collector_metric_info* infos;
+    collector_taglist_create_labels(&filter, 1, "rpc", "get");
+    ret = collector_remote_list_metrics_ext(context->client, context->addr, provider_id,
+            "test", filter, &token, &count, &infos);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 1);
+    munit_assert_int(infos[0].num_tags, ==, 2);
+    munit_assert_true(strcmp(infos[0].tags[0], "rpc=get") == 0 || strcmp(infos[0].tags[1], "rpc=get") == 0);
+    free(infos);
+    // fetches select through the index too, which forgets destroyed metrics
+    collector_taglist_t rank;
+    size_t num_metrics;
+    collector_metric_id_t* ids;
+    collector_metric_id_t id1, id2;
+    collector_metric_buffer buf;
+    uint64_t* offsets;
+    collector_remote_metric_get_id("test", "labels", labels1, &id1);
+    collector_remote_metric_get_id("test", "labels", labels2, &id2);
+    collector_taglist_create_labels(&rank, 1, "rank", "0");
+    collector_metric_update(m1, 1.0);
+    collector_metric_update(m2, 2.0);
+    ret = collector_remote_metric_fetch_batch_select(context->client, context->addr, provider_id,
+            "test", "labels", rank, 10, &num_metrics, &ids, &buf, &offsets);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_metrics, ==, 2);
+    munit_assert_int(ids[0], ==, id1);
+    munit_assert_int(ids[1], ==, id2);
+    free(ids);
+    free(buf);
+    free(offsets);
+    ret = collector_metric_destroy(m1, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_remote_metric_fetch_batch_select(context->client, context->addr, provider_id,
+            "test", "labels", rank, 10, &num_metrics, &ids, &buf, &offsets);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_metrics, ==, 1);
+    munit_assert_double(buf[0].val, ==, 2.0);
+    free(ids);
+    free(buf);
+    free(offsets);
+    collector_taglist_destroy(rank);
+
+    collector_metric_destroy_all(context->provider);
+    collector_taglist_destroy(filter);
+    collector_taglist_destroy(labels1);
+    collector_taglist_destroy(labels2);
+    return MUNIT_OK;
+}
+
+static MunitResult test_columns(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m, r;
+    collector_return_t ret;
+    int i;
+    // a columnar metric, and a row one, recording more samples than fit in a chunk
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.columnar = 1;
+    ret = collector_metric_create_ext("test", "columns", COLLECTOR_TYPE_GAUGE,
+            "columnar metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_create("test", "rows", COLLECTOR_TYPE_GAUGE,
+            "row metric", context->taglist, &r, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        ret = collector_metric_update(r, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // regular fetches return records whatever the layout
+    collector_metric_handle_t rh = open_metric(context, "columns");
+    int64_t count = 5000;
+    collector_metric_buffer buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 5000);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(5000 + i));
+    free(name);
+    free(ns);
+    // only the requested columns are fetched
+    double *times = NULL, *vals = NULL;
+    uint64_t *ids = NULL;
+    count = 5000;
+    ret = collector_remote_metric_fetch_columns(rh, &count, COLLECTOR_COLUMN_TIME | COLLECTOR_COLUMN_VAL,
+            &times, &vals, &ids);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 5000);
+    munit_assert_null(ids);
+    for(i = 0; i < count; i++) {
+        munit_assert_double(vals[i], ==, (double)(5000 + i));
+        munit_assert_double(times[i], ==, buf[i].time);
+    }
+    free(times);
+    free(vals);
+    free(buf);
+    collector_remote_metric_handle_release(rh);
+    // a row metric's columns are split by the provider
+    rh = open_metric(context, "rows");
+    count = 10;
+    times = vals = NULL;
+    ret = collector_remote_metric_fetch_columns(rh, &count, COLLECTOR_COLUMN_VAL, &times, &vals, &ids);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 10);
+    munit_assert_null(times);
+    for(i = 0; i < count; i++)
+        munit_assert_double(vals[i], ==, (double)(9990 + i));
+    free(vals);
+    // fetching all the samples sizes the arrays from the provider's count
+    count = 0;
+    vals = NULL;
+    ret = collector_remote_metric_fetch_columns(rh, &count, COLLECTOR_COLUMN_VAL | COLLECTOR_COLUMN_SAMPLE_ID,
+            &times, &vals, &ids);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 10000);
+    munit_assert_not_null(ids);
+    for(i = 0; i < count; i++)
+        munit_assert_double(vals[i], ==, (double)i);
+    free(vals);
+    free(ids);
+    ret = collector_remote_metric_fetch_columns(rh, &count, 0, &times, &vals, &ids);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_stats(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    // values 0..9999 in a columnar metric
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.columnar = 1;
+    ret = collector_metric_create_ext("test", "stats", COLLECTOR_TYPE_GAUGE,
+            "summarized metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // summarize all the samples on the provider
+    collector_metric_handle_t rh = open_metric(context, "stats");
+    collector_metric_stats stats;
+    ret = collector_remote_metric_fetch_stats(rh, -INFINITY, INFINITY, 8999.5, &stats);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_uint64(stats.count, ==, 10000);
+    munit_assert_uint64(stats.num_above, ==, 1000);
+    munit_assert_double(stats.min, ==, 0);
+    munit_assert_double(stats.max, ==, 9999);
+    munit_assert_double_equal(stats.sum, 49995000.0, 6);
+    munit_assert_double_equal(stats.mean, 4999.5, 6);
+    // variance of 0..n-1 is (n^2-1)/12
+    munit_assert_double_equal(stats.variance, (10000.0*10000.0 - 1)/12, 6);
+    // a time range without samples
+    ret = collector_remote_metric_fetch_stats(rh, -INFINITY, 0, 0, &stats);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_uint64(stats.count, ==, 0);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_query(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    size_t num_windows, num_series, w;
+    int i, h;
+    // values 0..999 on host a and 1000..1999 on host b
+    double t_start = ABT_get_wtime();
+    for(h = 0; h < 2; h++) {
+        collector_taglist_t tags;
+        ret = collector_taglist_create(&tags, 1, h ? "host=b" : "host=a");
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        ret = collector_metric_create("test", "query", COLLECTOR_TYPE_GAUGE,
+                "queried metric", tags, &m, context->provider);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        for(i = 0; i < 1000; i++) {
+            ret = collector_metric_update(m, (double)(1000*h + i));
+            munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        }
+        collector_taglist_destroy(tags);
+    }
+    double t_end = ABT_get_wtime() + 1;
+    collector_agg aggs[] = {
+        { COLLECTOR_AGG_COUNT, 0 }, { COLLECTOR_AGG_SUM, 0 }, { COLLECTOR_AGG_MIN, 0 },
+        { COLLECTOR_AGG_MAX, 0 }, { COLLECTOR_AGG_AVG, 0 }, { COLLECTOR_AGG_QUANTILE, 0.5 }
+    };
+    // a single window over all the samples of one metric
+    collector_metric_id_t id;
+    collector_metric_handle_t rh;
+    collector_taglist_t tags;
+    ret = collector_taglist_create(&tags, 1, "host=a");
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_remote_metric_get_id("test", "query", tags, &id);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    collector_taglist_destroy(tags);
+    ret = collector_remote_metric_handle_create(context->client, context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    double* values;
+    ret = collector_remote_metric_query(rh, t_start, t_end, t_end - t_start, 6, aggs, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_size(num_windows, ==, 1);
+    munit_assert_double(values[0], ==, 1000);
+    munit_assert_double_equal(values[1], 499500.0, 6);
+    munit_assert_double(values[2], ==, 0);
+    munit_assert_double(values[3], ==, 999);
+    munit_assert_double_equal(values[4], 499.5, 6);
+    munit_assert_double(values[5], ==, 499);
+    free(values);
+    // many windows, returned with a bulk transfer: every sample is in one of them
+    double total = 0;
+    ret = collector_remote_metric_query(rh, t_start, t_end, (t_end - t_start)/1000, 1, aggs, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_size(num_windows, >=, 1000);
+    for(w = 0; w < num_windows; w++)
+        total += values[w];
+    munit_assert_double(total, ==, 1000);
+    free(values);
+    // invalid step
+    ret = collector_remote_metric_query(rh, t_start, t_end, 0, 1, aggs, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    collector_remote_metric_handle_release(rh);
+    // one series per host
+    collector_query_series* series;
+    ret = collector_remote_query(context->client, context->addr, provider_id, "test", "query", NULL, "host",
+            t_start, t_end, t_end - t_start, 6, aggs, &num_windows, &num_series, &series);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_size(num_windows, ==, 1);
+    munit_assert_size(num_series, ==, 2);
+    munit_assert_string_equal(series[0].group, "host=a");
+    munit_assert_string_equal(series[1].group, "host=b");
+    munit_assert_double(series[1].values[0], ==, 1000);
+    munit_assert_double(series[1].values[2], ==, 1000);
+    munit_assert_double(series[1].values[3], ==, 1999);
+    free(series);
+    // a single series over both hosts
+    ret = collector_remote_query(context->client, context->addr, provider_id, "test", NULL, NULL, "",
+            t_start, t_end, t_end - t_start, 6, aggs, &num_windows, &num_series, &series);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_size(num_series, ==, 1);
+    munit_assert_uint64(series[0].num_metrics, ==, 2);
+    munit_assert_double(series[0].values[0], ==, 2000);
+    munit_assert_double(series[0].values[3], ==, 1999);
+    munit_assert_double(series[0].values[5], ==, 999);
+    free(series);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_ring(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    // create a metric that retains only its latest 100 samples
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.max_samples = 100;
+    ret = collector_metric_create_ext("test", "ring", COLLECTOR_TYPE_GAUGE,
+            "ring metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 250; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // fetching more than retained returns the latest 100, in order
+    collector_metric_handle_t rh = open_metric(context, "ring");
+    int64_t count = 1000;
+    uint64_t first_seq, next_seq;
+    collector_metric_buffer buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch_with_seq(rh, &count, &buf, &name, &ns, &first_seq, &next_seq);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 100);
+    munit_assert_int(first_seq, ==, 150);
+    munit_assert_int(next_seq, ==, 250);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(150 + i));
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_rollup(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    size_t num_windows;
+    double* values;
+    int i;
+    // rollups need a ring to age out of
+    struct collector_rollup_tier_args tiers[] = { { 1.0, 3600.0 }, { 60.0, 86400.0 } };
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.rollups = tiers;
+    args.num_rollups = 2;
+    ret = collector_metric_create_ext("test", "rollup", COLLECTOR_TYPE_GAUGE,
+            "rolled up metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    args.max_samples = 100;
+    double t_start = floor(ABT_get_wtime()) - 1;
+    ret = collector_metric_create_ext("test", "rollup", COLLECTOR_TYPE_GAUGE,
+            "rolled up metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 1000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    double t_end = ABT_get_wtime() + 2;
+    // the 900 samples that left the ring are counted from the first tier
+    collector_agg aggs[] = {
+        { COLLECTOR_AGG_COUNT, 0 }, { COLLECTOR_AGG_SUM, 0 }, { COLLECTOR_AGG_MIN, 0 },
+        { COLLECTOR_AGG_MAX, 0 }, { COLLECTOR_AGG_LAST, 0 }
+    };
+    collector_metric_handle_t rh = open_metric(context, "rollup");
+    ret = collector_remote_metric_query(rh, t_start, t_end, t_end - t_start, 5, aggs, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_size(num_windows, ==, 1);
+    munit_assert_double(values[0], ==, 1000);
+    munit_assert_double_equal(values[1], 499500.0, 6);
+    munit_assert_double(values[2], ==, 0);
+    munit_assert_double(values[3], ==, 999);
+    munit_assert_double(values[4], ==, 999);
+    free(values);
+    // quantiles are answered from the ring only
+    collector_agg quantile[] = { { COLLECTOR_AGG_COUNT, 0 }, { COLLECTOR_AGG_QUANTILE, 0 } };
+    ret = collector_remote_metric_query(rh, t_start, t_end, t_end - t_start, 2, quantile, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_double(values[0], ==, 100);
+    munit_assert_double(values[1], ==, 900);
+    free(values);
+    collector_remote_metric_handle_release(rh);
+    // a first tier of a few milliseconds evicts its buckets into the next one
+    struct collector_rollup_tier_args small_tiers[] = { { 0.001, 0.004 }, { 1.0, 3600.0 } };
+    args.rollups = small_tiers;
+    t_start = floor(ABT_get_wtime()) - 1;
+    ret = collector_metric_create_ext("test", "rollup_tiers", COLLECTOR_TYPE_GAUGE,
+            "rolled up metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 1000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+        // groups of 100 samples, 2 ms apart, fill different buckets of the first tier
+        if(i % 100 == 99) {
+            double t = ABT_get_wtime();
+            while(ABT_get_wtime() < t + 0.002)
+                ;
+        }
+    }
+    t_end = ABT_get_wtime() + 2;
+    collector_rollup_tier* tier = &m->rollup->tiers[1];
+    double second_count = tier->open.acc.count, second_sum = tier->open.acc.sum;
+    for(i = 0; i < (int)tier->count; i++) {
+        second_count += tier->buckets[i].acc.count;
+        second_sum   += tier->buckets[i].acc.sum;
+    }
+    munit_assert_uint64(m->rollup->tiers[0].count, >, m->rollup->tiers[0].capacity);
+    munit_assert_double(second_count, >, 0);
+    // with both tiers, every sample is counted once
+    rh = open_metric(context, "rollup_tiers");
+    ret = collector_remote_metric_query(rh, t_start, t_end, t_end - t_start, 5, aggs, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_size(num_windows, ==, 1);
+    munit_assert_double(values[0], ==, 1000);
+    munit_assert_double_equal(values[1], 499500.0, 6);
+    munit_assert_double(values[2], ==, 0);
+    munit_assert_double(values[3], ==, 999);
+    munit_assert_double(values[4], ==, 999);
+    free(values);
+    // windows finer than the second tier leave it out
+    ret = collector_remote_metric_query(rh, t_start, t_end, 0.5, 5, aggs, &num_windows, &values);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    double count = 0, sum = 0;
+    for(size_t w = 0; w < num_windows; w++) {
+        count += values[w*5];
+        sum   += values[w*5 + 1];
+    }
+    munit_assert_double(count, ==, 1000 - second_count);
+    munit_assert_double_equal(sum, 499500.0 - second_sum, 6);
+    free(values);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_sharded(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    // create a sharded metric and update it from this execution stream
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.sharded = 1;
+    ret = collector_metric_create_ext("test", "sharded", COLLECTOR_TYPE_GAUGE,
+            "sharded metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 100; i++) {
+        ret = collector_metric_update_gauge_by_fixed_amount(m, 2.0);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // the fetch merges the shards by timestamp
+    collector_metric_handle_t rh = open_metric(context, "sharded");
+    int64_t count = 10;
+    collector_metric_buffer buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 10);
+    for(i = 0; i < count; i++) {
+        munit_assert_double(buf[i].val, ==, 2.0*(91 + i));
+        if(i) munit_assert_double(buf[i].time, >=, buf[i-1].time);
+    }
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_compressed(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    // compression is only supported by unbounded, unsharded metrics
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.compressed = 1;
+    args.max_samples = 100;
+    ret = collector_metric_create_ext("test", "compressed", COLLECTOR_TYPE_GAUGE,
+            "compressed metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    // fill several chunks, so that all but the last one are compressed
+    args.max_samples = 0;
+    ret = collector_metric_create_ext("test", "compressed", COLLECTOR_TYPE_GAUGE,
+            "compressed metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = collector_metric_update(m, (double)(i % 7));
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // the two full chunks are sealed, well below their raw size
+    for(i = 0; i < 2; i++) {
+        munit_assert_not_null(m->store.dir->packed[i]);
+        munit_assert_null(m->store.dir->chunks[i]);
+        munit_assert_size(m->store.dir->packed[i]->num_words*sizeof(uint64_t), <,
+                COLLECTOR_CHUNK_SAMPLES*sizeof(collector_metric_sample)/2);
+    }
+    munit_assert_null(m->store.dir->packed[2]);
+    // the fetch decodes the compressed chunks
+    collector_metric_handle_t rh = open_metric(context, "compressed");
+    int64_t count = 10000;
+    collector_metric_buffer buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, ==, 10000);
+    for(i = 0; i < count; i++) {
+        munit_assert_double(buf[i].val, ==, (double)(i % 7));
+        if(i) munit_assert_double(buf[i].time, >=, buf[i-1].time);
+    }
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_sampled(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    int i;
+    // create a counter whose value is recorded every 50ms
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.sampling_period = 0.05;
+    ret = collector_metric_create_ext("test", "sampled", COLLECTOR_TYPE_COUNTER,
+            "sampled metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    for(i = 0; i < 100000; i++) {
+        ret = collector_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    }
+    // counters can't go backward
+    ret = collector_metric_update(m, 1.0);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_VALUE);
+    margo_thread_sleep(context->mid, 300);
+    // only the snapshots have been recorded
+    collector_metric_handle_t rh = open_metric(context, "sampled");
+    int64_t count = 1000;
+    collector_metric_buffer buf;
+    char *name, *ns;
+    ret = collector_remote_metric_fetch(rh, &count, &buf, &name, &ns);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(count, >=, 2);
+    munit_assert_int(count, <, 100);
+    munit_assert_double(buf[count-1].val, ==, 99999.0);
+    free(buf);
+    free(name);
+    free(ns);
+    collector_remote_metric_handle_release(rh);
+    // timers can't be sampled
+    ret = collector_metric_create_ext("test", "sampled_timer", COLLECTOR_TYPE_TIMER,
+            "sampled timer", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_histogram(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m;
+    collector_return_t ret;
+    // create a histogram with buckets (-inf,1) [1,2) [2,5) [5,+inf)
+    double bounds[3] = { 1.0, 2.0, 5.0 };
+    struct collector_metric_args args = COLLECTOR_METRIC_ARGS_INIT;
+    args.bounds = bounds;
+    args.num_bounds = 3;
+    ret = collector_metric_create_ext("test", "histogram", COLLECTOR_TYPE_HISTOGRAM,
+            "histogram metric", context->taglist, &args, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    collector_metric_update(m, 0.5);
+    collector_metric_update(m, 1.0);
+    collector_metric_update(m, 1.5);
+    collector_metric_update(m, 4.0);
+    collector_metric_update(m, 7.0);
+    collector_metric_update(m, 9.0);
+    // fetch the buckets
+    collector_metric_handle_t rh = open_metric(context, "histogram");
+    size_t num_buckets;
+    double* fetched_bounds;
+    uint64_t* counts;
+    ret = collector_remote_metric_fetch_histogram(rh, &num_buckets, &fetched_bounds, &counts);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(num_buckets, ==, 4);
+    munit_assert_double(fetched_bounds[2], ==, 5.0);
+    munit_assert_int(counts[0], ==, 1);
+    munit_assert_int(counts[1], ==, 2);
+    munit_assert_int(counts[2], ==, 1);
+    munit_assert_int(counts[3], ==, 2);
+    free(fetched_bounds);
+    free(counts);
+    collector_remote_metric_handle_release(rh);
+    // histograms need buckets
+    ret = collector_metric_create_ext("test", "histogram_nobuckets", COLLECTOR_TYPE_HISTOGRAM,
+            "histogram metric", context->taglist, NULL, &m, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_sketch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    collector_metric_t m1, m2;
+    collector_return_t ret;
+    unsigned i;
+    // two sketches with the default accuracy (1%)
+    ret = collector_metric_create_ext("test", "sketch1", COLLECTOR_TYPE_SKETCH,
+            "sketch metric", context->taglist, NULL, &m1, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    ret = collector_metric_create_ext("test", "sketch2", COLLECTOR_TYPE_SKETCH,
+            "sketch metric", context->taglist, NULL, &m2, context->provider);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    // 1..1000 split across the two sketches
+    for(i = 1; i <= 1000; i++)
+        collector_metric_update(i % 2 ? m1 : m2, (double)i);
+    // fetch and merge them
+    collector_sketch_t merged, fetched;
+    ret = collector_sketch_create(0.01, &merged);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    collector_metric_handle_t rh = open_metric(context, "sketch1");
+    ret = collector_remote_metric_fetch_sketch(rh, &fetched);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(collector_sketch_count(fetched), ==, 500);
+    munit_assert_int(collector_sketch_merge(merged, fetched), ==, COLLECTOR_SUCCESS);
+    collector_sketch_destroy(fetched);
+    collector_remote_metric_handle_release(rh);
+    rh = open_metric(context, "sketch2");
+    ret = collector_remote_metric_fetch_sketch(rh, &fetched);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    munit_assert_int(collector_sketch_merge(merged, fetched), ==, COLLECTOR_SUCCESS);
+    collector_sketch_destroy(fetched);
+    collector_remote_metric_handle_release(rh);
+    // quantiles are within 1% of the exact ones
+    double q;
+    munit_assert_int(collector_sketch_count(merged), ==, 1000);
+    collector_sketch_quantile(merged, 0.5, &q);
+    munit_assert_double_equal(q/500.0, 1.0, 2);
+    collector_sketch_quantile(merged, 0.99, &q);
+    munit_assert_double_equal(q/990.0, 1.0, 2);
+    collector_sketch_destroy(merged);
+    // sketches with a different accuracy can't be merged
+    collector_sketch_t s1, s2;
+    collector_sketch_create(0.01, &s1);
+    collector_sketch_create(0.05, &s2);
+    munit_assert_int(collector_sketch_merge(s1, s2), ==, COLLECTOR_ERR_INVALID_ARGS);
+    // a number of entries that doesn't fit in the buffer is rejected, even
+    // if its size wraps (it is the last 8 bytes of the serialized header)
+    void* serialized;
+    size_t size;
+    uint64_t num_entries = (uint64_t)1 << 60;
+    ret = collector_sketch_serialize(s1, &serialized, &size);
+    munit_assert_int(ret, ==, COLLECTOR_SUCCESS);
+    memcpy((char*)serialized + size - sizeof(num_entries), &num_entries, sizeof(num_entries));
+    ret = collector_sketch_deserialize(serialized, size, &fetched);
+    munit_assert_int(ret, ==, COLLECTOR_ERR_INVALID_ARGS);
+    free(serialized);
+    collector_sketch_destroy(s1);
+    collector_sketch_destroy(s2);
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/fetch", test_fetch, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/encodings", test_encodings, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/range", test_range, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/dump", test_dump, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/downsampled", test_downsampled, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/since", test_since, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/batch", test_batch, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/async", test_async, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/list",  test_list,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/ids",   test_ids,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/labels", test_labels, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/columns", test_columns, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/stats", test_stats, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/query", test_query, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/ring",  test_ring,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/rollup", test_rollup, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/sharded", test_sharded, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/compressed", test_compressed, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/sampled", test_sampled, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/histogram", test_histogram, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/sketch", test_sketch, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/collector/metric", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "collector", argc, argv);
+}
@@ -0,0 +1,140 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <collector/collector-dump.h>
+
+/*
+ * Converts a dump written by collector_metric_dump_raw_data to CSV (one
+ * "time,val,sample_id" line per sample) or to a JSON object holding the
+ * metadata of the metric and its samples as [time, val, sample_id] arrays.
+ */
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "Usage: %s [--csv|--json] <dump file> [<output file>]\n", argv0);
+}
+
+static void print_json_string(FILE* out, const char* s)
+{
+    fputc('"', out);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* JSON has no NaN nor infinity */
+static void print_json_double(FILE* out, double d)
+{
+    if(isfinite(d))
+        fprintf(out, "%.17g", d);
+    else
+        fputs("null", out);
+}
+
+static void convert_csv(collector_dump_t dump, const collector_dump_info* info, FILE* out)
+{
+    const double *time, *val;
+    const uint64_t* sample_id;
+    uint64_t c, i, n;
+
+    fprintf(out, "time,val,sample_id\n");
+    for(c = 0; c < info->num_chunks; c++) {
+        n = collector_dump_chunk(dump, c, &time, &val, &sample_id);
+        for(i = 0; i < n; i++)
+            fprintf(out, "%.17g,%.17g,%" PRIu64 "\n", time[i], val[i], sample_id[i]);
+    }
+}
+
+static void convert_json(collector_dump_t dump, const collector_dump_info* info, FILE* out)
+{
+    const double *time, *val;
+    const uint64_t* sample_id;
+    uint64_t c, i, n;
+    size_t t;
+
+    fprintf(out, "{\n  \"id\": %" PRIu64 ",\n  \"type\": %d,\n  \"ns\": ", info->id, (int)info->type);
+    print_json_string(out, info->ns);
+    fprintf(out, ",\n  \"name\": ");
+    print_json_string(out, info->name);
+    fprintf(out, ",\n  \"desc\": ");
+    print_json_string(out, info->desc);
+    fprintf(out, ",\n  \"tags\": [");
+    for(t = 0; t < info->num_tags; t++) {
+        if(t) fputs(", ", out);
+        print_json_string(out, info->tags[t]);
+    }
+    fprintf(out, "],\n  \"num_samples\": %" PRIu64 ",\n  \"samples\": [", info->num_samples);
+    for(c = 0; c < info->num_chunks; c++) {
+        n = collector_dump_chunk(dump, c, &time, &val, &sample_id);
+        for(i = 0; i < n; i++) {
+            fputs(c || i ? ",\n    [" : "\n    [", out);
+            print_json_double(out, time[i]);
+            fputs(", ", out);
+            print_json_double(out, val[i]);
+            fprintf(out, ", %" PRIu64 "]", sample_id[i]);
+        }
+    }
+    fprintf(out, "%s]\n}\n", info->num_samples ? "\n  " : "");
+}
+
+int main(int argc, char** argv)
+{
+    collector_dump_t dump;
+    collector_dump_info info;
+    collector_return_t ret;
+    FILE* out = stdout;
+    int json = 0, arg = 1;
+
+    if(arg < argc && !strcmp(argv[arg], "--csv")) {
+        arg++;
+    } else if(arg < argc && !strcmp(argv[arg], "--json")) {
+        json = 1;
+        arg++;
+    }
+    if(arg != argc - 1 && arg != argc - 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ret = collector_dump_open(argv[arg], &dump);
+    if(ret != COLLECTOR_SUCCESS) {
+        fprintf(stderr, "Error: could not open dump %s (%d)\n", argv[arg], ret);
+        return 1;
+    }
+    if(arg == argc - 2) {
+        out = fopen(argv[arg + 1], "w");
+        if(!out) {
+            fprintf(stderr, "Error: could not open %s\n", argv[arg + 1]);
+            collector_dump_close(dump);
+            return 1;
+        }
+    }
+
+    collector_dump_get_info(dump, &info);
+    if(json)
+        convert_json(dump, &info, out);
+    else
+        convert_csv(dump, &info, out);
+
+    ret = fflush(out) == 0 && !ferror(out) ? COLLECTOR_SUCCESS : COLLECTOR_ERR_IO;
+    if(out != stdout)
+        fclose(out);
+    collector_dump_close(dump);
+    if(ret != COLLECTOR_SUCCESS) {
+        fprintf(stderr, "Error: could not write the converted dump\n");
+        return 1;
+    }
+    return 0;
+}